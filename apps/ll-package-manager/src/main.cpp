@@ -40,6 +40,9 @@ void withDBusDaemon()
 
     auto *ostreeRepo = new linglong::repo::OSTreeRepo(repoRoot, *config, *clientFactory);
     ostreeRepo->setParent(QCoreApplication::instance());
+    // layers installed as images are mounted again after a reboot, before the service is
+    // registered. ll-cli activates the service when it finds an image unmounted.
+    ostreeRepo->mountLayerImages();
 
     QDBusConnection conn = QDBusConnection::systemBus();
     auto *packageManager =
@@ -93,6 +96,8 @@ void withoutDBusDaemon()
 
     auto *ostreeRepo = new linglong::repo::OSTreeRepo(repoRoot, *config, *clientFactory);
     ostreeRepo->setParent(QCoreApplication::instance());
+    // layers installed as images are mounted again after a reboot
+    ostreeRepo->mountLayerImages();
 
     auto packageManager =
       new linglong::service::PackageManager(*ostreeRepo, QCoreApplication::instance());
@@ -9,8 +9,10 @@
 #include <getopt.h>
 #include <libelf.h>
 #include <linux/limits.h>
+#include <linux/loop.h>
 #include <nlohmann/json.hpp>
 #include <openssl/evp.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
 
 #include <algorithm>
@@ -18,11 +20,16 @@
 #include <atomic>
 #include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <optional>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 #include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -336,6 +343,292 @@ std::string calculateDigest(int fd, std::size_t bundleOffset, std::size_t bundle
     return stream.str();
 }
 
+std::string toHex(const unsigned char *data, unsigned int length) noexcept
+{
+    std::stringstream stream;
+    stream << std::setfill('0') << std::hex;
+
+    for (auto i = 0U; i < length; i++) {
+        stream << std::setw(2) << static_cast<unsigned int>(data[i]);
+    }
+
+    return stream.str();
+}
+
+bool sha256(const unsigned char *data, std::size_t length, std::array<unsigned char, 32> &out)
+{
+    unsigned int outLength{ 0 };
+    return EVP_Digest(data, length, out.data(), &outLength, EVP_sha256(), nullptr) == 1
+      && outLength == out.size();
+}
+
+// the same as linglong::package::maxMerkleChunkSize
+constexpr int64_t maxMerkleChunkSize = 1024 * 1024 * 1024;
+
+// Checks a bundle with a chunked digest, the chunks are hashed on all cores. It's the same as
+// linglong::package::calculateMerkle.
+bool verifyMerkle(int fd,
+                  std::size_t bundleOffset,
+                  std::size_t bundleLength,
+                  const linglong::api::types::v1::UabMerkle &merkle,
+                  const std::string &root) noexcept
+try {
+    if (merkle.chunkSize <= 0 || merkle.chunkSize > maxMerkleChunkSize) {
+        std::cerr << "invalid chunk size " << merkle.chunkSize << std::endl;
+        return false;
+    }
+
+    auto chunkSize = static_cast<std::size_t>(merkle.chunkSize);
+    auto count = (bundleLength + chunkSize - 1) / chunkSize;
+    if (count != merkle.chunks.size()) {
+        std::cerr << "expected " << merkle.chunks.size() << " chunks, got " << count << std::endl;
+        return false;
+    }
+
+    // the range comes from the section header, reading a mapping past the end raises SIGBUS
+    struct stat sb
+    {
+    };
+
+    if (::fstat(fd, &sb) == -1) {
+        std::cerr << "fstat() error:" << ::strerror(errno) << std::endl;
+        return false;
+    }
+
+    auto fileSize = static_cast<std::size_t>(sb.st_size);
+    if (bundleOffset > fileSize || bundleLength > fileSize - bundleOffset) {
+        std::cerr << "bundle section exceeds the file" << std::endl;
+        return false;
+    }
+
+    auto pageSize = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    auto alignedOffset = bundleOffset / pageSize * pageSize;
+    auto mappedLength = bundleLength + bundleOffset - alignedOffset;
+    auto *addr = ::mmap(nullptr, mappedLength, PROT_READ, MAP_PRIVATE, fd, alignedOffset);
+    if (addr == MAP_FAILED) {
+        std::cerr << "mmap() error:" << ::strerror(errno) << std::endl;
+        return false;
+    }
+    auto unmap = defer([addr, mappedLength] {
+        ::munmap(addr, mappedLength);
+    });
+    ::madvise(addr, mappedLength, MADV_WILLNEED);
+
+    const auto *data = static_cast<const unsigned char *>(addr) + (bundleOffset - alignedOffset);
+    std::vector<std::array<unsigned char, 32>> hashes(count);
+    std::atomic_size_t next{ 0 };
+    std::atomic_bool failed{ false };
+    auto worker = [&]() {
+        for (auto i = next++; i < count && !failed; i = next++) {
+            auto size = std::min(chunkSize, bundleLength - i * chunkSize);
+            if (!sha256(data + i * chunkSize, size, hashes[i])
+                || toHex(hashes[i].data(), hashes[i].size()) != merkle.chunks[i]) {
+                std::cerr << "sha256 of chunk " << i << " mismatched" << std::endl;
+                failed = true;
+            }
+        }
+    };
+
+    auto jobs = std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1U), count);
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < jobs; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : workers) {
+        thread.join();
+    }
+    if (failed) {
+        return false;
+    }
+
+    std::array<unsigned char, 32> rootHash{};
+    const auto *chunkHashes = reinterpret_cast<const unsigned char *>(hashes.data()); // NOLINT
+    if (!sha256(chunkHashes, hashes.size() * rootHash.size(), rootHash)
+        || toHex(rootHash.data(), rootHash.size()) != root) {
+        std::cerr << "root of chunk digests mismatched, expected: " << root << std::endl;
+        return false;
+    }
+
+    return true;
+} catch (const std::exception &e) {
+    std::cerr << "failed to verify chunk digests: " << e.what() << std::endl;
+    return false;
+}
+
+// The digest cache shares its format with linglong::package::UABDigestCache, keep them in sync.
+// An entry records the identity of a verified bundle, any change to the file invalidates it.
+std::filesystem::path digestCacheDir() noexcept
+{
+    const auto *runtimeDir = ::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir != nullptr && runtimeDir[0] != '\0') {
+        return std::filesystem::path{ runtimeDir } / "linglong" / "uab-verified";
+    }
+
+    const auto *cacheDir = ::getenv("XDG_CACHE_HOME");
+    if (cacheDir != nullptr && cacheDir[0] != '\0') {
+        return std::filesystem::path{ cacheDir } / "linglong" / "uab-verified";
+    }
+
+    const auto *home = ::getenv("HOME");
+    return std::filesystem::path{ home != nullptr ? home : "/tmp" } / ".cache" / "linglong"
+      / "uab-verified";
+}
+
+// returns the name and the content of the cache entry
+std::optional<std::pair<std::string, std::string>> digestCacheEntry(int fd,
+                                                                    std::string_view digest)
+{
+    struct stat sb
+    {
+    };
+
+    if (::fstat(fd, &sb) == -1) {
+        return std::nullopt;
+    }
+
+    std::ostringstream stamp;
+    stamp << sb.st_size << ' ' << sb.st_mtim.tv_sec << '.' << sb.st_mtim.tv_nsec << ' '
+          << sb.st_ctim.tv_sec << '.' << sb.st_ctim.tv_nsec << ' ' << digest;
+    return std::make_pair(std::to_string(sb.st_dev) + "-" + std::to_string(sb.st_ino),
+                          stamp.str());
+}
+
+bool digestVerified(int fd, std::string_view digest) noexcept
+try {
+    auto entry = digestCacheEntry(fd, digest);
+    if (!entry) {
+        return false;
+    }
+
+    std::ifstream ifs(digestCacheDir() / entry->first);
+    std::string stamp;
+    return ifs.is_open() && std::getline(ifs, stamp) && stamp == entry->second;
+} catch (...) {
+    return false;
+}
+
+void markDigestVerified(int fd, std::string_view digest) noexcept
+try {
+    auto entry = digestCacheEntry(fd, digest);
+    if (!entry) {
+        return;
+    }
+
+    auto dir = digestCacheDir();
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec) {
+        return;
+    }
+    std::filesystem::permissions(dir, std::filesystem::perms::owner_all, ec);
+
+    auto file = dir / entry->first;
+    auto tmpFile = file;
+    tmpFile += "." + std::to_string(::getpid()) + ".tmp";
+    {
+        std::ofstream ofs(tmpFile, std::ios::trunc);
+        if (!ofs.is_open() || !(ofs << entry->second << '\n').flush()) {
+            return;
+        }
+    }
+
+    std::filesystem::rename(tmpFile, file, ec);
+    if (ec) {
+        std::filesystem::remove(tmpFile, ec);
+    }
+} catch (...) {
+    // the bundle is hashed again next time
+}
+
+// Attaches fd to loop with LOOP_SET_FD and LOOP_SET_STATUS64, for kernels before 5.8 and kernel
+// headers without LOOP_CONFIGURE.
+int setLoopFd(int loop, int fd, const loop_info64 &info) noexcept
+{
+    if (::ioctl(loop, LOOP_SET_FD, fd) == -1) {
+        return -1;
+    }
+
+    if (::ioctl(loop, LOOP_SET_STATUS64, &info) == -1) {
+        auto error = errno;
+        ::ioctl(loop, LOOP_CLR_FD, 0);
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Mounts the bundle with the kernel erofs driver over a loop device, which is released
+// automatically after unmounting.
+bool mountWithLoop(int fd, uint64_t offset, uint64_t size) noexcept
+{
+    auto control = ::open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (control == -1) {
+        return false;
+    }
+    auto closeControl = defer([control] {
+        ::close(control);
+    });
+
+    loop_info64 info{};
+    info.lo_offset = offset;
+    info.lo_sizelimit = size;
+    info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR;
+#ifdef LOOP_CONFIGURE
+    loop_config config{};
+    config.fd = static_cast<__u32>(fd);
+    config.info = info;
+#endif
+
+    constexpr int maxRetries = 8;
+    for (int i = 0; i < maxRetries; ++i) {
+        auto index = ::ioctl(control, LOOP_CTL_GET_FREE);
+        if (index < 0) {
+            return false;
+        }
+
+        auto device = "/dev/loop" + std::to_string(index);
+        auto loop = ::open(device.c_str(), O_RDONLY | O_CLOEXEC);
+        if (loop == -1) {
+            return false;
+        }
+        auto closeLoop = defer([loop] {
+            ::close(loop);
+        });
+
+#ifdef LOOP_CONFIGURE
+        auto ret = ::ioctl(loop, LOOP_CONFIGURE, &config);
+        if (ret == -1 && (errno == EINVAL || errno == ENOTTY)) {
+            ret = setLoopFd(loop, fd, info);
+        }
+#else
+        auto ret = setLoopFd(loop, fd, info);
+#endif
+        if (ret == -1) {
+            if (errno == EBUSY) {
+                continue;
+            }
+            return false;
+        }
+
+        if (::mount(device.c_str(),
+                    mountPoint.c_str(),
+                    "erofs",
+                    MS_RDONLY | MS_NODEV | MS_NOSUID,
+                    nullptr)
+            == -1) {
+            std::cerr << "kernel mount failed, fall back to erofsfuse: " << ::strerror(errno)
+                      << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
 int mountSelfBundle(std::string_view selfBin,
                     const linglong::api::types::v1::UabMetaInfo &meta) noexcept
 {
@@ -356,11 +649,28 @@ int mountSelfBundle(std::string_view selfBin,
     }
 
     auto bundleOffset = bundleSh->sh_offset;
-    if (auto digest = calculateDigest(selfBinFd, bundleOffset, bundleSh->sh_size);
-        digest != meta.digest) {
-        std::cerr << "sha256 mismatched, expected: " << meta.digest << " calculated: " << digest
-                  << std::endl;
-        return -1;
+    if (!digestVerified(selfBinFd, meta.digest)) {
+        if (meta.merkle) {
+            if (!verifyMerkle(selfBinFd,
+                              bundleOffset,
+                              bundleSh->sh_size,
+                              *meta.merkle,
+                              meta.digest)) {
+                return -1;
+            }
+        } else if (auto digest = calculateDigest(selfBinFd, bundleOffset, bundleSh->sh_size);
+                   digest != meta.digest) {
+            std::cerr << "sha256 mismatched, expected: " << meta.digest
+                      << " calculated: " << digest << std::endl;
+            return -1;
+        }
+
+        markDigestVerified(selfBinFd, meta.digest);
+    }
+
+    // the kernel driver avoids a round trip to userspace for every read, but requires root
+    if (::geteuid() == 0 && mountWithLoop(selfBinFd, bundleOffset, bundleSh->sh_size)) {
+        return 0;
     }
 
     auto offsetStr = "--offset=" + std::to_string(bundleOffset);
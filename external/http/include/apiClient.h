@@ -24,11 +24,23 @@ typedef struct apiClient_t {
     sslConfig_t *sslConfig;
     void *dataReceived;
     long dataReceivedLen;
+    long dataReceivedCapacity;  /* allocated size of dataReceived, grows geometrically */
     void (*data_callback_func)(void **, long *);
+    /*
+     * If set, the response body is passed to stream_func chunk by chunk instead of being kept in
+     * dataReceived. Returning anything other than len aborts the transfer.
+     */
+    size_t (*stream_func)(const char *data, size_t len, void *userdata);
+    void *stream_data;
+    /* If set, every response header line is passed to header_func, e.g. to read the ETag */
+    void (*header_func)(const char *header, size_t len, void *userdata);
+    void *header_data;
     int (*progress_func)(void *, curl_off_t, curl_off_t, curl_off_t, curl_off_t);
     void *progress_data;
     long response_code;
     list_t *apiKeys_Token;
+    CURL *curlHandle;   /* reused by apiClient_invoke if set, owned by the creator of apiClient */
+    CURLSH *curlShare;  /* shares DNS, TLS session and connection caches between handles */
 } apiClient_t;
 
 apiClient_t* apiClient_create();
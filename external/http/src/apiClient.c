@@ -1,10 +1,12 @@
 #include <curl/curl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include "../include/apiClient.h"
 
 size_t writeDataCallback(void *buffer, size_t size, size_t nmemb, void *userp);
+size_t writeHeaderCallback(char *buffer, size_t size, size_t nitems, void *userp);
 
 apiClient_t *apiClient_create() {
     apiClient_t *apiClient = malloc(sizeof(apiClient_t));
@@ -12,10 +14,17 @@ apiClient_t *apiClient_create() {
     apiClient->sslConfig = NULL;
     apiClient->dataReceived = NULL;
     apiClient->dataReceivedLen = 0;
+    apiClient->dataReceivedCapacity = 0;
     apiClient->data_callback_func = NULL;
+    apiClient->stream_func = NULL;
+    apiClient->stream_data = NULL;
+    apiClient->header_func = NULL;
+    apiClient->header_data = NULL;
     apiClient->progress_func = NULL;
     apiClient->progress_data = NULL;
     apiClient->response_code = 0;
+    apiClient->curlHandle = NULL;
+    apiClient->curlShare = NULL;
     apiClient->apiKeys_Token = NULL;
 
     return apiClient;
@@ -40,10 +49,17 @@ apiClient_t *apiClient_create_with_base_path(const char *basePath
 
     apiClient->dataReceived = NULL;
     apiClient->dataReceivedLen = 0;
+    apiClient->dataReceivedCapacity = 0;
     apiClient->data_callback_func = NULL;
+    apiClient->stream_func = NULL;
+    apiClient->stream_data = NULL;
+    apiClient->header_func = NULL;
+    apiClient->header_data = NULL;
     apiClient->progress_func = NULL;
     apiClient->progress_data = NULL;
     apiClient->response_code = 0;
+    apiClient->curlHandle = NULL;
+    apiClient->curlShare = NULL;
     if(apiKeys_Token!= NULL) {
         apiClient->apiKeys_Token = list_createList();
         listEntry_t *listEntry = NULL;
@@ -209,7 +225,13 @@ void apiClient_invoke(apiClient_t    *apiClient,
                       list_t        *contentType,
                       const char    *bodyParameters,
                       const char    *requestType) {
-    CURL *handle = curl_easy_init();
+    // a handle reused between requests keeps its connections alive
+    CURL *handle = apiClient->curlHandle;
+    if(handle) {
+        curl_easy_reset(handle);
+    } else {
+        handle = curl_easy_init();
+    }
     CURLcode res;
 
     if(handle) {
@@ -430,8 +452,17 @@ void apiClient_invoke(apiClient_t    *apiClient,
         curl_easy_setopt(handle,
                          CURLOPT_WRITEDATA,
                          apiClient);
+        curl_easy_setopt(handle,
+                         CURLOPT_HEADERFUNCTION,
+                         writeHeaderCallback);
+        curl_easy_setopt(handle,
+                         CURLOPT_HEADERDATA,
+                         apiClient);
         curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
         curl_easy_setopt(handle, CURLOPT_VERBOSE, 0); // to get curl debug msg 0: to disable, 1L:to enable
+        if(apiClient->curlShare) {
+            curl_easy_setopt(handle, CURLOPT_SHARE, apiClient->curlShare);
+        }
 
 
         if(bodyParameters != NULL) {
@@ -457,7 +488,9 @@ void apiClient_invoke(apiClient_t    *apiClient,
             curl_easy_strerror(res));
         }
 
-        curl_easy_cleanup(handle);
+        if(handle != apiClient->curlHandle) {
+            curl_easy_cleanup(handle);
+        }
         if(formParameters != NULL) {
             free(formString);
             curl_mime_free(mime);
@@ -465,15 +498,79 @@ void apiClient_invoke(apiClient_t    *apiClient,
     }
 }
 
+// makes room for at least `needed` bytes in dataReceived, returns 0 on failure
+static int reserveDataReceived(apiClient_t *apiClient, long needed) {
+    // the buffer is freed and reset by the callers of apiClient_invoke without touching the capacity
+    if(apiClient->dataReceived == NULL) {
+        apiClient->dataReceivedCapacity = 0;
+    }
+    if(needed <= apiClient->dataReceivedCapacity) {
+        return 1;
+    }
+
+    // grow geometrically, so a large response is copied O(log n) times rather than once per chunk
+    long capacity = apiClient->dataReceivedCapacity * 2;
+    if(capacity < needed) {
+        capacity = needed;
+    }
+    void *data = realloc(apiClient->dataReceived, capacity);
+    if(data == NULL) {
+        return 0;
+    }
+    apiClient->dataReceived = data;
+    apiClient->dataReceivedCapacity = capacity;
+    return 1;
+}
+
+size_t writeHeaderCallback(char *buffer, size_t size, size_t nitems, void *userp) {
+    size_t size_this_time = nitems * size;
+    apiClient_t *apiClient = (apiClient_t *)userp;
+    static const char contentLength[] = "content-length:";
+    size_t prefixLen = sizeof(contentLength) - 1;
+    if(apiClient->header_func != NULL) {
+        apiClient->header_func(buffer, size_this_time, apiClient->header_data);
+    }
+    if(apiClient->stream_func != NULL || size_this_time <= prefixLen ||
+       strncasecmp(buffer, contentLength, prefixLen) != 0)
+    {
+        return size_this_time;
+    }
+
+    // presize the buffer for the whole body, a bogus length only costs an early allocation
+    char value[32] = { 0 };
+    size_t valueLen = size_this_time - prefixLen;
+    if(valueLen >= sizeof(value)) {
+        return size_this_time;
+    }
+    memcpy(value, buffer + prefixLen, valueLen);
+    long length = strtol(value, NULL, 10);
+    if(length > 0) {
+        reserveDataReceived(apiClient, apiClient->dataReceivedLen + length + 1);
+    }
+    return size_this_time;
+}
+
 size_t writeDataCallback(void *buffer, size_t size, size_t nmemb, void *userp) {
     size_t size_this_time = nmemb * size;
     apiClient_t *apiClient = (apiClient_t *)userp;
-    apiClient->dataReceived = (char *)realloc( apiClient->dataReceived, apiClient->dataReceivedLen + size_this_time + 1);
+    if(apiClient->stream_func != NULL) {
+        return apiClient->stream_func((const char *)buffer, size_this_time, apiClient->stream_data);
+    }
+
+    // the space size of (apiClient->dataReceived) >= dataReceivedLen + 1
+    if(!reserveDataReceived(apiClient, apiClient->dataReceivedLen + size_this_time + 1)) {
+        return 0;
+    }
     memcpy((char *)apiClient->dataReceived + apiClient->dataReceivedLen, buffer, size_this_time);
     apiClient->dataReceivedLen += size_this_time;
-    ((char*)apiClient->dataReceived)[apiClient->dataReceivedLen] = '\0'; // the space size of (apiClient->dataReceived) = dataReceivedLen + 1
+    ((char*)apiClient->dataReceived)[apiClient->dataReceivedLen] = '\0';
     if (apiClient->data_callback_func) {
+        void *data = apiClient->dataReceived;
         apiClient->data_callback_func(&apiClient->dataReceived, &apiClient->dataReceivedLen);
+        // the callback took over the buffer, only its content is known to be valid
+        if(apiClient->dataReceived != data) {
+            apiClient->dataReceivedCapacity = apiClient->dataReceivedLen + 1;
+        }
     }
     return size_this_time;
 }
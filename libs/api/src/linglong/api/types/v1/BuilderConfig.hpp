@@ -40,6 +40,15 @@ std::optional<std::string> arch;
 */
 std::optional<std::string> cache;
 /**
+* compression of erofs images made by ll-builder, one of lz4, lz4hc, lzma and zstd with an
+* optional level, e.g. "zstd,15"
+*/
+std::optional<std::string> erofsCompression;
+/**
+* threads used by mkfs.erofs to compress images, 0 for all cores
+*/
+std::optional<int64_t> erofsWorkers;
+/**
 * use offline mode when build
 */
 std::optional<bool> offline;
@@ -22,6 +22,7 @@
 #include "linglong/api/types/v1/Version.hpp"
 #include "linglong/api/types/v1/Sections.hpp"
 #include "linglong/api/types/v1/UabLayer.hpp"
+#include "linglong/api/types/v1/UabMerkle.hpp"
 #include "linglong/api/types/v1/RepositoryCache.hpp"
 #include "linglong/api/types/v1/RepositoryCacheLayersItem.hpp"
 #include "linglong/api/types/v1/RepoConfig.hpp"
@@ -150,6 +151,9 @@ void to_json(json & j, const RepositoryCache & x);
 void from_json(const json & j, UabLayer & x);
 void to_json(json & j, const UabLayer & x);
 
+void from_json(const json & j, UabMerkle & x);
+void to_json(json & j, const UabMerkle & x);
+
 void from_json(const json & j, Sections & x);
 void to_json(json & j, const Sections & x);
 
@@ -215,6 +219,8 @@ j["version"] = x.version;
 inline void from_json(const json & j, BuilderConfig& x) {
 x.arch = get_stack_optional<std::string>(j, "arch");
 x.cache = get_stack_optional<std::string>(j, "cache");
+x.erofsCompression = get_stack_optional<std::string>(j, "erofs_compression");
+x.erofsWorkers = get_stack_optional<int64_t>(j, "erofs_workers");
 x.offline = get_stack_optional<bool>(j, "offline");
 x.repo = j.at("repo").get<std::string>();
 x.skipCheckOutput = get_stack_optional<bool>(j, "skip_check_output");
@@ -233,6 +239,12 @@ j["arch"] = x.arch;
 if (x.cache) {
 j["cache"] = x.cache;
 }
+if (x.erofsCompression) {
+j["erofs_compression"] = x.erofsCompression;
+}
+if (x.erofsWorkers) {
+j["erofs_workers"] = x.erofsWorkers;
+}
 if (x.offline) {
 j["offline"] = x.offline;
 }
@@ -674,6 +686,7 @@ j["version"] = x.version;
 
 inline void from_json(const json & j, RepositoryCacheLayersItem& x) {
 x.commit = j.at("commit").get<std::string>();
+x.image = get_stack_optional<bool>(j, "image");
 x.info = j.at("info").get<PackageInfoV2>();
 x.repo = j.at("repo").get<std::string>();
 }
@@ -681,6 +694,9 @@ x.repo = j.at("repo").get<std::string>();
 inline void to_json(json & j, const RepositoryCacheLayersItem & x) {
 j = json::object();
 j["commit"] = x.commit;
+if (x.image) {
+j["image"] = x.image;
+}
 j["info"] = x.info;
 j["repo"] = x.repo;
 }
@@ -715,6 +731,17 @@ j["info"] = x.info;
 j["minified"] = x.minified;
 }
 
+inline void from_json(const json & j, UabMerkle& x) {
+x.chunks = j.at("chunks").get<std::vector<std::string>>();
+x.chunkSize = j.at("chunkSize").get<int64_t>();
+}
+
+inline void to_json(json & j, const UabMerkle & x) {
+j = json::object();
+j["chunks"] = x.chunks;
+j["chunkSize"] = x.chunkSize;
+}
+
 inline void from_json(const json & j, Sections& x) {
 x.bundle = j.at("bundle").get<std::string>();
 x.icon = get_stack_optional<std::string>(j, "icon");
@@ -731,6 +758,7 @@ j["icon"] = x.icon;
 inline void from_json(const json & j, UabMetaInfo& x) {
 x.digest = j.at("digest").get<std::string>();
 x.layers = j.at("layers").get<std::vector<UabLayer>>();
+x.merkle = get_stack_optional<UabMerkle>(j, "merkle");
 x.sections = j.at("sections").get<Sections>();
 x.uuid = j.at("uuid").get<std::string>();
 x.version = j.at("version").get<Version>();
@@ -740,6 +768,9 @@ inline void to_json(json & j, const UabMetaInfo & x) {
 j = json::object();
 j["digest"] = x.digest;
 j["layers"] = x.layers;
+if (x.merkle) {
+j["merkle"] = x.merkle;
+}
 j["sections"] = x.sections;
 j["uuid"] = x.uuid;
 j["version"] = x.version;
@@ -874,12 +905,14 @@ j["UABMetaInfo"] = x.uabMetaInfo;
 
 inline void from_json(const json & j, Version & x) {
 if (j == "1") x = Version::The1;
+else if (j == "2") x = Version::The2;
 else { throw std::runtime_error("Input JSON does not conform to schema!"); }
 }
 
 inline void to_json(json & j, const Version & x) {
 switch (x) {
 case Version::The1: j = "1"; break;
+case Version::The2: j = "2"; break;
 default: throw std::runtime_error("Unexpected value in enumeration \"[object Object]\": " + std::to_string(static_cast<int>(x)));
 }
 }
@@ -37,6 +37,11 @@ struct RepositoryCacheLayersItem {
 * ostree commit hash
 */
 std::string commit;
+/**
+* the layer file is kept as is in images/COMMIT.layer and its erofs image is mounted on the
+* layer directory, COMMIT is the sha256 of the file then
+*/
+std::optional<bool> image;
 PackageInfoV2 info;
 /**
 * which repo is this app belongs to
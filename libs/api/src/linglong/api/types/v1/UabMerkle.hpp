@@ -0,0 +1,50 @@
+// This file is generated by tools/codegen.sh
+// DO NOT EDIT IT.
+
+// clang-format off
+
+//  To parse this JSON data, first install
+//
+//      json.hpp  https://github.com/nlohmann/json
+//
+//  Then include this file, and then do
+//
+//     UabMerkle.hpp data = nlohmann::json::parse(jsonString);
+
+#pragma once
+
+#include <optional>
+#include <nlohmann/json.hpp>
+#include "linglong/api/types/v1/helper.hpp"
+
+namespace linglong {
+namespace api {
+namespace types {
+namespace v1 {
+/**
+* The sha256 of each chunk of the bundle section, which could be hashed and verified in
+* parallel.
+*/
+
+using nlohmann::json;
+
+/**
+* The sha256 of each chunk of the bundle section, which could be hashed and verified in
+* parallel.
+*/
+struct UabMerkle {
+/**
+* Hex encoded sha256 of each chunk.
+*/
+std::vector<std::string> chunks;
+/**
+* Size of each chunk in bytes, the last one could be smaller.
+*/
+int64_t chunkSize;
+};
+}
+}
+}
+}
+
+// clang-format on
@@ -18,6 +18,7 @@
 #include "linglong/api/types/v1/helper.hpp"
 
 #include "linglong/api/types/v1/UabLayer.hpp"
+#include "linglong/api/types/v1/UabMerkle.hpp"
 #include "linglong/api/types/v1/Sections.hpp"
 
 namespace linglong {
@@ -38,10 +39,16 @@ using nlohmann::json;
 
 struct UabMetaInfo {
 /**
-* The digest of the bundle section.
+* The digest of the bundle section. If merkle is present, it's the sha256 of the binary
+* chunk hashes concatenated in order.
 */
 std::string digest;
 std::vector<UabLayer> layers;
+/**
+* The sha256 of each chunk of the bundle section, which could be hashed and verified in
+* parallel.
+*/
+std::optional<UabMerkle> merkle;
 Sections sections;
 /**
 * The version 4 uuid of this UAB file, generated by UAB builder when this UAB file is
@@ -49,7 +56,7 @@ Sections sections;
 */
 std::string uuid;
 /**
-* The format version of linglong.meta data.
+* The format version of linglong.meta data. Version 2 adds merkle.
 */
 Version version;
 };
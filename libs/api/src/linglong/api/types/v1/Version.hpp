@@ -23,7 +23,7 @@ namespace types {
 namespace v1 {
 using nlohmann::json;
 
-enum class Version : int { The1 };
+enum class Version : int { The1, The2 };
 }
 }
 }
@@ -230,39 +230,49 @@ fetchSources(const std::vector<api::types::v1::BuilderProjectSource> &sources,
     return LINGLONG_OK;
 }
 
-utils::error::Result<package::Reference> pullDependency(const package::FuzzyReference &fuzzyRef,
-                                                        repo::OSTreeRepo &repo,
-                                                        const std::string &module,
-                                                        bool onlyLocal) noexcept
+// pullDependencies resolves all references first and pulls the missing ones together, so the
+// objects shared by them are downloaded only once.
+utils::error::Result<std::vector<package::Reference>>
+pullDependencies(const std::vector<package::FuzzyReference> &fuzzyRefs,
+                 repo::OSTreeRepo &repo,
+                 const std::string &module,
+                 bool onlyLocal) noexcept
 {
-    LINGLONG_TRACE("pull " + fuzzyRef.toString());
+    LINGLONG_TRACE("pull dependencies");
 
-    if (onlyLocal) {
+    std::vector<package::Reference> refs;
+    std::vector<package::Reference> missing;
+    for (const auto &fuzzyRef : fuzzyRefs) {
         auto ref =
-          repo.clearReference(fuzzyRef, { .forceRemote = false, .fallbackToRemote = false });
+          repo.clearReference(fuzzyRef, { .forceRemote = !onlyLocal, .fallbackToRemote = false });
         if (!ref) {
             return LINGLONG_ERR(ref);
         }
-        return *ref;
+
+        // 如果依赖已存在，则直接使用
+        if (!onlyLocal && !repo.getLayerDir(*ref, module)) {
+            missing.emplace_back(*ref);
+        }
+        refs.emplace_back(*ref);
     }
-    auto ref = repo.clearReference(fuzzyRef, { .forceRemote = true, .fallbackToRemote = false });
-    if (!ref) {
-        return LINGLONG_ERR(ref);
+
+    if (missing.empty()) {
+        return refs;
     }
-    // 如果依赖已存在，则直接使用
-    auto baseLayerDir = repo.getLayerDir(*ref, module);
-    if (baseLayerDir) {
-        return *ref;
+
+    QStringList ids;
+    for (const auto &ref : missing) {
+        ids.append(ref.id);
     }
 
     auto tmpTask = service::InstallTask::createTemporaryTask();
-    auto partChanged = [&ref, &module](const QString &,
-                                       const QString &percentage,
-                                       const QString &,
-                                       service::InstallTask::Status) {
+    auto partChanged = [name = ids.join(","), &module](const QString &,
+                                                       const QString &percentage,
+                                                       const QString &,
+                                                       service::InstallTask::Status) {
         printReplacedText(QString("%1%2%3%4 %5")
-                            .arg(ref->id, -25)                        // NOLINT
-                            .arg(ref->version.toString(), -15)        // NOLINT
+                            .arg(name, -25)                           // NOLINT
+                            .arg("", -15)                             // NOLINT
                             .arg(QString::fromStdString(module), -15) // NOLINT
                             .arg("downloading")
                             .arg(percentage)
@@ -270,26 +280,38 @@ utils::error::Result<package::Reference> pullDependency(const package::FuzzyRefe
                           2);
     };
     QObject::connect(&tmpTask, &service::InstallTask::PartChanged, partChanged);
-    repo.pull(tmpTask, *ref, module);
+    repo.pullMany(tmpTask, missing, module);
     if (tmpTask.currentStatus() == service::InstallTask::Status::Failed) {
-        return LINGLONG_ERR("pull " + ref->toString() + " failed",
+        return LINGLONG_ERR("pull " + ids.join(",") + " failed",
                             std::move(tmpTask).currentError());
     }
-    return *ref;
+
+    return refs;
 }
 
-utils::error::Result<package::Reference> pullDependency(const QString &fuzzyRefStr,
-                                                        repo::OSTreeRepo &repo,
-                                                        const std::string &module,
-                                                        bool onlyLocal) noexcept
+// the base comes first, followed by the runtime if there is one
+utils::error::Result<std::vector<package::FuzzyReference>>
+projectDependencies(const api::types::v1::BuilderProject &project) noexcept
 {
-    LINGLONG_TRACE("pull " + fuzzyRefStr);
-    auto fuzzyRef = package::FuzzyReference::parse(fuzzyRefStr);
-    if (!fuzzyRef) {
-        return LINGLONG_ERR(fuzzyRef);
+    LINGLONG_TRACE("parse dependencies of project");
+
+    std::vector<package::FuzzyReference> fuzzyRefs;
+    auto fuzzyBase = package::FuzzyReference::parse(QString::fromStdString(project.base));
+    if (!fuzzyBase) {
+        return LINGLONG_ERR(fuzzyBase);
+    }
+    fuzzyRefs.emplace_back(*fuzzyBase);
+
+    if (project.runtime) {
+        auto fuzzyRuntime =
+          package::FuzzyReference::parse(QString::fromStdString(*project.runtime));
+        if (!fuzzyRuntime) {
+            return LINGLONG_ERR(fuzzyRuntime);
+        }
+        fuzzyRefs.emplace_back(*fuzzyRuntime);
     }
 
-    return pullDependency(*fuzzyRef, repo, module, onlyLocal);
+    return fuzzyRefs;
 }
 
 // 拆分develop和binary的文件
@@ -441,6 +463,30 @@ utils::error::Result<void> splitDevelop(QString installFilepath,
     return LINGLONG_OK;
 }
 
+utils::error::Result<package::ErofsOptions>
+erofsOptions(const api::types::v1::BuilderConfig &cfg) noexcept
+{
+    LINGLONG_TRACE("get erofs options from builder config");
+
+    package::ErofsOptions options;
+    if (cfg.erofsCompression) {
+        auto ret = package::validateErofsCompression(*cfg.erofsCompression);
+        if (!ret) {
+            return LINGLONG_ERR(ret);
+        }
+        options.compression = *cfg.erofsCompression;
+    }
+
+    if (cfg.erofsWorkers) {
+        if (*cfg.erofsWorkers < 0) {
+            return LINGLONG_ERR("erofs_workers should not be negative");
+        }
+        options.workers = static_cast<unsigned int>(*cfg.erofsWorkers);
+    }
+
+    return options;
+}
+
 } // namespace
 
 Builder::Builder(const api::types::v1::BuilderProject &project,
@@ -525,25 +571,24 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
                    .arg("Status")
                    .toStdString(),
                  2);
+    auto dependencies = projectDependencies(this->project);
+    if (!dependencies) {
+        return LINGLONG_ERR(dependencies);
+    }
+    auto refs = pullDependencies(*dependencies,
+                                 this->repo,
+                                 "develop",
+                                 cfg.skipPullDepend.has_value() && *cfg.skipPullDepend);
+    if (!refs) {
+        return LINGLONG_ERR("pull dependencies", refs);
+    }
+
     std::optional<package::Reference> runtime;
     std::optional<package::FuzzyReference> fuzzyRuntime;
     QString runtimeLayerDir;
     if (this->project.runtime) {
-        auto fuzzyRef =
-          package::FuzzyReference::parse(QString::fromStdString(*this->project.runtime));
-        if (!fuzzyRef) {
-            return LINGLONG_ERR(fuzzyRef);
-        }
-
-        fuzzyRuntime = *fuzzyRef;
-        auto ref = pullDependency(*fuzzyRuntime,
-                                  this->repo,
-                                  "develop",
-                                  cfg.skipPullDepend.has_value() && *cfg.skipPullDepend);
-        if (!ref) {
-            return LINGLONG_ERR("pull runtime", ref);
-        }
-        runtime = *ref;
+        fuzzyRuntime = dependencies->back();
+        runtime = refs->back();
         auto ret = this->repo.getLayerDir(*runtime, "develop");
         if (!ret.has_value()) {
             return LINGLONG_ERR("get runtime layer dir", ret);
@@ -559,29 +604,20 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
         qDebug() << "pull runtime success" << runtime->toString();
     }
 
-    auto fuzzyBase = package::FuzzyReference::parse(QString::fromStdString(this->project.base));
-    if (!fuzzyBase) {
-        return LINGLONG_ERR(fuzzyBase);
-    }
-    auto base = pullDependency(*fuzzyBase,
-                               this->repo,
-                               "develop",
-                               cfg.skipPullDepend.has_value() && *cfg.skipPullDepend);
-    if (!base) {
-        return LINGLONG_ERR("pull base", base);
-    }
-    auto baseLayerDir = this->repo.getLayerDir(*base, "develop");
+    const auto &fuzzyBase = dependencies->front();
+    auto &base = refs->front();
+    auto baseLayerDir = this->repo.getLayerDir(base, "develop");
     if (!baseLayerDir) {
         return LINGLONG_ERR(baseLayerDir);
     }
     printReplacedText(QString("%1%2%3%4")
-                        .arg(base->id, -25)                 // NOLINT
-                        .arg(base->version.toString(), -15) // NOLINT
-                        .arg("develop", -15)                // NOLINT
+                        .arg(base.id, -25)                 // NOLINT
+                        .arg(base.version.toString(), -15) // NOLINT
+                        .arg("develop", -15)               // NOLINT
                         .arg("complete\n")
                         .toStdString(),
                       2);
-    qDebug() << "pull base success" << base->toString();
+    qDebug() << "pull base success" << base.toString();
 
     if (cfg.skipRunContainer) {
         return LINGLONG_OK;
@@ -822,15 +858,15 @@ set -e
     }
     // when the base version is likes 20.0.0.1, warning that it is a full version
     // if the base version is likes 20.0.0, we should also write 20.0.0 to info.json
-    if (fuzzyBase->version->tweak) {
-        qWarning() << fuzzyBase->toString() << "is set a full version.";
+    if (fuzzyBase.version->tweak) {
+        qWarning() << fuzzyBase.toString() << "is set a full version.";
     } else {
-        base->version.tweak = std::nullopt;
+        base.version.tweak = std::nullopt;
     }
 
     auto info = api::types::v1::PackageInfoV2{
         .arch = { package::Architecture::currentCPUArchitecture()->toString().toStdString() },
-        .base = base->toString().toStdString(),
+        .base = base.toString().toStdString(),
         .channel = ref->channel.toStdString(),
         .command = project.command,
         .description = this->project.package.description,
@@ -964,7 +1000,13 @@ utils::error::Result<void> Builder::exportUAB(const QString &destination, const
         return LINGLONG_ERR("mkpath " + destination + ": failed");
     }
 
+    auto erofs = erofsOptions(this->cfg);
+    if (!erofs) {
+        return LINGLONG_ERR(erofs);
+    }
+
     package::UABPackager packager{ destDir };
+    packager.setErofsOptions(std::move(erofs).value());
 
     if (!option.iconPath.isEmpty()) {
         if (auto ret = packager.setIcon(option.iconPath); !ret) {
@@ -980,30 +1022,20 @@ utils::error::Result<void> Builder::exportUAB(const QString &destination, const
         packager.include(project.include.value());
     }
 
-    auto baseRef =
-      pullDependency(QString::fromStdString(this->project.base), this->repo, "binary", false);
-    if (!baseRef) {
-        return LINGLONG_ERR(baseRef);
+    auto dependencies = projectDependencies(this->project);
+    if (!dependencies) {
+        return LINGLONG_ERR(dependencies);
     }
-    auto baseDir = this->repo.getLayerDir(*baseRef);
-    if (!baseDir) {
-        return LINGLONG_ERR(baseDir);
+    auto refs = pullDependencies(*dependencies, this->repo, "binary", false);
+    if (!refs) {
+        return LINGLONG_ERR(refs);
     }
-    packager.appendLayer(*baseDir);
-
-    if (this->project.runtime) {
-        auto ref = pullDependency(QString::fromStdString(*this->project.runtime),
-                                  this->repo,
-                                  "binary",
-                                  false);
-        if (!ref) {
-            return LINGLONG_ERR(ref);
-        }
-        auto runtimeDir = this->repo.getLayerDir(*ref);
-        if (!runtimeDir) {
-            return LINGLONG_ERR(runtimeDir);
+    for (const auto &ref : *refs) {
+        auto layerDir = this->repo.getLayerDir(ref);
+        if (!layerDir) {
+            return LINGLONG_ERR(layerDir);
         }
-        packager.appendLayer(*runtimeDir);
+        packager.appendLayer(*layerDir);
     }
 
     auto curRef = currentReference(this->project);
@@ -1066,7 +1098,13 @@ utils::error::Result<void> Builder::exportLayer(const QString &destination)
         return LINGLONG_ERR(developLayerDir);
     }
 
+    auto erofs = erofsOptions(this->cfg);
+    if (!erofs) {
+        return LINGLONG_ERR(erofs);
+    }
+
     package::LayerPackager pkger;
+    pkger.setErofsOptions(std::move(erofs).value());
 
     auto binaryLayer = pkger.pack(*binaryLayerDir, binaryLayerPath);
     if (!binaryLayer) {
@@ -1182,28 +1220,25 @@ utils::error::Result<void> Builder::run(const QStringList &args)
         .mounts = {},
     };
 
-    auto baseRef = pullDependency(QString::fromStdString(this->project.base),
-                                  this->repo,
-                                  "binary",
-                                  cfg.skipPullDepend.has_value() && *cfg.skipPullDepend);
-    if (!baseRef) {
-        return LINGLONG_ERR(baseRef);
+    auto dependencies = projectDependencies(this->project);
+    if (!dependencies) {
+        return LINGLONG_ERR(dependencies);
+    }
+    auto refs = pullDependencies(*dependencies,
+                                 this->repo,
+                                 "binary",
+                                 cfg.skipPullDepend.has_value() && *cfg.skipPullDepend);
+    if (!refs) {
+        return LINGLONG_ERR(refs);
     }
-    auto baseDir = this->repo.getLayerDir(*baseRef, "binary");
+    auto baseDir = this->repo.getLayerDir(refs->front(), "binary");
     if (!baseDir) {
         return LINGLONG_ERR(baseDir);
     }
     options.baseDir = QDir(baseDir->absolutePath());
 
     if (this->project.runtime) {
-        auto ref = pullDependency(QString::fromStdString(*this->project.runtime),
-                                  this->repo,
-                                  "binary",
-                                  cfg.skipPullDepend.has_value() && *cfg.skipPullDepend);
-        if (!ref) {
-            return LINGLONG_ERR(ref);
-        }
-        auto dir = this->repo.getLayerDir(*ref, "binary");
+        auto dir = this->repo.getLayerDir(refs->back(), "binary");
         if (!dir) {
             return LINGLONG_ERR(dir);
         }
@@ -14,8 +14,10 @@
 #include "linglong/api/types/v1/PackageManager1SearchParameters.hpp"
 #include "linglong/api/types/v1/PackageManager1SearchResult.hpp"
 #include "linglong/api/types/v1/PackageManager1UninstallParameters.hpp"
+#include "linglong/api/types/v1/PackageManager1UpdateParameters.hpp"
 #include "linglong/package/layer_file.h"
 #include "linglong/runtime/container_builder.h"
+#include "linglong/utils/async/await.h"
 #include "linglong/utils/command/env.h"
 #include "linglong/utils/configure.h"
 #include "linglong/utils/error/error.h"
@@ -26,6 +28,7 @@
 
 #include <nlohmann/json.hpp>
 
+#include <QDBusMessage>
 #include <QEventLoop>
 #include <QFileInfo>
 
@@ -49,7 +52,7 @@ Usage:
     ll-cli [--json] kill PAGODA
     ll-cli [--json] [--no-dbus] install TIER
     ll-cli [--json] uninstall TIER [--all] [--prune]
-    ll-cli [--json] upgrade TIER
+    ll-cli [--json] upgrade [TIER]
     ll-cli [--json] search [--type=TYPE] [--dev] TEXT
     ll-cli [--json] [--no-dbus] list [--type=TYPE]
     ll-cli [--json] repo modify [--name=REPO] URL
@@ -93,7 +96,7 @@ Subcommands:
     kill       Stop applications and remove the pagoda.
     install    Install tier(s).
     uninstall  Uninstall tier(s).
-    upgrade    Upgrade tier(s).
+    upgrade    Upgrade tier(s), all installed applications are upgraded if TIER is not specified.
     search     Search for tiers.
     list       List known tiers.
     repo       Display or modify information of the repository currently using.
@@ -128,10 +131,12 @@ void Cli::processDownloadStatus(const QString &recTaskID,
         this->taskDone = true;
         this->printer.printTaskStatus(percentage, message, status);
         std::cout << std::endl;
+        Q_EMIT taskFinished({});
     } break;
     case service::InstallTask::Failed: {
         this->printer.printErr(LINGLONG_ERRV("\n" + message));
         this->taskDone = true;
+        Q_EMIT taskFinished({});
     }
     }
 }
@@ -153,6 +158,30 @@ Cli::Cli(Printer &printer,
 {
 }
 
+utils::error::Result<package::LayerDir>
+Cli::getLayerDir(const package::Reference &ref,
+                 const std::optional<std::string> &subRef) noexcept
+{
+    auto layerDir = this->repository.getLayerDir(ref, "binary", subRef);
+    if (layerDir) {
+        return layerDir;
+    }
+
+    // Layer images are mounted by ll-package-manager when it starts, it isn't running after a
+    // reboot until something activates it. The ping returns after the images are mounted.
+    auto ping = QDBusMessage::createMethodCall(this->pkgMan.service(),
+                                               this->pkgMan.path(),
+                                               "org.freedesktop.DBus.Peer",
+                                               "Ping");
+    auto reply = this->pkgMan.connection().call(ping);
+    if (reply.type() == QDBusMessage::ErrorMessage) {
+        qWarning() << "failed to activate the package manager:" << reply.errorMessage();
+        return layerDir;
+    }
+
+    return this->repository.getLayerDir(ref, "binary", subRef);
+}
+
 int Cli::run(std::map<std::string, docopt::value> &args)
 {
     LINGLONG_TRACE("command run");
@@ -176,7 +205,7 @@ int Cli::run(std::map<std::string, docopt::value> &args)
         return -1;
     }
 
-    auto appLayerDir = this->repository.getLayerDir(*curAppRef, std::string{ "binary" });
+    auto appLayerDir = this->getLayerDir(*curAppRef);
     if (!appLayerDir) {
         this->printer.printErr(appLayerDir.error());
         return -1;
@@ -207,8 +236,7 @@ int Cli::run(std::map<std::string, docopt::value> &args)
             return -1;
         }
 
-        auto runtimeLayerDirRet =
-          this->repository.getLayerDir(*runtimeRef, std::string{ "binary" }, info->uuid);
+        auto runtimeLayerDirRet = this->getLayerDir(*runtimeRef, info->uuid);
         if (!runtimeLayerDirRet) {
             this->printer.printErr(runtimeLayerDirRet.error());
             return -1;
@@ -233,7 +261,7 @@ int Cli::run(std::map<std::string, docopt::value> &args)
         return -1;
     }
 
-    auto baseLayerDir = this->repository.getLayerDir(*baseRef, std::string{ "binary" }, info->uuid);
+    auto baseLayerDir = this->getLayerDir(*baseRef, info->uuid);
     if (!baseLayerDir) {
         this->printer.printErr(LINGLONG_ERRV(baseLayerDir));
         return -1;
@@ -548,16 +576,9 @@ int Cli::installFromFile(const QFileInfo &fileInfo)
 
     this->taskID = QString::fromStdString(*result->taskID);
     this->taskDone = false;
-    QEventLoop loop;
-    std::function<void()> statusChecker = std::function{ [&loop, &statusChecker, this]() -> void {
-        if (this->taskDone) {
-            loop.exit(0);
-        }
-        QMetaObject::invokeMethod(&loop, statusChecker, Qt::QueuedConnection);
-    } };
-
-    QMetaObject::invokeMethod(&loop, statusChecker, Qt::QueuedConnection);
-    loop.exec();
+    utils::async::waitUntil(this, &Cli::taskFinished, [this]() {
+        return this->taskDone;
+    });
 
     updateAM();
     return 0;
@@ -650,16 +671,9 @@ int Cli::install(std::map<std::string, docopt::value> &args)
 
     this->taskID = QString::fromStdString(*result->taskID);
     this->taskDone = false;
-    QEventLoop loop;
-    std::function<void()> statusChecker = std::function{ [&loop, &statusChecker, this]() -> void {
-        if (this->taskDone) {
-            loop.exit(0);
-        }
-        QMetaObject::invokeMethod(&loop, statusChecker, Qt::QueuedConnection);
-    } };
-
-    QMetaObject::invokeMethod(&loop, statusChecker, Qt::QueuedConnection);
-    loop.exec();
+    utils::async::waitUntil(this, &Cli::taskFinished, [this]() {
+        return this->taskDone;
+    });
 
     updateAM();
     return this->lastStatus == service::InstallTask::Success ? 0 : -1;
@@ -669,21 +683,24 @@ int Cli::upgrade(std::map<std::string, docopt::value> &args)
 {
     LINGLONG_TRACE("command upgrade");
 
-    auto tier = args["TIER"].asString();
+    std::optional<api::types::v1::PackageManager1InstallParameters> params;
+    if (args["TIER"].isString()) {
+        auto tier = args["TIER"].asString();
 
-    auto fuzzyRef = package::FuzzyReference::parse(QString::fromStdString(tier));
-    if (!fuzzyRef) {
-        this->printer.printErr(fuzzyRef.error());
-        return -1;
-    }
+        auto fuzzyRef = package::FuzzyReference::parse(QString::fromStdString(tier));
+        if (!fuzzyRef) {
+            this->printer.printErr(fuzzyRef.error());
+            return -1;
+        }
 
-    api::types::v1::PackageManager1InstallParameters params;
-    params.package.id = fuzzyRef->id.toStdString();
-    if (fuzzyRef->channel) {
-        params.package.channel = fuzzyRef->channel->toStdString();
-    }
-    if (fuzzyRef->version) {
-        params.package.version = fuzzyRef->version->toString().toStdString();
+        params.emplace();
+        params->package.id = fuzzyRef->id.toStdString();
+        if (fuzzyRef->channel) {
+            params->package.channel = fuzzyRef->channel->toStdString();
+        }
+        if (fuzzyRef->version) {
+            params->package.version = fuzzyRef->version->toString().toStdString();
+        }
     }
 
     auto conn = this->pkgMan.connection();
@@ -699,7 +716,13 @@ int Cli::upgrade(std::map<std::string, docopt::value> &args)
         return -1;
     }
 
-    auto reply = this->pkgMan.Update(utils::serialize::toQVariantMap(params)).value();
+    // without TIER, all installed applications are upgraded in a single task
+    auto reply = params
+      ? this->pkgMan.Update(utils::serialize::toQVariantMap(*params)).value()
+      : this->pkgMan
+          .UpdateAll(utils::serialize::toQVariantMap(
+            api::types::v1::PackageManager1UpdateParameters{ .packages = {} }))
+          .value();
     auto result =
       utils::serialize::fromQVariantMap<api::types::v1::PackageManager1ResultWithTaskID>(reply);
     if (!result) {
@@ -713,18 +736,17 @@ int Cli::upgrade(std::map<std::string, docopt::value> &args)
         return -1;
     }
 
+    // nothing to upgrade
+    if (!result->taskID) {
+        this->printer.printReply({ .code = result->code, .message = result->message });
+        return 0;
+    }
+
     this->taskID = QString::fromStdString(*result->taskID);
     this->taskDone = false;
-    QEventLoop loop;
-    std::function<void()> statusChecker = std::function{ [&loop, &statusChecker, this]() -> void {
-        if (this->taskDone) {
-            loop.exit(0);
-        }
-        QMetaObject::invokeMethod(&loop, statusChecker, Qt::QueuedConnection);
-    } };
-
-    QMetaObject::invokeMethod(&loop, statusChecker, Qt::QueuedConnection);
-    loop.exec();
+    utils::async::waitUntil(this, &Cli::taskFinished, [this]() {
+        return this->taskDone;
+    });
 
     if (this->lastStatus != service::InstallTask::Success) {
         return -1;
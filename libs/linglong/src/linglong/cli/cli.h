@@ -51,6 +51,9 @@ private:
     static void filterPackageInfosFromType(std::vector<api::types::v1::PackageInfoV2> &list,
                                            const QString &type) noexcept;
     void updateAM() noexcept;
+    utils::error::Result<package::LayerDir>
+    getLayerDir(const package::Reference &ref,
+                const std::optional<std::string> &subRef = std::nullopt) noexcept;
 
 public:
     int run(std::map<std::string, docopt::value> &args);
@@ -80,6 +83,7 @@ private Q_SLOTS:
 
 Q_SIGNALS:
     void migrateDone(int code, QString message, QPrivateSignal);
+    void taskFinished(QPrivateSignal);
 };
 
 } // namespace linglong::cli
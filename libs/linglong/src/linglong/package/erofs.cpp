@@ -0,0 +1,282 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "linglong/package/erofs.h"
+
+#include "linglong/utils/command/env.h"
+#include "linglong/utils/finally/finally.h"
+
+#include <linux/loop.h>
+
+#include <QDebug>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <unistd.h>
+
+namespace linglong::package {
+
+namespace {
+
+// multi-threaded compression is added to mkfs.erofs in erofs-utils 1.8
+bool mkfsErofsSupportsWorkers() noexcept
+{
+    static const bool supported = []() {
+        auto help = utils::command::Exec("mkfs.erofs", { "--help" });
+        return help && help->contains("--workers");
+    }();
+
+    return supported;
+}
+
+// Attaches fd to loop with LOOP_SET_FD and LOOP_SET_STATUS64, which works on every kernel. Returns
+// -1 with errno set on failure.
+int setLoopFd(int loop, int fd, const loop_info64 &info) noexcept
+{
+    if (::ioctl(loop, LOOP_SET_FD, fd) == -1) {
+        return -1;
+    }
+
+    if (::ioctl(loop, LOOP_SET_STATUS64, &info) == -1) {
+        auto error = errno;
+        ::ioctl(loop, LOOP_CLR_FD, 0);
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Attaches fd to a free loop device and returns the opened device with its path. Another process
+// could take the device between LOOP_CTL_GET_FREE and the attachment, so it's retried a few times.
+utils::error::Result<std::pair<int, QString>>
+attachLoopDevice(int fd, uint64_t offset, uint64_t size) noexcept
+{
+    LINGLONG_TRACE("attach loop device");
+
+    auto control = ::open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (control == -1) {
+        return LINGLONG_ERR(QString{ "open /dev/loop-control: %1" }.arg(::strerror(errno)));
+    }
+    auto closeControl = utils::finally::finally([control] {
+        ::close(control);
+    });
+
+    loop_info64 info{};
+    info.lo_offset = offset;
+    info.lo_sizelimit = size;
+    info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR;
+#ifdef LOOP_CONFIGURE
+    loop_config config{};
+    config.fd = static_cast<__u32>(fd);
+    config.info = info;
+#endif
+
+    constexpr int maxRetries = 8;
+    for (int i = 0; i < maxRetries; ++i) {
+        auto index = ::ioctl(control, LOOP_CTL_GET_FREE);
+        if (index < 0) {
+            return LINGLONG_ERR(QString{ "LOOP_CTL_GET_FREE: %1" }.arg(::strerror(errno)));
+        }
+
+        auto device = QString{ "/dev/loop%1" }.arg(index);
+        auto loop = ::open(device.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+        if (loop == -1) {
+            return LINGLONG_ERR(QString{ "open %1: %2" }.arg(device, ::strerror(errno)));
+        }
+
+#ifdef LOOP_CONFIGURE
+        // LOOP_CONFIGURE attaches and configures the device at once since linux 5.8
+        auto ret = ::ioctl(loop, LOOP_CONFIGURE, &config);
+        if (ret == -1 && (errno == EINVAL || errno == ENOTTY)) {
+            ret = setLoopFd(loop, fd, info);
+        }
+#else
+        // the kernel headers of older build environments don't define LOOP_CONFIGURE
+        auto ret = setLoopFd(loop, fd, info);
+#endif
+        if (ret == 0) {
+            return std::make_pair(loop, device);
+        }
+
+        auto error = errno;
+        ::close(loop);
+        if (error != EBUSY) {
+            return LINGLONG_ERR(QString{ "attach %1: %2" }.arg(device, ::strerror(error)));
+        }
+    }
+
+    return LINGLONG_ERR("no free loop device");
+}
+
+} // namespace
+
+utils::error::Result<void> validateErofsCompression(const std::string &compression) noexcept
+{
+    LINGLONG_TRACE(QString{ "validate erofs compression %1" }.arg(compression.c_str()));
+
+    constexpr std::array<std::string_view, 4> algorithms{ "lz4", "lz4hc", "lzma", "zstd" };
+
+    std::string_view algorithm{ compression };
+    std::string_view level;
+    if (auto pos = algorithm.find(','); pos != std::string_view::npos) {
+        level = algorithm.substr(pos + 1);
+        algorithm = algorithm.substr(0, pos);
+        if (level.empty()
+            || level.find_first_not_of("0123456789") != std::string_view::npos) {
+            return LINGLONG_ERR("the compression level should be a number");
+        }
+    }
+
+    if (std::find(algorithms.cbegin(), algorithms.cend(), algorithm) == algorithms.cend()) {
+        return LINGLONG_ERR("the compression algorithm should be one of lz4, lz4hc, lzma and zstd");
+    }
+
+    return LINGLONG_OK;
+}
+
+utils::error::Result<void> mkfsErofs(const QString &image,
+                                     const QString &source,
+                                     const ErofsOptions &options,
+                                     const QStringList &extraArgs) noexcept
+{
+    LINGLONG_TRACE("make erofs image " + image);
+
+    auto ret = validateErofsCompression(options.compression);
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    // 使用-b统一指定block size为4096(2^12), 避免不同系统的兼容问题
+    // loongarch64默认使用(16384)2^14, 在x86和arm64不受支持, 会导致无法推包
+    QStringList args{ "-z" + QString::fromStdString(options.compression), "-b4096" };
+    if (mkfsErofsSupportsWorkers()) {
+        auto workers = options.workers;
+        if (workers == 0) {
+            workers = std::max(std::thread::hardware_concurrency(), 1U);
+        }
+        args.append(QString{ "--workers=%1" }.arg(workers));
+    }
+    args << extraArgs << image << source;
+
+    auto output = utils::command::Exec("mkfs.erofs", args);
+    if (!output) {
+        return LINGLONG_ERR(output);
+    }
+
+    return LINGLONG_OK;
+}
+
+utils::error::Result<void> mountErofsWithLoop(const QString &file,
+                                              uint64_t offset,
+                                              uint64_t size,
+                                              const QString &mountPoint) noexcept
+{
+    LINGLONG_TRACE(QString{ "mount %1 on %2 with loop device" }.arg(file, mountPoint));
+
+    auto fd = ::open(file.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return LINGLONG_ERR(QString{ "open: %1" }.arg(::strerror(errno)));
+    }
+    auto closeFile = utils::finally::finally([fd] {
+        ::close(fd);
+    });
+
+    auto loop = attachLoopDevice(fd, offset, size);
+    if (!loop) {
+        return LINGLONG_ERR(loop);
+    }
+    // the device is detached by LO_FLAGS_AUTOCLEAR after it's closed and unmounted
+    auto closeLoop = utils::finally::finally([loop = loop->first] {
+        ::close(loop);
+    });
+
+    if (::mount(loop->second.toLocal8Bit().constData(),
+                mountPoint.toLocal8Bit().constData(),
+                "erofs",
+                MS_RDONLY | MS_NODEV | MS_NOSUID,
+                nullptr)
+        == -1) {
+        return LINGLONG_ERR(QString{ "mount erofs: %1" }.arg(::strerror(errno)));
+    }
+
+    return LINGLONG_OK;
+}
+
+utils::error::Result<void> mountErofs(const QString &file,
+                                      uint64_t offset,
+                                      uint64_t size,
+                                      const QString &mountPoint,
+                                      bool allowOther) noexcept
+{
+    LINGLONG_TRACE(QString{ "mount %1 on %2" }.arg(file, mountPoint));
+
+    // Files are read without crossing into userspace. The digest of a file is declared by the file
+    // itself and proves nothing about it, so the administrator has to opt in.
+    if (::geteuid() == 0 && !::qgetenv("LINGLONG_EROFS_KERNEL_MOUNT").isEmpty()) {
+        auto ret = mountErofsWithLoop(file, offset, size, mountPoint);
+        if (ret) {
+            return LINGLONG_OK;
+        }
+
+        qDebug() << "fall back to erofsfuse:" << ret.error().message();
+    }
+
+    // erofsfuse always reads to the end of the file
+    QStringList args{ QString{ "--offset=%1" }.arg(offset), file, mountPoint };
+    if (allowOther) {
+        args.prepend("allow_other");
+        args.prepend("-o");
+    }
+    auto ret = utils::command::Exec("erofsfuse", args);
+    if (!ret) {
+        if (allowOther && ::geteuid() != 0) {
+            return LINGLONG_ERR("is user_allow_other set in /etc/fuse.conf?", ret);
+        }
+        return LINGLONG_ERR(ret);
+    }
+
+    return LINGLONG_OK;
+}
+
+utils::error::Result<void> umountErofs(const QString &mountPoint) noexcept
+{
+    LINGLONG_TRACE("umount " + mountPoint);
+
+    if (::geteuid() == 0) {
+        if (::umount2(mountPoint.toLocal8Bit().constData(), 0) == -1) {
+            return LINGLONG_ERR(QString{ "umount2: %1" }.arg(::strerror(errno)));
+        }
+
+        return LINGLONG_OK;
+    }
+
+    // fusermount3 comes with libfuse3, fusermount with libfuse2
+    for (const auto *fusermount : { "fusermount3", "fusermount" }) {
+        if (QStandardPaths::findExecutable(fusermount).isEmpty()) {
+            continue;
+        }
+
+        auto ret = utils::command::Exec(fusermount, { "-u", mountPoint });
+        if (!ret) {
+            return LINGLONG_ERR(ret);
+        }
+
+        return LINGLONG_OK;
+    }
+
+    return LINGLONG_ERR("neither fusermount3 nor fusermount is found");
+}
+
+} // namespace linglong::package
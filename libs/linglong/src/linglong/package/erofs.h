@@ -0,0 +1,57 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include "linglong/utils/error/error.h"
+
+#include <QString>
+#include <QStringList>
+
+#include <string>
+
+namespace linglong::package {
+
+struct ErofsOptions
+{
+    // the compressor of mkfs.erofs with an optional level, e.g. "lz4hc,9" or "zstd,15"
+    std::string compression{ "lz4hc,9" };
+    // compression threads, 0 for all cores. mkfs.erofs without --workers always uses one thread.
+    unsigned int workers{ 0 };
+};
+
+// Checks that the compression is one of lz4, lz4hc, lzma and zstd followed by an optional level.
+utils::error::Result<void> validateErofsCompression(const std::string &compression) noexcept;
+
+// Makes an erofs image with 4096 bytes blocks from the directory source.
+utils::error::Result<void> mkfsErofs(const QString &image,
+                                     const QString &source,
+                                     const ErofsOptions &options,
+                                     const QStringList &extraArgs = {}) noexcept;
+
+// Mounts the erofs image at [offset, offset + size) of file read only on mountPoint with the
+// kernel erofs driver over a loop device, size 0 means to the end of the file. It requires
+// CAP_SYS_ADMIN. The loop device is released automatically once the image is unmounted.
+utils::error::Result<void> mountErofsWithLoop(const QString &file,
+                                              uint64_t offset,
+                                              uint64_t size,
+                                              const QString &mountPoint) noexcept;
+
+// Mounts the erofs image through erofsfuse. The images come from users, e.g. files passed to the
+// package manager over D-Bus, so they aren't handed to the filesystem parser of the kernel by
+// default. With LINGLONG_EROFS_KERNEL_MOUNT set and CAP_SYS_ADMIN, the kernel driver is tried
+// first.
+// A FUSE mount is only accessible to the user who mounted it, allowOther opens it to every user
+// like a kernel mount. Without root, this requires user_allow_other in /etc/fuse.conf.
+utils::error::Result<void> mountErofs(const QString &file,
+                                      uint64_t offset,
+                                      uint64_t size,
+                                      const QString &mountPoint,
+                                      bool allowOther = false) noexcept;
+
+// Unmounts an image mounted by mountErofs. Mounts of erofsfuse are released with fusermount
+// unless running as root, an unprivileged umount fails on them.
+utils::error::Result<void> umountErofs(const QString &mountPoint) noexcept;
+
+} // namespace linglong::package
@@ -8,13 +8,124 @@
 
 #include "linglong/api/types/v1/Generators.hpp"
 #include "linglong/api/types/v1/LayerInfo.hpp"
-#include "linglong/utils/command/env.h"
+#include "linglong/utils/finally/finally.h"
 
 #include <QDataStream>
 #include <QSysInfo>
 
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace linglong::package {
 
+namespace {
+
+// the block size of erofs images made by the packager, also the alignment of them in layer files
+constexpr int layerBlockSize = 4096;
+
+int alignUp(int size, int alignment) noexcept
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// Copies the whole file `from` to the end of `to` inside the kernel. copy_file_range could share
+// the extents on filesystems with reflink, sendfile works between any regular files.
+utils::error::Result<void> appendFile(int from, int to) noexcept
+{
+    LINGLONG_TRACE("append file");
+
+    struct stat sb
+    {
+    };
+
+    if (::fstat(from, &sb) == -1) {
+        return LINGLONG_ERR(QString{ "fstat: %1" }.arg(::strerror(errno)));
+    }
+
+    auto remaining = sb.st_size;
+    bool useSendfile{ false };
+    while (remaining > 0) {
+        ssize_t copied{ 0 };
+        if (!useSendfile) {
+            copied = ::copy_file_range(from, nullptr, to, nullptr, remaining, 0);
+            if (copied == -1
+                && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+                useSendfile = true;
+                continue;
+            }
+        } else {
+            copied = ::sendfile(to, from, nullptr, remaining);
+        }
+
+        if (copied == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return LINGLONG_ERR(QString{ "copy image: %1" }.arg(::strerror(errno)));
+        }
+        if (copied == 0) {
+            return LINGLONG_ERR("image is truncated while copying");
+        }
+        remaining -= copied;
+    }
+
+    return LINGLONG_OK;
+}
+
+// Puts the header in front of the image. The header is inserted into the image in place where
+// the filesystem supports FALLOC_FL_INSERT_RANGE, e.g. ext4 and xfs, otherwise the image is
+// copied after the header.
+utils::error::Result<void> assembleLayer(const QByteArray &header,
+                                         const QString &imagePath,
+                                         const QString &layerFilePath) noexcept
+{
+    LINGLONG_TRACE("assemble layer file " + layerFilePath);
+
+    auto image = ::open(imagePath.toLocal8Bit().constData(), O_RDWR | O_CLOEXEC);
+    if (image == -1) {
+        return LINGLONG_ERR(QString{ "open %1: %2" }.arg(imagePath, ::strerror(errno)));
+    }
+    auto closeImage = utils::finally::finally([image] {
+        ::close(image);
+    });
+
+    if (::fallocate(image, FALLOC_FL_INSERT_RANGE, 0, header.size()) == 0) {
+        if (::pwrite(image, header.constData(), header.size(), 0) != header.size()) {
+            return LINGLONG_ERR(QString{ "write header: %1" }.arg(::strerror(errno)));
+        }
+        if (::rename(imagePath.toLocal8Bit().constData(), layerFilePath.toLocal8Bit().constData())
+            == -1) {
+            return LINGLONG_ERR(QString{ "rename: %1" }.arg(::strerror(errno)));
+        }
+
+        return LINGLONG_OK;
+    }
+
+    QFile layer(layerFilePath);
+    if (!layer.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return LINGLONG_ERR(layer);
+    }
+
+    if (layer.write(header) != header.size() || !layer.flush()) {
+        return LINGLONG_ERR(layer);
+    }
+
+    auto ret = appendFile(image, layer.handle());
+    if (!ret) {
+        layer.remove();
+        return LINGLONG_ERR(ret);
+    }
+
+    return LINGLONG_OK;
+}
+
+} // namespace
+
 LayerPackager::LayerPackager(const QDir &workDir)
     : workDir(workDir)
 {
@@ -33,7 +144,7 @@ LayerPackager::~LayerPackager()
             continue;
         }
 
-        auto ret = utils::command::Exec("umount", { info.absoluteFilePath() });
+        auto ret = umountErofs(info.absoluteFilePath());
         if (!ret) {
             qCritical() << ret.error();
         }
@@ -57,14 +168,6 @@ LayerPackager::pack(const LayerDir &dir, const QString &layerFilePath) const
         layer.remove();
     }
 
-    if (!layer.open(QIODevice::WriteOnly | QIODevice::Append)) {
-        return LINGLONG_ERR(layer);
-    }
-
-    if (layer.write(magicNumber) < 0) {
-        return LINGLONG_ERR(layer);
-    }
-
     // generate LayerInfo
     api::types::v1::LayerInfo layerInfo;
     // layer info version not used yet, so give fixed value
@@ -79,6 +182,12 @@ LayerPackager::pack(const LayerDir &dir, const QString &layerFilePath) const
     layerInfo.info = nlohmann::json(*info);
     auto data = QByteArray::fromStdString(nlohmann::json(layerInfo).dump());
 
+    // The meta info is padded with spaces, which are ignored by json parsers, so that the erofs
+    // image starts at a block boundary. Then the header could be inserted in front of the image
+    // in place, and the image could be mounted through a loop device at that offset.
+    auto headerSize = magicNumber.size() + static_cast<int>(sizeof(quint32)) + data.size();
+    data.append(QByteArray(alignUp(headerSize, layerBlockSize) - headerSize, ' '));
+
     QByteArray dataSizeBytes;
 
     QDataStream dataSizeStream(&dataSizeBytes, QIODevice::WriteOnly);
@@ -88,33 +197,25 @@ LayerPackager::pack(const LayerDir &dir, const QString &layerFilePath) const
 
     Q_ASSERT(dataSizeStream.status() == QDataStream::Status::Ok);
 
-    if (layer.write(dataSizeBytes) < 0) {
-        return LINGLONG_ERR(layer);
-    }
-
-    if (layer.write(data) < 0) {
-        return LINGLONG_ERR(layer);
-    }
-
-    layer.close();
-
-    // compress data with erofs
-    const auto &compressedFilePath = this->workDir.absoluteFilePath("tmp.erofs");
-    const auto &ignoreRegex = QString{ "--exclude-regex=minified*" };
-    // 使用-b统一指定block size为4096(2^12), 避免不同系统的兼容问题
-    // loongarch64默认使用(16384)2^14, 在x86和arm64不受支持, 会导致无法推包
-    auto ret = utils::command::Exec(
-      "mkfs.erofs",
-      { "-zlz4hc,9", "-b4096", compressedFilePath, ignoreRegex, dir.absolutePath() });
+    auto header = magicNumber + dataSizeBytes + data;
+
+    // compress data with erofs, the image is written next to the layer file, so that it could
+    // become the layer file without being copied
+    const auto imagePath = layerFilePath + ".erofs";
+    auto removeImage = utils::finally::finally([&imagePath] {
+        QFile::remove(imagePath);
+    });
+    auto ret = mkfsErofs(imagePath,
+                         dir.absolutePath(),
+                         this->erofsOptions,
+                         { "--exclude-regex=minified*" });
     if (!ret) {
         return LINGLONG_ERR(ret);
     }
 
-    ret = utils::command::Exec(
-      "sh",
-      { "-c", QString("cat %1 >> %2").arg(compressedFilePath, layerFilePath) });
-    if (!ret) {
-        LINGLONG_ERR(ret);
+    auto assembled = assembleLayer(header, imagePath, layerFilePath);
+    if (!assembled) {
+        return LINGLONG_ERR(assembled);
     }
 
     auto result = LayerFile::New(layerFilePath);
@@ -123,6 +224,11 @@ LayerPackager::pack(const LayerDir &dir, const QString &layerFilePath) const
     return result;
 }
 
+void LayerPackager::setErofsOptions(ErofsOptions options) noexcept
+{
+    this->erofsOptions = std::move(options);
+}
+
 utils::error::Result<LayerDir> LayerPackager::unpack(LayerFile &file)
 {
     LINGLONG_TRACE("unpack layer file");
@@ -137,10 +243,7 @@ utils::error::Result<LayerDir> LayerPackager::unpack(LayerFile &file)
         return LINGLONG_ERR(offset);
     }
 
-    auto ret = utils::command::Exec("erofsfuse",
-                                    { QString("--offset=%1").arg(*offset),
-                                      fileInfo.absoluteFilePath(),
-                                      unpackDir.absolutePath() });
+    auto ret = mountErofs(fileInfo.absoluteFilePath(), *offset, 0, unpackDir.absolutePath());
     if (!ret) {
         return LINGLONG_ERR(ret);
     }
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include "linglong/package/erofs.h"
 #include "linglong/package/layer_dir.h"
 #include "linglong/package/layer_file.h"
 #include "linglong/utils/error/error.h"
@@ -28,9 +29,11 @@ public:
     utils::error::Result<QSharedPointer<LayerFile>> pack(const LayerDir &dir,
                                                          const QString &layerFilePath) const;
     utils::error::Result<LayerDir> unpack(LayerFile &file);
+    void setErofsOptions(ErofsOptions options) noexcept;
 
 private:
     QDir workDir;
+    ErofsOptions erofsOptions;
 };
 
 } // namespace linglong::package
@@ -0,0 +1,114 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "linglong/package/uab_digest_cache.h"
+
+#include <QDebug>
+
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace linglong::package {
+
+namespace {
+
+struct FileIdentity
+{
+    std::string name;
+    std::string stamp;
+};
+
+std::optional<FileIdentity> identify(int fd, std::string_view digest) noexcept
+{
+    struct stat sb
+    {
+    };
+
+    if (::fstat(fd, &sb) == -1) {
+        return std::nullopt;
+    }
+
+    std::ostringstream stamp;
+    stamp << sb.st_size << ' ' << sb.st_mtim.tv_sec << '.' << sb.st_mtim.tv_nsec << ' '
+          << sb.st_ctim.tv_sec << '.' << sb.st_ctim.tv_nsec << ' ' << digest;
+    return FileIdentity{ std::to_string(sb.st_dev) + "-" + std::to_string(sb.st_ino),
+                         stamp.str() };
+}
+
+} // namespace
+
+UABDigestCache::UABDigestCache(std::filesystem::path dir) noexcept
+    : dir(std::move(dir))
+{
+}
+
+std::filesystem::path UABDigestCache::defaultDir() noexcept
+{
+    const auto *runtimeDir = ::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir != nullptr && runtimeDir[0] != '\0') {
+        return std::filesystem::path{ runtimeDir } / "linglong" / "uab-verified";
+    }
+
+    const auto *cacheDir = ::getenv("XDG_CACHE_HOME");
+    if (cacheDir != nullptr && cacheDir[0] != '\0') {
+        return std::filesystem::path{ cacheDir } / "linglong" / "uab-verified";
+    }
+
+    const auto *home = ::getenv("HOME");
+    return std::filesystem::path{ home != nullptr ? home : "/tmp" } / ".cache" / "linglong"
+      / "uab-verified";
+}
+
+bool UABDigestCache::contains(int fd, std::string_view digest) const noexcept
+{
+    auto identity = identify(fd, digest);
+    if (!identity) {
+        return false;
+    }
+
+    std::ifstream ifs(this->dir / identity->name);
+    std::string stamp;
+    return ifs.is_open() && std::getline(ifs, stamp) && stamp == identity->stamp;
+}
+
+void UABDigestCache::insert(int fd, std::string_view digest) const noexcept
+{
+    auto identity = identify(fd, digest);
+    if (!identity) {
+        return;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(this->dir, ec);
+    if (ec) {
+        qDebug() << "failed to create uab digest cache" << this->dir.c_str()
+                 << ec.message().c_str();
+        return;
+    }
+    std::filesystem::permissions(this->dir, std::filesystem::perms::owner_all, ec);
+
+    auto file = this->dir / identity->name;
+    auto tmpFile = file;
+    tmpFile += "." + std::to_string(::getpid()) + ".tmp";
+    {
+        std::ofstream ofs(tmpFile, std::ios::trunc);
+        if (!ofs.is_open() || !(ofs << identity->stamp << '\n').flush()) {
+            qDebug() << "failed to write uab digest cache" << tmpFile.c_str();
+            return;
+        }
+    }
+
+    std::filesystem::rename(tmpFile, file, ec);
+    if (ec) {
+        qDebug() << "failed to replace uab digest cache:" << ec.message().c_str();
+        std::filesystem::remove(tmpFile, ec);
+    }
+}
+
+} // namespace linglong::package
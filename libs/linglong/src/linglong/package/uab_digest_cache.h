@@ -0,0 +1,31 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <filesystem>
+#include <string_view>
+
+namespace linglong::package {
+
+// UABDigestCache remembers bundles whose digest has been verified, keyed by device, inode, size,
+// mtime and ctime of the file. Any change to the file invalidates its entry, so the bundle only
+// has to be hashed again after it was modified. The uab header keeps a copy of this logic with
+// the same on-disk format, keep them in sync.
+class UABDigestCache
+{
+public:
+    explicit UABDigestCache(std::filesystem::path dir) noexcept;
+
+    // $XDG_RUNTIME_DIR/linglong/uab-verified, or ~/.cache/linglong/uab-verified without it
+    static std::filesystem::path defaultDir() noexcept;
+
+    [[nodiscard]] bool contains(int fd, std::string_view digest) const noexcept;
+    void insert(int fd, std::string_view digest) const noexcept;
+
+private:
+    std::filesystem::path dir;
+};
+
+} // namespace linglong::package
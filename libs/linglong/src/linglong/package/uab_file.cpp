@@ -5,12 +5,13 @@
 #include "linglong/package/uab_file.h"
 
 #include "linglong/api/types/v1/Generators.hpp"
-#include "linglong/utils/command/env.h"
+#include "linglong/package/erofs.h"
+#include "linglong/package/uab_digest_cache.h"
+#include "linglong/package/uab_merkle.h"
 #include "linglong/utils/finally/finally.h"
 
 #include <nlohmann/json.hpp>
 
-#include <QCryptographicHash>
 #include <QDir>
 #include <QFileInfo>
 #include <QStandardPaths>
@@ -58,7 +59,7 @@ utils::error::Result<std::shared_ptr<UABFile>> UABFile::loadFromFile(const QStri
 UABFile::~UABFile()
 {
     if (!mountPoint.isEmpty()) {
-        auto ret = utils::command::Exec("umount", { mountPoint });
+        auto ret = umountErofs(mountPoint);
         if (!ret) {
             qCritical() << "failed to umount " << mountPoint << ", please umount it manually";
         }
@@ -150,32 +151,55 @@ utils::error::Result<bool> UABFile::verify() noexcept
           QString{ "couldn't find bundle section which named %1" }.arg(bundleSection));
     }
 
-    std::array<char, 4096> buf{};
-    std::string digest;
-    QCryptographicHash cryptor{ QCryptographicHash::Sha256 };
+    UABDigestCache cache{ UABDigestCache::defaultDir() };
+    if (cache.contains(handle(), expectedDigest)) {
+        return true;
+    }
 
-    seek(bundleSh->sh_offset);
-    auto backToHead = utils::finally::finally([this] {
-        seek(0);
-    });
+    if (metaInfo.merkle) {
+        // the chunk size decides how many hashes are allocated, check it against the number of
+        // chunks in the metadata before hashing
+        auto chunkSize = metaInfo.merkle->chunkSize;
+        if (chunkSize <= 0 || chunkSize > maxMerkleChunkSize) {
+            return LINGLONG_ERR(QString{ "invalid chunk size %1" }.arg(chunkSize));
+        }
+
+        auto size = static_cast<uint64_t>(bundleSh->sh_size);
+        auto count = size / chunkSize + (size % chunkSize != 0 ? 1 : 0);
+        if (count != metaInfo.merkle->chunks.size()) {
+            return false;
+        }
 
-    auto bundleLength = bundleSh->sh_size;
-    auto readBytes = buf.size();
-    int bytesRead{ 0 };
-    while ((bytesRead = read(buf.data(), readBytes)) != 0) {
-        if (bytesRead == -1) {
-            return LINGLONG_ERR(QString{ "read error: %1" }.arg(errorString()));
+        auto merkle = calculateMerkle(handle(),
+                                      static_cast<int64_t>(bundleSh->sh_offset),
+                                      static_cast<int64_t>(bundleSh->sh_size),
+                                      metaInfo.merkle->chunkSize);
+        if (!merkle) {
+            return LINGLONG_ERR(merkle);
         }
 
-        cryptor.addData(buf.data(), bytesRead);
-        bundleLength -= bytesRead;
-        if (bundleLength <= 0) {
-            digest = cryptor.result().toHex().toStdString();
-            break;
+        if (merkle->chunks != metaInfo.merkle->chunks
+            || merkleRoot(merkle->chunks) != expectedDigest) {
+            return false;
         }
+
+        cache.insert(handle(), expectedDigest);
+        return true;
+    }
+
+    auto digest = calculateDigest(handle(),
+                                  static_cast<int64_t>(bundleSh->sh_offset),
+                                  static_cast<int64_t>(bundleSh->sh_size));
+    if (!digest) {
+        return LINGLONG_ERR(digest);
+    }
+
+    if (*digest != expectedDigest) {
+        return false;
     }
 
-    return (expectedDigest == digest);
+    cache.insert(handle(), expectedDigest);
+    return true;
 }
 
 utils::error::Result<QDir> UABFile::mountUab() noexcept
@@ -203,15 +227,12 @@ utils::error::Result<QDir> UABFile::mountUab() noexcept
         return LINGLONG_ERR(QString{ "failed mkpath %1" }.arg(uabDir.absolutePath()));
     }
 
-    auto ret = utils::command::Exec(
-      "erofsfuse",
-      { QString{ "--offset=%1" }.arg(bundleOffset), fileName(), uabDir.absolutePath() });
+    auto ret = mountErofs(fileName(), bundleOffset, bundleSh->sh_size, uabDir.absolutePath());
     if (!ret) {
         return LINGLONG_ERR(ret.error());
     }
 
     this->mountPoint = uabDir.absolutePath();
-    qDebug() << "erofsfuse output:" << *ret;
 
     return mountPoint;
 }
@@ -0,0 +1,215 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "linglong/package/uab_merkle.h"
+
+#include <openssl/evp.h>
+
+#include <QByteArray>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace linglong::package {
+
+namespace {
+
+// MappedRange maps [offset, offset + length) of a file read only, offset needn't be aligned.
+// The range must lie within the file, reading a mapping past the end of the file raises SIGBUS.
+class MappedRange
+{
+public:
+    MappedRange(const MappedRange &) = delete;
+    MappedRange &operator=(const MappedRange &) = delete;
+    MappedRange(MappedRange &&) = delete;
+    MappedRange &operator=(MappedRange &&) = delete;
+
+    MappedRange(int fd, int64_t offset, int64_t length, int advice) noexcept
+    {
+        if (length == 0) {
+            return;
+        }
+
+        // the range comes from the section headers of the file, which can't be trusted
+        struct stat sb
+        {
+        };
+
+        if (::fstat(fd, &sb) == -1) {
+            this->error = errno;
+            return;
+        }
+
+        if (offset > sb.st_size || length > sb.st_size - offset) {
+            this->error = ERANGE;
+            return;
+        }
+
+        // mmap requires the offset to be aligned to pages
+        const auto pageSize = static_cast<int64_t>(::sysconf(_SC_PAGESIZE));
+        const auto alignedOffset = offset / pageSize * pageSize;
+        this->mappedLength = static_cast<std::size_t>(length + offset - alignedOffset);
+        this->addr = ::mmap(nullptr, this->mappedLength, PROT_READ, MAP_PRIVATE, fd, alignedOffset);
+        if (this->addr == MAP_FAILED) {
+            this->error = errno;
+            return;
+        }
+
+        ::madvise(this->addr, this->mappedLength, advice);
+        this->begin = static_cast<const unsigned char *>(this->addr) + (offset - alignedOffset);
+    }
+
+    ~MappedRange()
+    {
+        if (this->addr != MAP_FAILED) {
+            ::munmap(this->addr, this->mappedLength);
+        }
+    }
+
+    [[nodiscard]] const unsigned char *data() const noexcept { return this->begin; }
+
+    // errno of fstat or mmap, ERANGE if the range exceeds the file, 0 on success
+    [[nodiscard]] int mmapError() const noexcept { return this->error; }
+
+private:
+    void *addr{ MAP_FAILED };
+    std::size_t mappedLength{ 0 };
+    const unsigned char *begin{ nullptr };
+    int error{ 0 };
+};
+
+using Sha256 = std::array<unsigned char, 32>;
+
+// OpenSSL picks the SHA extensions or AVX2 implementation of the cpu at runtime
+bool sha256(const unsigned char *data, std::size_t size, Sha256 &out) noexcept
+{
+    unsigned int outLength{ 0 };
+    return EVP_Digest(data, size, out.data(), &outLength, EVP_sha256(), nullptr) == 1
+      && outLength == out.size();
+}
+
+std::string toHex(const Sha256 &hash) noexcept
+{
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(hash.data()), // NOLINT
+                                   static_cast<int>(hash.size()))
+      .toHex()
+      .toStdString();
+}
+
+} // namespace
+
+utils::error::Result<std::string> calculateDigest(int fd, int64_t offset, int64_t length) noexcept
+{
+    LINGLONG_TRACE(QString{ "calculate digest of %1 bytes at %2" }.arg(length).arg(offset));
+
+    if (offset < 0 || length < 0) {
+        return LINGLONG_ERR("invalid range");
+    }
+
+    MappedRange range{ fd, offset, length, MADV_SEQUENTIAL };
+    if (range.mmapError() != 0) {
+        return LINGLONG_ERR(QString{ "map bundle: %1" }.arg(::strerror(range.mmapError())));
+    }
+
+    Sha256 hash{};
+    if (!sha256(range.data(), static_cast<std::size_t>(length), hash)) {
+        return LINGLONG_ERR("failed to calculate sha256");
+    }
+
+    return toHex(hash);
+}
+
+utils::error::Result<api::types::v1::UabMerkle> calculateMerkle(int fd,
+                                                                int64_t offset,
+                                                                int64_t length,
+                                                                int64_t chunkSize,
+                                                                unsigned int jobs) noexcept
+{
+    LINGLONG_TRACE(QString{ "calculate merkle of %1 bytes at %2" }.arg(length).arg(offset));
+
+    if (offset < 0 || length < 0 || chunkSize <= 0 || chunkSize > maxMerkleChunkSize) {
+        return LINGLONG_ERR("invalid range or chunk size");
+    }
+
+    api::types::v1::UabMerkle merkle{ {}, chunkSize };
+    auto count = static_cast<std::size_t>((length + chunkSize - 1) / chunkSize);
+    merkle.chunks.resize(count);
+    if (count == 0) {
+        return merkle;
+    }
+
+    MappedRange range{ fd, offset, length, MADV_WILLNEED };
+    if (range.mmapError() != 0) {
+        return LINGLONG_ERR(QString{ "map bundle: %1" }.arg(::strerror(range.mmapError())));
+    }
+
+    std::atomic<std::size_t> next{ 0 };
+    std::atomic_bool failed{ false };
+    auto worker = [&]() {
+        for (auto i = next++; i < count && !failed; i = next++) {
+            auto begin = static_cast<int64_t>(i) * chunkSize;
+            auto size = static_cast<std::size_t>(std::min(chunkSize, length - begin));
+            Sha256 hash{};
+            if (!sha256(range.data() + begin, size, hash)) {
+                failed = true;
+                return;
+            }
+            merkle.chunks[i] = toHex(hash);
+        }
+    };
+
+    if (jobs == 0) {
+        jobs = std::max(std::thread::hardware_concurrency(), 1U);
+    }
+    jobs = static_cast<unsigned int>(std::min<std::size_t>(jobs, count));
+
+    std::vector<std::thread> workers;
+    workers.reserve(jobs - 1);
+    try {
+        for (unsigned int i = 1; i < jobs; ++i) {
+            workers.emplace_back(worker);
+        }
+    } catch (const std::system_error &e) {
+        // the remaining chunks are hashed by the threads already started
+        qWarning() << "failed to start hashing thread:" << e.what();
+    }
+    worker();
+    for (auto &thread : workers) {
+        thread.join();
+    }
+
+    if (failed) {
+        return LINGLONG_ERR("failed to calculate sha256 of chunks");
+    }
+
+    return merkle;
+}
+
+std::string merkleRoot(const std::vector<std::string> &chunks) noexcept
+{
+    QByteArray hashes;
+    hashes.reserve(static_cast<int>(chunks.size() * std::tuple_size_v<Sha256>));
+    for (const auto &chunk : chunks) {
+        hashes.append(QByteArray::fromHex(QByteArray::fromStdString(chunk)));
+    }
+
+    Sha256 root{};
+    if (!sha256(reinterpret_cast<const unsigned char *>(hashes.constData()), // NOLINT
+                static_cast<std::size_t>(hashes.size()),
+                root)) {
+        return {};
+    }
+
+    return toHex(root);
+}
+
+} // namespace linglong::package
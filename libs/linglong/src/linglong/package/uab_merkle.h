@@ -0,0 +1,36 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include "linglong/api/types/v1/UabMerkle.hpp"
+#include "linglong/utils/error/error.h"
+
+#include <string>
+#include <vector>
+
+namespace linglong::package {
+
+constexpr int64_t defaultMerkleChunkSize = 4 * 1024 * 1024;
+// the chunk size is read from the metadata of a bundle, larger ones are rejected
+constexpr int64_t maxMerkleChunkSize = 1024 * 1024 * 1024;
+
+// Returns the hex encoded sha256 of exactly [offset, offset + length) of fd. The range is mapped
+// into memory and hashed by OpenSSL, which uses the SIMD extensions of the cpu. A range exceeding
+// the file is rejected.
+utils::error::Result<std::string> calculateDigest(int fd, int64_t offset, int64_t length) noexcept;
+
+// Hashes the range [offset, offset + length) of fd in chunks of chunkSize. The file is mapped into
+// memory and the chunks are hashed on `jobs` threads, or on all cores if jobs is 0. The chunk size
+// must be in (0, maxMerkleChunkSize].
+utils::error::Result<api::types::v1::UabMerkle> calculateMerkle(int fd,
+                                                                int64_t offset,
+                                                                int64_t length,
+                                                                int64_t chunkSize,
+                                                                unsigned int jobs = 0) noexcept;
+
+// the sha256 of the binary chunk hashes concatenated in order, stored as the digest of the bundle
+std::string merkleRoot(const std::vector<std::string> &chunks) noexcept;
+
+} // namespace linglong::package
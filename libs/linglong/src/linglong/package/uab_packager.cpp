@@ -7,13 +7,13 @@
 #include "linglong/api/types/v1/Generators.hpp"
 #include "linglong/api/types/v1/Version.hpp"
 #include "linglong/package/architecture.h"
+#include "linglong/package/uab_merkle.h"
 #include "linglong/utils/command/env.h"
 #include "linglong/utils/configure.h"
 #include "linglong/utils/serialize/json.h"
 
 #include <yaml-cpp/yaml.h>
 
-#include <QCryptographicHash>
 #include <QStandardPaths>
 
 #include <fstream>
@@ -201,6 +201,11 @@ utils::error::Result<void> UABPackager::include(const std::vector<std::string> &
     return LINGLONG_OK;
 }
 
+void UABPackager::setErofsOptions(ErofsOptions options) noexcept
+{
+    this->erofsOptions = std::move(options);
+}
+
 utils::error::Result<void> UABPackager::pack(const QString &uabFilename) noexcept
 {
     LINGLONG_TRACE("package uab")
@@ -578,10 +583,7 @@ utils::error::Result<void> UABPackager::packBundle() noexcept
             return ret;
         }
 
-        if (auto ret =
-              utils::command::Exec("mkfs.erofs",
-                                   { "-zlz4hc,9", "-b4096", bundleFile, bundleDir.absolutePath() });
-            !ret) {
+        if (auto ret = mkfsErofs(bundleFile, bundleDir.absolutePath(), this->erofsOptions); !ret) {
             return LINGLONG_ERR(ret);
         }
     }
@@ -592,11 +594,24 @@ utils::error::Result<void> UABPackager::packBundle() noexcept
         return LINGLONG_ERR(bundle);
     }
 
-    QCryptographicHash cryptor{ QCryptographicHash::Sha256 };
-    if (!cryptor.addData(&bundle)) {
-        return LINGLONG_ERR(QString{ "failed to calculate digest from %1: %2" }.arg(bundleFile));
+    // a chunked digest is hashed in parallel, but couldn't be verified by older versions
+    if (!::qgetenv("LINGLONG_UAB_CHUNKED_DIGEST").isEmpty()) {
+        auto merkle = calculateMerkle(bundle.handle(), 0, bundle.size(), defaultMerkleChunkSize);
+        if (!merkle) {
+            return LINGLONG_ERR(merkle);
+        }
+
+        this->meta.version = api::types::v1::Version::The2;
+        this->meta.digest = merkleRoot(merkle->chunks);
+        this->meta.merkle = std::move(merkle).value();
+    } else {
+        auto digest = calculateDigest(bundle.handle(), 0, bundle.size());
+        if (!digest) {
+            return LINGLONG_ERR(QString{ "failed to calculate digest from %1" }.arg(bundleFile),
+                                digest);
+        }
+        this->meta.digest = std::move(digest).value();
     }
-    this->meta.digest = cryptor.result().toHex().toStdString();
     const auto *bundleSection = "linglong.bundle";
     if (auto ret = this->uab.addNewSection(bundleSection, bundleFile); !ret) {
         return LINGLONG_ERR(ret);
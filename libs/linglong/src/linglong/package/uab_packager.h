@@ -5,6 +5,7 @@
 #pragma once
 
 #include "linglong/api/types/v1/UabMetaInfo.hpp"
+#include "linglong/package/erofs.h"
 #include "linglong/package/layer_dir.h"
 #include "linglong/utils/error/error.h"
 
@@ -71,6 +72,7 @@ public:
     utils::error::Result<void> pack(const QString &uabFilename) noexcept;
     utils::error::Result<void> exclude(const std::vector<std::string> &files) noexcept;
     utils::error::Result<void> include(const std::vector<std::string> &files) noexcept;
+    void setErofsOptions(ErofsOptions options) noexcept;
 
 private:
     [[nodiscard]] utils::error::Result<void> packIcon() noexcept;
@@ -87,5 +89,6 @@ private:
     std::optional<QFileInfo> icon{ std::nullopt };
     api::types::v1::UabMetaInfo meta;
     QDir buildDir;
+    ErofsOptions erofsOptions;
 };
 } // namespace linglong::package
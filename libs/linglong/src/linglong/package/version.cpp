@@ -5,140 +5,79 @@
  */
 #include "linglong/package/version.h"
 
-#include <QRegularExpression>
 #include <QString>
-#include <QStringBuilder>
 
-#if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
-namespace Qt {
-static auto SkipEmptyParts = QString::SkipEmptyParts;
-} // namespace Qt
-#endif
+#include <algorithm>
+#include <limits>
 
 namespace linglong::package {
-namespace {
 
-struct PreRelease
+const char *versionErrorString(VersionError error) noexcept
 {
-    explicit PreRelease(const QString &raw)
-        : list(raw.split('.', Qt::SkipEmptyParts))
-    {
+    switch (error) {
+    case VersionError::None:
+        return "no error";
+    case VersionError::Mismatched:
+        return "version regex mismatched, please use four digits version like 1.0.0.0";
+    case VersionError::MajorTooLarge:
+        return "major too large";
+    case VersionError::MinorTooLarge:
+        return "minor too large";
+    case VersionError::PatchTooLarge:
+        return "patch too large";
+    case VersionError::TweakTooLarge:
+        return "tweak too large";
     }
 
-    bool operator==(const PreRelease &that) const { return this->list == that.list; };
-
-    bool operator<(const PreRelease &that) const
-    {
-        auto limit = std::min(this->list.size(), that.list.size());
-        for (decltype(limit) i = 0; i < limit; i++) {
-            bool ok = false;
-            auto thisAsNumber = this->list[i].toInt(&ok);
-            if (!ok) {
-                thisAsNumber = std::numeric_limits<decltype(thisAsNumber)>::max();
-            }
-            auto thatAsNumber = that.list[i].toInt(&ok);
-            if (!ok) {
-                thatAsNumber = std::numeric_limits<decltype(thatAsNumber)>::max();
-            }
-
-            if (thisAsNumber != thatAsNumber) {
-                return thisAsNumber < thatAsNumber;
-            }
-
-            if (this->list[i] != that.list[i]) {
-                return this->list[i] < that.list[i];
-            }
-        }
-
-        if (this->list.isEmpty()) {
-            return false;
-        }
-
-        if (that.list.isEmpty()) {
-            return !this->list.isEmpty();
-        }
-
-        return this->list.size() < that.list.size();
+    return "unknown error";
+}
+
+tl::expected<Version, VersionError>
+Version::fromNumbers(const detail::VersionNumbers &numbers) noexcept
+{
+    if (numbers.error != VersionError::None) {
+        return tl::unexpected(numbers.error);
     }
 
-    bool operator>(const PreRelease &that) const
-    {
-        auto limit = std::min(this->list.size(), that.list.size());
-        for (decltype(limit) i = 0; i < limit; i++) {
-            bool ok = false;
-            auto thisAsNumber = this->list[i].toInt(&ok);
-            if (!ok) {
-                thisAsNumber = std::numeric_limits<decltype(thisAsNumber)>::max();
-            }
-            auto thatAsNumber = that.list[i].toInt(&ok);
-            if (!ok) {
-                thatAsNumber = std::numeric_limits<decltype(thatAsNumber)>::max();
-            }
-
-            if (thisAsNumber != thatAsNumber) {
-                return thisAsNumber > thatAsNumber;
-            }
-
-            if (this->list[i] != that.list[i]) {
-                return this->list[i] > that.list[i];
-            }
-        }
-
-        if (this->list.isEmpty()) {
-            return !that.list.isEmpty();
-        }
-
-        if (that.list.isEmpty()) {
-            return false;
-        }
-
-        return this->list.size() > that.list.size();
+    Version version;
+    version.major = numbers.numbers[0];
+    version.minor = numbers.numbers[1];
+    version.patch = numbers.numbers[2];
+    if (numbers.count == 4) {
+        version.tweak = numbers.numbers[3];
     }
+    return version;
+}
 
-    QStringList list;
-};
+tl::expected<Version, VersionError> Version::tryParse(std::string_view raw) noexcept
+{
+    return fromNumbers(detail::parseVersionNumbers(raw));
+}
 
-} // namespace
+tl::expected<Version, VersionError> Version::tryParse(QStringView raw) noexcept
+{
+    return fromNumbers(detail::parseVersionNumbers(raw.utf16(), raw.size()));
+}
 
 utils::error::Result<Version> Version::parse(const QString &raw) noexcept
-try {
-    return Version(raw);
-} catch (const std::exception &e) {
-    LINGLONG_TRACE("parse version " + raw);
-    return LINGLONG_ERR(e);
+{
+    auto version = tryParse(QStringView(raw));
+    if (!version) {
+        LINGLONG_TRACE("parse version " + raw);
+        return LINGLONG_ERR(versionErrorString(version.error()));
+    }
+
+    return *version;
 }
 
 Version::Version(const QString &raw)
 {
-    // modified from https://regex101.com/r/vkijKf/1/
-    static QRegularExpression regexExp(
-      R"(^(0|[1-9]\d*)\.(0|[1-9]\d*)\.(0|[1-9]\d*)(?:\.(0|[1-9]\d*))?$)");
-
-    QRegularExpressionMatch matched = regexExp.match(raw);
-
-    if (!matched.hasMatch()) {
-        throw std::runtime_error("version regex mismatched, please use four digits version like 1.0.0.0");
+    auto version = tryParse(QStringView(raw));
+    if (!version) {
+        throw std::runtime_error(versionErrorString(version.error()));
     }
 
-    bool ok = false;
-    this->major = matched.captured(1).toLongLong(&ok);
-    if (!ok) {
-        throw std::runtime_error("major too large");
-    }
-    this->minor = matched.captured(2).toLongLong(&ok);
-    if (!ok) {
-        throw std::runtime_error("minor too large");
-    }
-    this->patch = matched.captured(3).toLongLong(&ok);
-    if (!ok) {
-        throw std::runtime_error("patch too large");
-    }
-    if (!matched.captured(4).isNull()) {
-        this->tweak = matched.captured(4).toLongLong(&ok);
-        if (!ok) {
-            throw std::runtime_error("tweak too large");
-        }
-    }
+    *this = *version;
 }
 
 bool Version::operator==(const Version &that) const noexcept
@@ -199,4 +138,17 @@ QString Version::toString() const noexcept
       .arg(this->patch)
       .arg(this->tweak ? "." + QString::number(*this->tweak) : "");
 }
+
+PackedVersion Version::pack() const noexcept
+{
+    const qlonglong max = std::numeric_limits<uint32_t>::max();
+    auto part = [max](qlonglong number) -> PackedVersion {
+        return std::clamp<qlonglong>(number, 0, max);
+    };
+
+    // the tweak is stored plus one, so 0 is left for a missing one
+    auto tweak = this->tweak ? part(std::min(*this->tweak, max - 1) + 1) : 0;
+    return part(this->major) << 96 | part(this->minor) << 64 | part(this->patch) << 32 | tweak;
+}
+
 } // namespace linglong::package
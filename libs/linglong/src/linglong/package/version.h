@@ -9,16 +9,107 @@
 #include "linglong/utils/error/error.h"
 
 #include <QString>
+#include <QStringView>
+#include <tl/expected.hpp>
 
+#include <limits>
 #include <optional>
+#include <string_view>
 
 namespace linglong::package {
 
+// A version packed into an integer, which compares in the same order as Version. Each number takes
+// 32 bits and saturates beyond that, a missing tweak sorts before any tweak.
+__extension__ typedef unsigned __int128 PackedVersion;
+
+enum class VersionError {
+    None,
+    Mismatched,
+    MajorTooLarge,
+    MinorTooLarge,
+    PatchTooLarge,
+    TweakTooLarge,
+};
+
+const char *versionErrorString(VersionError error) noexcept;
+
+namespace detail {
+
+struct VersionNumbers
+{
+    qlonglong numbers[4]{};
+    int count{ 0 };
+    VersionError error{ VersionError::None };
+};
+
+// Parses the same grammar as ^(0|[1-9]\d*)\.(0|[1-9]\d*)\.(0|[1-9]\d*)(?:\.(0|[1-9]\d*))?$ in a
+// single pass. It neither allocates nor throws, so it could be evaluated at compile time.
+template<typename Char>
+constexpr VersionNumbers parseVersionNumbers(const Char *str, std::size_t size) noexcept
+{
+    constexpr auto isDigit = [](Char c) {
+        return c >= Char('0') && c <= Char('9');
+    };
+    constexpr VersionError tooLarge[] = { VersionError::MajorTooLarge,
+                                          VersionError::MinorTooLarge,
+                                          VersionError::PatchTooLarge,
+                                          VersionError::TweakTooLarge };
+
+    VersionNumbers ret;
+    // overflow is reported only if the whole string matches, like the regex did
+    auto overflow = VersionError::None;
+    std::size_t pos = 0;
+    while (true) {
+        if (ret.count == 4 || pos == size || !isDigit(str[pos])) {
+            ret.error = VersionError::Mismatched;
+            return ret;
+        }
+        if (str[pos] == Char('0') && pos + 1 < size && isDigit(str[pos + 1])) {
+            ret.error = VersionError::Mismatched;
+            return ret;
+        }
+
+        qlonglong number = 0;
+        for (; pos < size && isDigit(str[pos]); ++pos) {
+            auto digit = static_cast<qlonglong>(str[pos] - Char('0'));
+            if (number > (std::numeric_limits<qlonglong>::max() - digit) / 10) {
+                if (overflow == VersionError::None) {
+                    overflow = tooLarge[ret.count];
+                }
+                continue;
+            }
+            number = number * 10 + digit;
+        }
+        ret.numbers[ret.count++] = number;
+
+        if (pos == size) {
+            break;
+        }
+        if (str[pos++] != Char('.')) {
+            ret.error = VersionError::Mismatched;
+            return ret;
+        }
+    }
+
+    ret.error = ret.count < 3 ? VersionError::Mismatched : overflow;
+    return ret;
+}
+
+constexpr VersionNumbers parseVersionNumbers(std::string_view raw) noexcept
+{
+    return parseVersionNumbers(raw.data(), raw.size());
+}
+
+} // namespace detail
+
 // This is a 4 number semver
 class Version final
 {
 public:
     static utils::error::Result<Version> parse(const QString &raw) noexcept;
+    // Like parse, but reports failures with an error code and never allocates.
+    static tl::expected<Version, VersionError> tryParse(std::string_view raw) noexcept;
+    static tl::expected<Version, VersionError> tryParse(QStringView raw) noexcept;
     explicit Version(const QString &raw);
 
     qlonglong major = 0;
@@ -34,5 +125,11 @@ public:
     bool operator>=(const Version &that) const noexcept;
 
     QString toString() const noexcept;
+    [[nodiscard]] PackedVersion pack() const noexcept;
+
+private:
+    Version() = default;
+    static tl::expected<Version, VersionError>
+    fromNumbers(const detail::VersionNumbers &numbers) noexcept;
 };
 } // namespace linglong::package
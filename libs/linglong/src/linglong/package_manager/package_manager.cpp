@@ -9,12 +9,12 @@
 #include "linglong/adaptors/migrate/migrate1.h"
 #include "linglong/api/types/v1/Generators.hpp"
 #include "linglong/api/types/v1/PackageManager1JobInfo.hpp"
+#include "linglong/package/erofs.h"
 #include "linglong/package/layer_file.h"
 #include "linglong/package/layer_packager.h"
 #include "linglong/package/uab_file.h"
 #include "linglong/package_manager/task.h"
 #include "linglong/package_manager/migrate.h"
-#include "linglong/utils/command/env.h"
 #include "linglong/utils/dbus/register.h"
 #include "linglong/utils/finally/finally.h"
 #include "linglong/utils/packageinfo_handler.h"
@@ -31,11 +31,22 @@
 #include <QUuid>
 
 #include <algorithm>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <numeric>
 #include <utility>
 
 namespace linglong::service {
 
 namespace {
+
+// installs are mostly waiting for the network, a few of them could run at the same time without
+// competing for the CPU, could be overridden by LINGLONG_MAX_RUNNING_TASKS
+constexpr int defaultMaxRunningTasks = 4;
+// searches of different references run in parallel, could be overridden by LINGLONG_MAX_SEARCH_JOBS
+constexpr int defaultMaxSearchJobs = 4;
+
 template<typename T>
 QVariantMap toDBusReply(const utils::error::Result<T> &x) noexcept
 {
@@ -85,47 +96,221 @@ PackageManager::PackageManager(linglong::repo::OSTreeRepo &repo, QObject *parent
     : QObject(parent)
     , repo(repo)
 {
+    // TaskChanged of InstallTask is emitted from the threads of taskPool
+    qRegisterMetaType<InstallTask::Status>();
+
+    bool ok{ false };
+    auto maxRunningTasks = qEnvironmentVariableIntValue("LINGLONG_MAX_RUNNING_TASKS", &ok);
+    if (!ok || maxRunningTasks <= 0) {
+        maxRunningTasks = defaultMaxRunningTasks;
+    }
+    this->taskPool.setMaxThreadCount(maxRunningTasks);
+    // threads are cheap to keep, but the idle ones shouldn't live forever in a daemon
+    this->taskPool.setExpiryTimeout(60 * 1000);
+
+    auto maxSearchJobs = qEnvironmentVariableIntValue("LINGLONG_MAX_SEARCH_JOBS", &ok);
+    if (!ok || maxSearchJobs <= 0) {
+        maxSearchJobs = defaultMaxSearchJobs;
+    }
+    this->searchPool.setMaxThreadCount(maxSearchJobs);
+    this->searchPool.setExpiryTimeout(60 * 1000);
+
     // exec install on task list changed signal
     connect(
       this,
       &PackageManager::TaskListChanged,
       this,
-      [this](const QString &taskID) {
-          // notify task waiting
-          if (!this->runningTaskID.isEmpty()) {
-              for (auto &task : taskList) {
-                  // skip tasks without job
-                  if (!task.getJob().has_value() || task.taskID() == runningTaskID) {
-                      continue;
-                  }
-                  auto msg = QString("Waiting for the other tasks");
-                  task.updateStatus(InstallTask::Queued, msg);
-              }
-              return;
-          }
-          // start next task
-          this->runningTaskID = taskID;
-          if (this->taskList.empty()) {
-              return;
-          };
-          for (auto task = taskList.begin(); task != taskList.end(); ++task) {
-              if (!task->getJob().has_value() || task->currentStatus() != InstallTask::Queued) {
-                  continue;
-              }
-              // execute the task
-              auto func = *task->getJob();
-              func();
-              this->runningTaskID = "";
-              taskList.erase(task);
-              Q_EMIT this->TaskListChanged("");
-              return;
-          }
+      [this]() {
+          this->scheduleTasks();
       },
       Qt::QueuedConnection);
 }
 
+void PackageManager::scheduleTasks() noexcept
+{
+    // tasks are started again once the migration is done
+    if (this->migrating) {
+        return;
+    }
+
+    this->runPendingUninstalls();
+
+    if (this->pendingConfiguration || this->pendingMigration != nullptr) {
+        if (this->busy()) {
+            return;
+        }
+
+        if (this->pendingConfiguration) {
+            auto result = this->repo.setConfig(*this->pendingConfiguration);
+            this->pendingConfiguration.reset();
+            if (!result) {
+                qCritical() << "failed to update configuration:" << result.error().message();
+            }
+        }
+
+        if (this->pendingMigration != nullptr) {
+            this->startMigration(std::exchange(this->pendingMigration, nullptr));
+            return;
+        }
+    }
+
+    for (auto task = taskList.begin(); task != taskList.end();) {
+        // skip tasks without job and the running ones
+        if (!task->getJob().has_value() || this->runningTaskIDs.contains(task->taskID())) {
+            ++task;
+            continue;
+        }
+
+        // canceled before it got the chance to run
+        if (task->currentStatus() != InstallTask::Queued) {
+            task = taskList.erase(task);
+            continue;
+        }
+
+        auto conflicted =
+          std::any_of(taskList.cbegin(), taskList.cend(), [this, &task](const InstallTask &other) {
+              if (!this->runningTaskIDs.contains(other.taskID())) {
+                  return false;
+              }
+
+              return std::any_of(other.packageIDs().cbegin(),
+                                 other.packageIDs().cend(),
+                                 [&task](const QString &id) {
+                                     return task->packageIDs().contains(id);
+                                 });
+          });
+        if (conflicted || this->runningTaskIDs.size() >= this->taskPool.maxThreadCount()) {
+            // notify task waiting
+            auto msg = QString("Waiting for the other tasks");
+            task->updateStatus(InstallTask::Queued, msg);
+            ++task;
+            continue;
+        }
+
+        // execute the task, the task won't be removed from the list until it finished
+        this->runningTaskIDs.insert(task->taskID());
+        this->taskPool.start([this, job = *task->getJob(), taskID = task->taskID()]() {
+            job();
+            QMetaObject::invokeMethod(
+              this,
+              [this, taskID]() {
+                  this->finishTask(taskID);
+              },
+              Qt::QueuedConnection);
+        });
+        ++task;
+    }
+}
+
+void PackageManager::finishTask(const QString &taskID) noexcept
+{
+    this->runningTaskIDs.remove(taskID);
+    {
+        std::lock_guard<std::mutex> lock(this->layerUsersMutex);
+        for (auto users = this->layerUsers.begin(); users != this->layerUsers.end();) {
+            users->remove(taskID);
+            if (users->isEmpty()) {
+                users = this->layerUsers.erase(users);
+                continue;
+            }
+            ++users;
+        }
+    }
+
+    auto task = std::find_if(taskList.begin(), taskList.end(), [&taskID](const InstallTask &task) {
+        return task.taskID() == taskID;
+    });
+    if (task == taskList.end()) {
+        qCritical() << "the status of package manager is invalid";
+        return;
+    }
+
+    taskList.erase(task);
+    Q_EMIT this->TaskListChanged("");
+}
+
+bool PackageManager::busy() const noexcept
+{
+    return this->migrating || !this->runningTaskIDs.isEmpty() || !this->searchingJobs.isEmpty();
+}
+
+std::optional<QVariantMap> PackageManager::tryUninstall(const package::Reference &ref,
+                                                        const std::string &module) noexcept
+{
+    auto operated =
+      std::any_of(taskList.cbegin(), taskList.cend(), [this, &ref](const InstallTask &task) {
+          return this->runningTaskIDs.contains(task.taskID())
+            && task.packageIDs().contains(ref.id);
+      });
+
+    // like removeUnusedLayer, a task starting to use the layer meanwhile either prevents the
+    // removal or finds the layer missing and pulls it again
+    std::lock_guard<std::mutex> lock(this->layerUsersMutex);
+    QString layer = ref.toString() % "/" % QString::fromStdString(module);
+    if (operated || this->layerUsers.contains(layer)) {
+        return std::nullopt;
+    }
+
+    this->repo.unexportReference(ref);
+    auto result = this->repo.remove(ref, module);
+    if (!result) {
+        return toDBusReply(result);
+    }
+
+    return toDBusReply(0, "Uninstall " + ref.toString() + " success.");
+}
+
+void PackageManager::runPendingUninstalls() noexcept
+{
+    for (auto call = this->pendingUninstalls.begin(); call != this->pendingUninstalls.end();) {
+        auto reply = this->tryUninstall(call->ref, call->module);
+        if (!reply) {
+            ++call;
+            continue;
+        }
+
+        call->connection.send(call->message.createReply(*reply));
+        call = this->pendingUninstalls.erase(call);
+    }
+}
+
+void PackageManager::useLayer(const InstallTask &taskContext,
+                              const package::Reference &ref,
+                              const std::string &module) noexcept
+{
+    std::lock_guard<std::mutex> lock(this->layerUsersMutex);
+    this->layerUsers[ref.toString() % "/" % QString::fromStdString(module)].insert(
+      taskContext.taskID());
+}
+
+void PackageManager::removeUnusedLayer(const InstallTask &taskContext,
+                                       const package::Reference &ref,
+                                       const std::string &module,
+                                       const std::optional<std::string> &subRef) noexcept
+{
+    // The lock is held while removing, a task starting to use the layer meanwhile either
+    // prevents the removal or finds the layer missing and pulls it again.
+    std::lock_guard<std::mutex> lock(this->layerUsersMutex);
+    auto users = this->layerUsers.value(ref.toString() % "/" % QString::fromStdString(module));
+    users.remove(taskContext.taskID());
+    if (!users.isEmpty()) {
+        qInfo() << "keep" << ref.toString() << "as it is used by" << users.size()
+                << "other tasks";
+        return;
+    }
+
+    auto result = this->repo.remove(ref, module, subRef);
+    if (!result) {
+        qCritical() << "failed to remove" << ref.toString() << result.error().message();
+    }
+}
+
 auto PackageManager::getConfiguration() const noexcept -> QVariantMap
 {
+    if (this->pendingConfiguration) {
+        return utils::serialize::toQVariantMap(*this->pendingConfiguration);
+    }
+
     return utils::serialize::toQVariantMap(this->repo.getConfig());
 }
 
@@ -138,7 +323,8 @@ void PackageManager::setConfiguration(const QVariantMap &parameters) noexcept
     }
 
     const auto &cfgRef = *cfg;
-    const auto &curCfg = repo.getConfig();
+    const auto &curCfg = this->pendingConfiguration ? *this->pendingConfiguration
+                                                    : this->repo.getConfig();
     if (cfgRef.version == curCfg.version && cfgRef.defaultRepo == curCfg.defaultRepo
         && cfgRef.repos == curCfg.repos) {
         return;
@@ -151,6 +337,12 @@ void PackageManager::setConfiguration(const QVariantMap &parameters) noexcept
         return;
     }
 
+    // the configuration is read by the running tasks and searches, it's changed after them
+    if (this->busy()) {
+        this->pendingConfiguration = std::move(cfg).value();
+        return;
+    }
+
     auto result = this->repo.setConfig(*cfg);
     if (!result) {
         sendErrorReply(QDBusError::Failed, result.error().message());
@@ -231,16 +423,30 @@ QVariantMap PackageManager::installFromLayer(const QDBusUnixFileDescriptor &fd)
        &taskRef,
        packageRef = std::move(packageRefRet).value(),
        layerFile = *layerFileRet,
+       info = packageInfo,
        module = packageInfo.packageInfoV2Module]() {
-          auto removeTask = utils::finally::finally([&taskRef, this] {
-              auto elem = std::find(this->taskList.begin(), this->taskList.end(), taskRef);
-              if (elem == this->taskList.end()) {
-                  qCritical() << "the status of package manager is invalid";
+          taskRef.updateStatus(InstallTask::preInstall, "prepare for installing layer");
+
+          // the erofs image is kept and mounted as is, nothing is decompressed or checked out.
+          // It's mounted by erofsfuse with allow_other, which needs user_allow_other in
+          // /etc/fuse.conf
+          if (!::qgetenv("LINGLONG_LAYER_IMAGE_INSTALL").isEmpty()) {
+              pullDependency(taskRef, { info }, module);
+              if (taskRef.currentStatus() == InstallTask::Failed
+                  || taskRef.currentStatus() == InstallTask::Canceled) {
+                  return;
+              }
+
+              auto result = this->repo.importLayerFile(*layerFile);
+              if (!result) {
+                  taskRef.reportError(std::move(result).error());
                   return;
               }
-              this->taskList.erase(elem);
-          });
-          taskRef.updateStatus(InstallTask::preInstall, "prepare for installing layer");
+
+              this->repo.exportReference(packageRef);
+              taskRef.updateStatus(InstallTask::Success, "install layer successfully");
+              return;
+          }
 
           package::LayerPackager layerPackager;
           auto layerDir = layerPackager.unpack(*layerFile);
@@ -251,7 +457,7 @@ QVariantMap PackageManager::installFromLayer(const QDBusUnixFileDescriptor &fd)
 
           auto unmountLayer = utils::finally::finally([mountPoint = layerDir->absolutePath()] {
               if (QFileInfo::exists(mountPoint)) {
-                  auto ret = utils::command::Exec("umount", { mountPoint });
+                  auto ret = package::umountErofs(mountPoint);
                   if (!ret) {
                       qCritical() << "failed to umount " << mountPoint
                                   << ", please umount it manually";
@@ -265,7 +471,7 @@ QVariantMap PackageManager::installFromLayer(const QDBusUnixFileDescriptor &fd)
               return;
           }
 
-          pullDependency(taskRef, *info, module);
+          pullDependency(taskRef, { *info }, module);
           if (taskRef.currentStatus() == InstallTask::Failed
               || taskRef.currentStatus() == InstallTask::Canceled) {
               return;
@@ -446,6 +652,7 @@ QVariantMap PackageManager::installFromUAB(const QDBusUnixFileDescriptor &fd) no
                   subRef = std::nullopt;
               }
 
+              this->useLayer(taskRef, ref, info.packageInfoV2Module);
               auto ret = this->repo.importLayerDir(layerDir, subRef);
               if (!ret) {
                   if (ret.error().code() == 0
@@ -457,11 +664,11 @@ QVariantMap PackageManager::installFromUAB(const QDBusUnixFileDescriptor &fd) no
               }
 
               transaction.addRollBack(
-                [this, layerInfo = std::move(info), layerRef = ref, subRef]() noexcept {
-                    auto ret = this->repo.remove(layerRef, layerInfo.packageInfoV2Module, subRef);
-                    if (!ret) {
-                        qCritical() << "rollback importLayerDir failed:" << ret.error().message();
-                    }
+                [this, &taskRef, layerInfo = std::move(info), layerRef = ref, subRef]() noexcept {
+                    this->removeUnusedLayer(taskRef,
+                                            layerRef,
+                                            layerInfo.packageInfoV2Module,
+                                            subRef);
                 });
           }
 
@@ -562,6 +769,7 @@ void PackageManager::InstallRef(InstallTask &taskContext,
 {
     LINGLONG_TRACE("install " + ref.toString());
 
+    auto start = std::chrono::steady_clock::now();
     taskContext.updateStatus(InstallTask::preInstall, "prepare installing " + ref.toString());
 
     auto currentArch = package::Architecture::currentCPUArchitecture();
@@ -573,19 +781,20 @@ void PackageManager::InstallRef(InstallTask &taskContext,
         return;
     }
 
+    // the layer and its dependencies are flushed to the cache journal together, the batch is
+    // declared before the transaction so the layers removed by its rollback are in it as well
+    auto cacheBatch = this->repo.batchCacheUpdates();
     utils::Transaction t;
 
+    // a runtime or base could be installed while the other tasks depend on it
+    this->useLayer(taskContext, ref, module);
     this->repo.pull(taskContext, ref, module);
     if (taskContext.currentStatus() == InstallTask::Failed
         || taskContext.currentStatus() == InstallTask::Canceled) {
         return;
     }
-    t.addRollBack([this, &ref, &module]() noexcept {
-        auto result = this->repo.remove(ref, module);
-        if (!result) {
-            qCritical() << result.error();
-            Q_ASSERT(false);
-        }
+    t.addRollBack([this, &taskContext, &ref, &module]() noexcept {
+        this->removeUnusedLayer(taskContext, ref, module);
     });
 
     auto layerDir = this->repo.getLayerDir(ref);
@@ -602,7 +811,7 @@ void PackageManager::InstallRef(InstallTask &taskContext,
 
     // for 'kind: app', check runtime and foundation
     if (info->kind == "app") {
-        pullDependency(taskContext, *info, module);
+        pullDependency(taskContext, { *info }, module);
     }
 
     // check the status of pull runtime and foundation
@@ -613,6 +822,17 @@ void PackageManager::InstallRef(InstallTask &taskContext,
 
     this->repo.exportReference(ref);
 
+    auto synced = cacheBatch.end();
+    if (!synced) {
+        taskContext.updateStatus(InstallTask::Failed, LINGLONG_ERRV(synced).message());
+        return;
+    }
+
+    qInfo() << "install" << ref.toString() << "with its dependencies took"
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - start)
+                 .count()
+            << "ms";
     taskContext.updateStatus(InstallTask::Success, "Install " + ref.toString() + " success");
     t.commit();
 }
@@ -640,13 +860,18 @@ auto PackageManager::Uninstall(const QVariantMap &parameters) noexcept -> QVaria
     }
 
     auto module = paras->package.packageManager1PackageModule.value_or("binary");
-    this->repo.unexportReference(*ref);
-    auto result = this->repo.remove(*ref, module);
-    if (!result) {
-        return toDBusReply(result);
+    auto reply = this->tryUninstall(*ref, module);
+    if (reply) {
+        return *reply;
     }
 
-    return toDBusReply(0, "Uninstall " + ref->toString() + " success.");
+    // the running tasks are pulling or depending on the package, it's removed after them
+    if (!calledFromDBus()) {
+        return toDBusReply(-1, ref->toString() + " is being operated");
+    }
+    setDelayedReply(true);
+    this->pendingUninstalls.push_back({ *ref, module, connection(), message() });
+    return {};
 }
 
 auto PackageManager::Update(const QVariantMap &parameters) noexcept -> QVariantMap
@@ -751,6 +976,223 @@ void PackageManager::Update(InstallTask &taskContext,
     }
 }
 
+auto PackageManager::UpdateAll(const QVariantMap &parameters) noexcept -> QVariantMap
+{
+    auto paras =
+      utils::serialize::fromQVariantMap<api::types::v1::PackageManager1UpdateParameters>(
+        parameters);
+    if (!paras) {
+        return toDBusReply(paras);
+    }
+
+    // all installed apps are upgraded if no package is specified
+    std::string curModule = "binary";
+    std::vector<package::FuzzyReference> installedFuzzyRefs;
+    if (paras->packages.empty()) {
+        auto pkgInfos = this->repo.listLocal();
+        if (!pkgInfos) {
+            return toDBusReply(pkgInfos);
+        }
+
+        for (const auto &info : *pkgInfos) {
+            if (info.kind != "app" || info.packageInfoV2Module != curModule) {
+                continue;
+            }
+
+            auto fuzzyRef = package::FuzzyReference::create(QString::fromStdString(info.channel),
+                                                            QString::fromStdString(info.id),
+                                                            std::nullopt,
+                                                            std::nullopt);
+            if (!fuzzyRef) {
+                return toDBusReply(fuzzyRef);
+            }
+
+            auto found = std::find_if(installedFuzzyRefs.cbegin(),
+                                      installedFuzzyRefs.cend(),
+                                      [&fuzzyRef](const package::FuzzyReference &other) {
+                                          return other.id == fuzzyRef->id
+                                            && other.channel == fuzzyRef->channel;
+                                      });
+            if (found == installedFuzzyRefs.cend()) {
+                installedFuzzyRefs.emplace_back(*fuzzyRef);
+            }
+        }
+    } else {
+        curModule = paras->packages.front().packageManager1PackageModule.value_or("binary");
+        for (const auto &package : paras->packages) {
+            if (package.packageManager1PackageModule.value_or("binary") != curModule) {
+                return toDBusReply(-1, "packages to update should be of the same module");
+            }
+
+            auto fuzzyRef = fuzzyReferenceFromPackage(package);
+            if (!fuzzyRef) {
+                return toDBusReply(fuzzyRef);
+            }
+            installedFuzzyRefs.emplace_back(*fuzzyRef);
+        }
+    }
+
+    std::vector<package::Reference> installedRefs;
+    std::vector<package::FuzzyReference> remoteFuzzyRefs;
+    for (const auto &fuzzyRef : installedFuzzyRefs) {
+        auto ref = this->repo.clearReference(fuzzyRef,
+                                             {
+                                               .fallbackToRemote = false // NOLINT
+                                             });
+        if (!ref) {
+            return toDBusReply(-1, fuzzyRef.toString() + " not installed.");
+        }
+
+        auto operating =
+          std::any_of(this->taskList.cbegin(), this->taskList.cend(), [&ref](const auto &task) {
+              return task.packageIDs().contains(ref->id);
+          });
+        if (operating) {
+            qInfo() << "skip" << ref->toString() << "as it is being operated";
+            continue;
+        }
+
+        // the latest version of the installed channel
+        auto remoteFuzzyRef =
+          package::FuzzyReference::create(ref->channel, ref->id, std::nullopt, ref->arch);
+        if (!remoteFuzzyRef) {
+            return toDBusReply(remoteFuzzyRef);
+        }
+        installedRefs.emplace_back(*ref);
+        remoteFuzzyRefs.emplace_back(*remoteFuzzyRef);
+    }
+
+    // one round of concurrent queries for all packages instead of one query per package
+    auto latestRefs = this->repo.clearRemoteReferences(remoteFuzzyRefs);
+    std::vector<package::Reference> refs;
+    std::vector<package::Reference> newRefs;
+    for (std::size_t i = 0; i < installedRefs.size(); ++i) {
+        if (!latestRefs[i]) {
+            qWarning() << "failed to find the latest version of" << installedRefs[i].toString()
+                       << latestRefs[i].error();
+            continue;
+        }
+
+        if (latestRefs[i]->version <= installedRefs[i].version) {
+            continue;
+        }
+
+        qInfo() << "Before upgrade, old Ref: " << installedRefs[i].toString()
+                << " new Ref: " << latestRefs[i]->toString();
+        refs.emplace_back(installedRefs[i]);
+        newRefs.emplace_back(*latestRefs[i]);
+    }
+
+    if (newRefs.empty()) {
+        return toDBusReply(0, "all packages are up to date");
+    }
+
+    auto &taskRef = this->taskList.emplace_back(InstallTask{ newRefs, curModule });
+    connect(&taskRef, &InstallTask::TaskChanged, this, &PackageManager::TaskChanged);
+    taskRef.setJob([this, &taskRef, refs, newRefs, curModule]() {
+        this->UpdateAll(taskRef, refs, newRefs, curModule);
+    });
+    Q_EMIT TaskListChanged(taskRef.taskID());
+
+    return utils::serialize::toQVariantMap(api::types::v1::PackageManager1ResultWithTaskID{
+      .taskID = taskRef.taskID().toStdString(),
+      .code = 0,
+      .message = QString("%1 packages are updating").arg(newRefs.size()).toStdString(),
+    });
+}
+
+void PackageManager::UpdateAll(InstallTask &taskContext,
+                               const std::vector<package::Reference> &refs,
+                               const std::vector<package::Reference> &newRefs,
+                               const std::string &module) noexcept
+{
+    LINGLONG_TRACE(QString("update %1 packages").arg(refs.size()));
+
+    auto start = std::chrono::steady_clock::now();
+    taskContext.updateStatus(InstallTask::preInstall,
+                             QString("prepare upgrading %1 packages").arg(refs.size()));
+
+    // pullMany skips the layers which are already there, they mustn't be removed on failure. The
+    // new versions are used by this task before they are checked, like InstallRef does.
+    std::vector<bool> existed;
+    existed.reserve(newRefs.size());
+    for (const auto &newRef : newRefs) {
+        this->useLayer(taskContext, newRef, module);
+        existed.emplace_back(this->repo.getLayerDir(newRef, module).has_value());
+    }
+
+    // see InstallRef
+    auto cacheBatch = this->repo.batchCacheUpdates();
+    utils::Transaction t;
+
+    // the new versions are pulled together, the objects shared by them are downloaded once
+    taskContext.updateStatus(InstallTask::installApplication,
+                             QString("Installing %1 packages").arg(newRefs.size()));
+    this->repo.pullMany(taskContext, newRefs, module);
+    if (taskContext.currentStatus() == InstallTask::Failed
+        || taskContext.currentStatus() == InstallTask::Canceled) {
+        return;
+    }
+
+    std::vector<api::types::v1::PackageInfoV2> infos;
+    for (std::size_t i = 0; i < newRefs.size(); ++i) {
+        if (!existed[i]) {
+            t.addRollBack([this, &taskContext, ref = newRefs[i], module]() noexcept {
+                this->removeUnusedLayer(taskContext, ref, module);
+            });
+        }
+
+        auto layerDir = this->repo.getLayerDir(newRefs[i], module);
+        if (!layerDir) {
+            taskContext.updateStatus(InstallTask::Failed, LINGLONG_ERRV(layerDir).message());
+            return;
+        }
+
+        auto info = layerDir->info();
+        if (!info) {
+            taskContext.updateStatus(InstallTask::Failed, LINGLONG_ERRV(info).message());
+            return;
+        }
+        infos.emplace_back(std::move(info).value());
+    }
+
+    pullDependency(taskContext, infos, module);
+    if (taskContext.currentStatus() == InstallTask::Failed
+        || taskContext.currentStatus() == InstallTask::Canceled) {
+        return;
+    }
+
+    for (std::size_t i = 0; i < refs.size(); ++i) {
+        t.addRollBack([this, ref = refs[i], newRef = newRefs[i]]() noexcept {
+            this->repo.unexportReference(newRef);
+            this->repo.exportReference(ref);
+        });
+        this->repo.unexportReference(refs[i]);
+        this->repo.exportReference(newRefs[i]);
+    }
+
+    auto synced = cacheBatch.end();
+    if (!synced) {
+        taskContext.updateStatus(InstallTask::Failed, LINGLONG_ERRV(synced).message());
+        return;
+    }
+
+    qInfo() << "upgrade" << refs.size() << "packages took"
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - start)
+                 .count()
+            << "ms";
+    taskContext.updateStatus(InstallTask::Success,
+                             QString("Upgrade %1 packages success").arg(refs.size()));
+    t.commit();
+
+    // try to remove old versions, the ones used by the other tasks are kept
+    auto removalBatch = this->repo.batchCacheUpdates();
+    for (const auto &ref : refs) {
+        this->removeUnusedLayer(taskContext, ref, module);
+    }
+}
+
 auto PackageManager::Search(const QVariantMap &parameters) noexcept -> QVariantMap
 {
     auto paras = utils::serialize::fromQVariantMap<api::types::v1::PackageManager1SearchParameters>(
@@ -764,21 +1206,44 @@ auto PackageManager::Search(const QVariantMap &parameters) noexcept -> QVariantM
         return toDBusReply(fuzzyRef);
     }
     auto jobID = QUuid::createUuid().toString();
-    auto ref = *fuzzyRef;
-    m_search_queue.runTask([this, jobID, ref]() {
-        auto pkgInfos = this->repo.listRemote(ref);
-        if (!pkgInfos.has_value()) {
-            qWarning() << "list remote failed: " << pkgInfos.error().message();
-            Q_EMIT this->SearchFinished(jobID, toDBusReply(pkgInfos));
-            return;
-        }
-        auto result = api::types::v1::PackageManager1SearchResult{
-            .packages = *pkgInfos,
-            .code = 0,
-            .message = "",
-        };
-        Q_EMIT this->SearchFinished(jobID, utils::serialize::toQVariantMap(result));
-    });
+    auto key = fuzzyRef->toString();
+    // the same query in flight serves all of its jobs
+    auto searching = this->searchingJobs.find(key);
+    if (searching != this->searchingJobs.end()) {
+        searching->append(jobID);
+    } else {
+        this->searchingJobs.insert(key, { jobID });
+        this->searchPool.start([this, key, ref = *fuzzyRef]() {
+            QVariantMap result;
+            auto pkgInfos = this->repo.listRemote(ref);
+            if (!pkgInfos.has_value()) {
+                qWarning() << "list remote failed: " << pkgInfos.error().message();
+                result = toDBusReply(pkgInfos);
+            } else {
+                auto searchResult = api::types::v1::PackageManager1SearchResult{
+                    .packages = *pkgInfos,
+                    .code = 0,
+                    .message = "",
+                };
+                result = utils::serialize::toQVariantMap(searchResult);
+            }
+
+            QMetaObject::invokeMethod(
+              this,
+              [this, key, result]() {
+                  for (const auto &jobID : this->searchingJobs.take(key)) {
+                      Q_EMIT this->SearchFinished(jobID, result);
+                  }
+
+                  // the configuration or the migration may be waiting for the searches
+                  if (this->searchingJobs.isEmpty()) {
+                      this->scheduleTasks();
+                  }
+              },
+              Qt::QueuedConnection);
+        });
+    }
+
     auto result = utils::serialize::toQVariantMap(api::types::v1::PackageManager1JobInfo{
       .id = jobID.toStdString(),
       .code = 0,
@@ -799,6 +1264,20 @@ QVariantMap PackageManager::Migrate() noexcept
         return toDBusReply(ret);
     }
 
+    // the migration waits for the running tasks and searches
+    this->pendingMigration = migrate;
+    this->scheduleTasks();
+
+    return utils::serialize::toQVariantMap(api::types::v1::CommonResult{
+      .code = 0,
+      .message = "package manager is migrating data",
+    });
+}
+
+void PackageManager::startMigration(Migrate *migrate) noexcept
+{
+    // the tasks queued meanwhile wait until the migration is done
+    this->migrating = true;
     QMetaObject::invokeMethod(
       QCoreApplication::instance(),
       [this, migrate]() {
@@ -810,13 +1289,10 @@ QVariantMap PackageManager::Migrate() noexcept
           }
 
           migrate->deleteLater();
+          this->migrating = false;
+          Q_EMIT this->TaskListChanged("");
       },
       Qt::QueuedConnection);
-
-    return utils::serialize::toQVariantMap(api::types::v1::CommonResult{
-      .code = 0,
-      .message = "package manager is migrating data",
-    });
 }
 
 void PackageManager::CancelTask(const QString &taskID) noexcept
@@ -835,92 +1311,150 @@ void PackageManager::CancelTask(const QString &taskID) noexcept
 }
 
 void PackageManager::pullDependency(InstallTask &taskContext,
-                                    const api::types::v1::PackageInfoV2 &info,
+                                    const std::vector<api::types::v1::PackageInfoV2> &infos,
                                     const std::string &module) noexcept
 {
-    if (info.kind != "app") {
-        return;
-    }
-
     LINGLONG_TRACE("pull dependency runtime and base");
 
-    utils::Transaction transaction;
+    // resolve all dependencies before pulling any of them, apps sharing a runtime or base need
+    // it only once
+    std::vector<std::pair<std::string, InstallTask::Status>> dependencies;
+    auto addDependency = [&dependencies](const std::string &dependency,
+                                         InstallTask::Status status) {
+        auto found = std::find_if(dependencies.cbegin(),
+                                  dependencies.cend(),
+                                  [&dependency](const auto &item) {
+                                      return item.first == dependency;
+                                  });
+        if (found == dependencies.cend()) {
+            dependencies.emplace_back(dependency, status);
+        }
+    };
+    for (const auto &info : infos) {
+        if (info.kind != "app") {
+            continue;
+        }
 
-    if (info.runtime) {
-        auto fuzzyRuntime = package::FuzzyReference::parse(QString::fromStdString(*info.runtime));
-        if (!fuzzyRuntime) {
-            taskContext.updateStatus(InstallTask::Failed, LINGLONG_ERRV(fuzzyRuntime).message());
-            return;
+        if (info.runtime) {
+            addDependency(*info.runtime, InstallTask::installRuntime);
         }
+        addDependency(info.base, InstallTask::installBase);
+    }
 
-        auto runtime = this->repo.clearReference(*fuzzyRuntime,
-                                                 {
-                                                   .forceRemote = false,
-                                                   .fallbackToRemote = true,
-                                                 });
-        if (!runtime) {
-            taskContext.updateStatus(InstallTask::Failed, runtime.error().message());
+    std::vector<package::Reference> missing;
+    for (const auto &[dependency, status] : dependencies) {
+        auto fuzzyRef = package::FuzzyReference::parse(QString::fromStdString(dependency));
+        if (!fuzzyRef) {
+            taskContext.updateStatus(InstallTask::Failed, LINGLONG_ERRV(fuzzyRef).message());
             return;
         }
 
-        taskContext.updateStatus(InstallTask::installRuntime,
-                                 "Installing runtime " + runtime->toString());
-
-        // 如果runtime已存在，则直接使用, 否则从远程拉取
-        auto runtimeLayerDir = repo.getLayerDir(*runtime, module);
-        if (!runtimeLayerDir) {
-            if (taskContext.currentStatus() == InstallTask::Canceled) {
-                return;
-            }
-
-            this->repo.pull(taskContext, *runtime, module);
+        auto ref = this->repo.clearReference(*fuzzyRef,
+                                             {
+                                               .forceRemote = false,
+                                               .fallbackToRemote = true,
+                                             });
+        if (!ref) {
+            taskContext.updateStatus(InstallTask::Failed, LINGLONG_ERRV(ref).message());
+            return;
+        }
 
-            if (taskContext.currentStatus() == InstallTask::Canceled
-                || taskContext.currentStatus() == InstallTask::Failed) {
-                return;
-            }
+        taskContext.updateStatus(status,
+                                 QString{ "Installing %1 %2" }.arg(
+                                   status == InstallTask::installRuntime ? "runtime" : "base",
+                                   ref->toString()));
 
-            transaction.addRollBack([this, runtimeRef = *runtime, module]() noexcept {
-                auto result = this->repo.remove(runtimeRef, module);
-                if (!result) {
-                    qCritical() << result.error();
-                    Q_ASSERT(false);
-                }
-            });
+        // registered before checking, so that the rollback of another task won't remove it
+        this->useLayer(taskContext, *ref, module);
+        // 如果依赖已存在，则直接使用, 否则从远程拉取
+        if (!this->repo.getLayerDir(*ref, module)) {
+            missing.emplace_back(std::move(ref).value());
         }
     }
 
-    auto fuzzyBase = package::FuzzyReference::parse(QString::fromStdString(info.base));
-    if (!fuzzyBase) {
-        taskContext.updateStatus(InstallTask::Failed, LINGLONG_ERRV(fuzzyBase).message());
+    if (missing.empty() || taskContext.currentStatus() == InstallTask::Canceled) {
         return;
     }
 
-    auto base = this->repo.clearReference(*fuzzyBase,
-                                          {
-                                            .forceRemote = false,
-                                            .fallbackToRemote = true,
-                                          });
-    if (!base) {
-        taskContext.updateStatus(InstallTask::Failed, LINGLONG_ERRV(base).message());
-        return;
+    // Missing layers are pulled at the same time, each by a temporary task. Their progress is
+    // merged into the progress of this task, and canceling this task cancels all of them.
+    std::vector<InstallTask> pullTasks;
+    pullTasks.reserve(missing.size());
+    std::vector<double> progress(missing.size(), 0);
+    std::mutex progressMutex;
+    std::vector<gulong> cancelHandlers;
+    auto disconnectCancel = utils::finally::finally([&taskContext, &cancelHandlers]() {
+        for (auto handler : cancelHandlers) {
+            g_cancellable_disconnect(taskContext.cancellable(), handler);
+        }
+    });
+    for (std::size_t i = 0; i < missing.size(); ++i) {
+        auto &pullTask = pullTasks.emplace_back(InstallTask::createTemporaryTask());
+        pullTask.forwardProgress(
+          [&taskContext, &progress, &progressMutex, i](double current,
+                                                      double total,
+                                                      const QString &message) {
+              std::lock_guard<std::mutex> lock(progressMutex);
+              progress[i] = current / total;
+              auto sum = std::accumulate(progress.cbegin(), progress.cend(), 0.0);
+              taskContext.updateTask(sum, static_cast<double>(progress.size()), message);
+          });
+        cancelHandlers.emplace_back(
+          g_cancellable_connect(taskContext.cancellable(),
+                                G_CALLBACK(+[](GCancellable *, gpointer data) {
+                                    g_cancellable_cancel(static_cast<GCancellable *>(data));
+                                }),
+                                g_object_ref(pullTask.cancellable()),
+                                g_object_unref));
     }
 
-    taskContext.updateStatus(InstallTask::installBase, "Installing base " + base->toString());
+    std::vector<std::future<void>> pulls;
+    pulls.reserve(missing.size());
+    for (std::size_t i = 0; i < missing.size(); ++i) {
+        auto pull = [this, &pullTask = pullTasks[i], &ref = missing[i], &module]() {
+            this->repo.pull(pullTask, ref, module);
+        };
 
-    // 如果base已存在，则直接使用, 否则从远程拉取
-    auto baseLayerDir = repo.getLayerDir(*base, module);
-    if (!baseLayerDir) {
-        if (taskContext.currentStatus() == InstallTask::Canceled) {
-            return;
+        try {
+            pulls.emplace_back(std::async(std::launch::async, pull));
+        } catch (const std::system_error &e) {
+            qWarning() << "failed to start pulling" << missing[i].toString() << e.what();
+            pull();
         }
+    }
+    for (auto &pull : pulls) {
+        pull.wait();
+    }
 
-        this->repo.pull(taskContext, *base, module);
+    // pulled layers are kept only if all of them have been pulled
+    utils::Transaction transaction;
+    std::optional<utils::error::Error> error;
+    for (std::size_t i = 0; i < missing.size(); ++i) {
+        auto status = pullTasks[i].currentStatus();
+        if (status == InstallTask::Failed) {
+            if (!error) {
+                error = std::move(pullTasks[i]).currentError();
+            }
+            continue;
+        }
 
-        if (taskContext.currentStatus() == InstallTask::Canceled
-            || taskContext.currentStatus() == InstallTask::Failed) {
-            return;
+        // Success means the layer has been pulled by another task meanwhile, it isn't ours
+        if (status == InstallTask::Canceled || status == InstallTask::Success) {
+            continue;
         }
+
+        transaction.addRollBack([this, &taskContext, ref = missing[i], module]() noexcept {
+            this->removeUnusedLayer(taskContext, ref, module);
+        });
+    }
+
+    if (taskContext.currentStatus() == InstallTask::Canceled) {
+        return;
+    }
+
+    if (error) {
+        taskContext.reportError(std::move(*error));
+        return;
     }
 
     transaction.commit();
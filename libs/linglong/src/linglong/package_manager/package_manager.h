@@ -11,51 +11,21 @@
 #include "task.h"
 
 #include <QDBusArgument>
+#include <QDBusConnection>
 #include <QDBusContext>
+#include <QDBusMessage>
+#include <QHash>
 #include <QList>
 #include <QObject>
+#include <QSet>
+#include <QThreadPool>
 
-namespace linglong::service {
-
-class JobQueue : public QObject
-{
-    Q_OBJECT
-private:
-    uint runningJobsCount = 0;
-    uint runningJobsMax = 1;
-    std::list<std::function<void()>> taskList = {};
+#include <mutex>
+#include <optional>
 
-    void run()
-    {
-        // 检查任务队列是否为空
-        if (taskList.size() == 0) {
-            runningJobsCount--;
-            return;
-        }
-        // 从队列中取出任务
-        auto func = taskList.front();
-        taskList.pop_front();
-        // 执行任务
-        func();
-
-        // 如果还有任务，继续执行
-        if (taskList.size() > 0) {
-            QMetaObject::invokeMethod(this, &JobQueue::run, Qt::QueuedConnection);
-        } else {
-            runningJobsCount--;
-        }
-    }
+namespace linglong::service {
 
-public:
-    void runTask(std::function<void()> func)
-    {
-        taskList.emplace_back(func);
-        if (runningJobsCount < runningJobsMax) {
-            runningJobsCount++;
-            QMetaObject::invokeMethod(this, &JobQueue::run, Qt::QueuedConnection);
-        }
-    }
-};
+class Migrate;
 
 class PackageManager : public QObject, protected QDBusContext
 {
@@ -75,6 +45,10 @@ public:
                 const package::Reference &ref,
                 const package::Reference &newRef,
                 const std::string &module) noexcept;
+    void UpdateAll(InstallTask &taskContext,
+                   const std::vector<package::Reference> &refs,
+                   const std::vector<package::Reference> &newRefs,
+                   const std::string &module) noexcept;
 
 public
     Q_SLOT : [[nodiscard]] auto getConfiguration() const noexcept -> QVariantMap;
@@ -87,6 +61,7 @@ public
                          const QString &fileType) noexcept -> QVariantMap;
     auto Uninstall(const QVariantMap &parameters) noexcept -> QVariantMap;
     auto Update(const QVariantMap &parameters) noexcept -> QVariantMap;
+    auto UpdateAll(const QVariantMap &parameters) noexcept -> QVariantMap;
     auto Search(const QVariantMap &parameters) noexcept -> QVariantMap;
     auto Migrate() noexcept -> QVariantMap;
     void CancelTask(const QString &taskID) noexcept;
@@ -100,14 +75,56 @@ private:
     QVariantMap installFromLayer(const QDBusUnixFileDescriptor &fd) noexcept;
     QVariantMap installFromUAB(const QDBusUnixFileDescriptor &fd) noexcept;
     void pullDependency(InstallTask &taskContext,
-                        const api::types::v1::PackageInfoV2 &info,
+                        const std::vector<api::types::v1::PackageInfoV2> &infos,
                         const std::string &module) noexcept;
+    void scheduleTasks() noexcept;
+    void finishTask(const QString &taskID) noexcept;
+    [[nodiscard]] bool busy() const noexcept;
+    [[nodiscard]] std::optional<QVariantMap> tryUninstall(const package::Reference &ref,
+                                                          const std::string &module) noexcept;
+    void runPendingUninstalls() noexcept;
+    void startMigration(Migrate *migrate) noexcept;
+    void useLayer(const InstallTask &taskContext,
+                  const package::Reference &ref,
+                  const std::string &module) noexcept;
+    void removeUnusedLayer(const InstallTask &taskContext,
+                           const package::Reference &ref,
+                           const std::string &module,
+                           const std::optional<std::string> &subRef = std::nullopt) noexcept;
     linglong::repo::OSTreeRepo &repo; // NOLINT
     std::list<InstallTask> taskList;
     // 正在运行的任务ID
-    QString runningTaskID;
+    QSet<QString> runningTaskIDs;
+    // no task is started while migrating the repository
+    bool migrating{ false };
 
-    JobQueue m_search_queue = {};
+    // Uninstall calls waiting for the running tasks using their packages, they are replied once the
+    // packages are removed
+    struct PendingUninstall
+    {
+        package::Reference ref;
+        std::string module;
+        QDBusConnection connection;
+        QDBusMessage message;
+    };
+
+    std::list<PendingUninstall> pendingUninstalls;
+    // the configuration and the migration wait until the running tasks and searches are done, no
+    // task is started meanwhile
+    std::optional<api::types::v1::RepoConfig> pendingConfiguration;
+    Migrate *pendingMigration{ nullptr };
+
+    // the running tasks using each layer, a layer is not removed by the rollback of a task while
+    // the other tasks depend on it
+    std::mutex layerUsersMutex;
+    QHash<QString, QSet<QString>> layerUsers;
+
+    // the search jobs waiting for the result of each fuzzy reference being searched
+    QHash<QString, QStringList> searchingJobs;
+    // jobs of tasks and searches run here, they must be destroyed first as the jobs refer to the
+    // members above
+    QThreadPool taskPool;
+    QThreadPool searchPool;
 };
 
 } // namespace linglong::service
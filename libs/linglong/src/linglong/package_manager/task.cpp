@@ -24,6 +24,7 @@ InstallTask::InstallTask(const package::Reference &ref, const QString &module, Q
     : QObject(parent)
     , m_taskID(QUuid::createUuid())
     , m_layer(ref.toString() % "-" % module)
+    , m_packageIDs({ ref.id })
     , m_cancelFlag(g_cancellable_new())
 {
 }
@@ -33,12 +34,28 @@ InstallTask::InstallTask(const package::Reference &ref, const std::string &modul
 {
 }
 
+InstallTask::InstallTask(const std::vector<package::Reference> &refs,
+                         const std::string &module,
+                         QObject *parent)
+    : QObject(parent)
+    , m_taskID(QUuid::createUuid())
+    , m_cancelFlag(g_cancellable_new())
+{
+    QStringList layers;
+    for (const auto &ref : refs) {
+        layers.append(ref.toString() % "-" % QString::fromStdString(module));
+        m_packageIDs.append(ref.id);
+    }
+    m_layer = layers.join(",");
+}
+
 InstallTask::InstallTask(InstallTask &&other) noexcept
     : m_status(other.m_status)
     , m_err(std::move(other).m_err)
     , m_statePercentage(other.m_statePercentage)
     , m_taskID(std::move(other).m_taskID)
     , m_layer(std::move(other).m_layer)
+    , m_packageIDs(std::move(other).m_packageIDs)
     , m_cancelFlag(other.m_cancelFlag)
 {
     other.m_cancelFlag = nullptr;
@@ -62,6 +79,7 @@ InstallTask &InstallTask::operator=(InstallTask &&other) noexcept
     other.m_statePercentage = 0;
 
     this->m_layer = std::move(other).m_layer;
+    this->m_packageIDs = std::move(other).m_packageIDs;
     this->m_err = std::move(other).m_err;
     this->m_taskID = std::move(other).m_taskID;
 
@@ -83,17 +101,35 @@ void InstallTask::updateTask(double currentPercentage,
         return;
     }
 
-    auto increase = (currentPercentage / totalPercentage) * partsMap[m_status];
+    if (m_progressForwarder) {
+        m_progressForwarder(currentPercentage, totalPercentage, message);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto status = m_status;
+    auto increase = (currentPercentage / totalPercentage) * partsMap[status];
+    auto percentage = formatPercentage(increase);
     auto partPercentage = QString("%1/%2(%3%)")
                             .arg(currentPercentage)
                             .arg(totalPercentage)
                             .arg(formatPercentage(currentPercentage / totalPercentage * 100));
-    Q_EMIT PartChanged(taskID(), partPercentage, message, m_status, {});
-    Q_EMIT TaskChanged(taskID(), formatPercentage(increase), message, m_status, {});
+    lock.unlock();
+
+    Q_EMIT PartChanged(taskID(), partPercentage, message, status, {});
+    Q_EMIT TaskChanged(taskID(), percentage, message, status, {});
 }
 
 void InstallTask::updateStatus(Status newStatus, const QString &message) noexcept
 {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // a canceled or failed task is finished, the job still running mustn't bring it back
+    if ((m_status == Canceled || m_status == Failed) && newStatus != m_status) {
+        qInfo() << "ignore status" << newStatus << "of task" << m_taskID << "which is"
+                << m_status;
+        return;
+    }
+
     qInfo() << "update task" << m_taskID << "status to" << newStatus << message;
 
     if (newStatus == Success || newStatus == Failed || newStatus == Canceled) {
@@ -103,16 +139,28 @@ void InstallTask::updateStatus(Status newStatus, const QString &message) noexcep
     }
 
     m_status = newStatus;
-    Q_EMIT TaskChanged(taskID(), formatPercentage(), message, m_status, {});
+    auto percentage = formatPercentage();
+    lock.unlock();
+
+    Q_EMIT TaskChanged(taskID(), percentage, message, newStatus, {});
 }
 
 void InstallTask::reportError(linglong::utils::error::Error &&err) noexcept
 {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_status == Canceled) {
+        qInfo() << "task" << m_taskID << "has been canceled, ignore error" << err.message();
+        return;
+    }
+
     m_statePercentage = 100;
     m_status = Status::Failed;
     m_err = std::move(err);
+    auto percentage = formatPercentage();
+    auto message = m_err.message();
+    lock.unlock();
 
-    Q_EMIT TaskChanged(taskID(), formatPercentage(), m_err.message(), Status::Failed, {});
+    Q_EMIT TaskChanged(taskID(), percentage, message, Status::Failed, {});
 }
 
 QString InstallTask::formatPercentage(double increase) const noexcept
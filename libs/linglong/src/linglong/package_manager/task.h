@@ -12,10 +12,13 @@
 #include <QMap>
 #include <QObject>
 #include <QString>
+#include <QStringList>
 #include <QUuid>
 
 #include <functional>
+#include <mutex>
 #include <optional>
+#include <vector>
 
 namespace linglong::service {
 
@@ -29,6 +32,10 @@ public:
     explicit InstallTask(const package::Reference &ref,
                          const std::string &module,
                          QObject *parent = nullptr);
+    // a task operating on several packages at once
+    explicit InstallTask(const std::vector<package::Reference> &refs,
+                         const std::string &module,
+                         QObject *parent = nullptr);
     InstallTask(InstallTask &&other) noexcept;
     InstallTask &operator=(InstallTask &&other) noexcept;
     ~InstallTask() override;
@@ -61,7 +68,11 @@ public:
     void updateStatus(Status newStatus, const QString &message = "") noexcept;
     void reportError(linglong::utils::error::Error &&err) noexcept;
 
-    [[nodiscard]] Status currentStatus() const noexcept { return m_status; }
+    [[nodiscard]] Status currentStatus() const noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_status;
+    }
 
     [[nodiscard]] utils::error::Error currentError() && noexcept { return std::move(m_err); }
 
@@ -76,10 +87,20 @@ public:
 
     [[nodiscard]] const QString &layer() const noexcept { return m_layer; }
 
+    // tasks operating on the same package must not run at the same time
+    [[nodiscard]] const QStringList &packageIDs() const noexcept { return m_packageIDs; }
+
     auto getJob() { return m_job; }
 
     void setJob(std::function<void()> job) { m_job = job; };
 
+    // The progress of a temporary task, which does a part of the work of another task, is
+    // forwarded to the given function instead of being emitted.
+    void forwardProgress(std::function<void(double, double, const QString &)> forwarder) noexcept
+    {
+        m_progressForwarder = std::move(forwarder);
+    }
+
 Q_SIGNALS:
     void
     TaskChanged(QString taskID, QString percentage, QString message, Status status, QPrivateSignal);
@@ -89,13 +110,18 @@ Q_SIGNALS:
 private:
     InstallTask();
     [[nodiscard]] QString formatPercentage(double increase = 0) const noexcept;
+    // the job of a task runs on a thread of the pool, while the task could be canceled from the
+    // main thread, the status, percentage and error are protected by this mutex
+    mutable std::mutex m_mutex;
     Status m_status{ Queued };
     utils::error::Error m_err;
     double m_statePercentage{ 0 };
     QUuid m_taskID;
     QString m_layer;
+    QStringList m_packageIDs;
     GCancellable *m_cancelFlag{ nullptr };
     std::optional<std::function<void()>> m_job;
+    std::function<void(double, double, const QString &)> m_progressForwarder;
     inline static QMap<Status, double> partsMap{ { Queued, 0 },       { Canceled, 0 },
                                                  { preInstall, 10 },  { installRuntime, 20 },
                                                  { installBase, 20 }, { installApplication, 20 },
@@ -0,0 +1,356 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "binary_repo_cache.h"
+
+#include "linglong/api/types/v1/Generators.hpp"
+#include "linglong/utils/finally/finally.h"
+
+#include <QSaveFile>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <tuple>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace linglong::repo {
+
+namespace {
+
+bool matchQuery(std::string_view value, const std::optional<std::string> &expected) noexcept
+{
+    return !expected || *expected == value;
+}
+
+} // namespace
+
+BinaryRepoCache::~BinaryRepoCache()
+{
+    if (this->data != nullptr) {
+        ::munmap(const_cast<char *>(this->data), this->size);
+    }
+}
+
+utils::error::Result<std::unique_ptr<BinaryRepoCache>>
+BinaryRepoCache::open(const std::filesystem::path &file) noexcept
+{
+    LINGLONG_TRACE(QString("open binary repo cache %1").arg(file.c_str()));
+
+    struct enableMaker : public BinaryRepoCache
+    {
+        using BinaryRepoCache::BinaryRepoCache;
+    };
+
+    auto fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return LINGLONG_ERR(QString("open: %1").arg(::strerror(errno)));
+    }
+    auto closeFd = utils::finally::finally([fd]() {
+        ::close(fd);
+    });
+
+    struct stat st{};
+    if (::fstat(fd, &st) == -1) {
+        return LINGLONG_ERR(QString("fstat: %1").arg(::strerror(errno)));
+    }
+
+    if (static_cast<std::size_t>(st.st_size) < sizeof(BinaryCacheHeader)) {
+        return LINGLONG_ERR("file is too small");
+    }
+
+    auto *addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        return LINGLONG_ERR(QString("mmap: %1").arg(::strerror(errno)));
+    }
+
+    auto cache = std::make_unique<enableMaker>();
+    cache->data = static_cast<const char *>(addr);
+    cache->size = st.st_size;
+
+    // queries jump around the record array, don't waste I/O on readahead
+    ::madvise(addr, cache->size, MADV_RANDOM);
+
+    const auto &header = cache->header();
+    if (header.magic != binaryCacheMagic) {
+        return LINGLONG_ERR("invalid magic number");
+    }
+
+    if (header.formatVersion != binaryCacheFormatVersion) {
+        return LINGLONG_ERR(QString("unsupported format version %1").arg(header.formatVersion));
+    }
+
+    if (header.recordSize != sizeof(BinaryCacheLayerRecord) || header.fileSize != cache->size) {
+        return LINGLONG_ERR("broken header");
+    }
+
+    if (header.stringTableOffset > cache->size
+        || header.stringTableSize > cache->size - header.stringTableOffset) {
+        return LINGLONG_ERR("string table out of range");
+    }
+
+    if (header.recordsOffset % alignof(BinaryCacheLayerRecord) != 0
+        || header.recordsOffset > cache->size
+        || header.recordCount > (cache->size - header.recordsOffset) / header.recordSize) {
+        return LINGLONG_ERR("layer records out of range");
+    }
+
+    return cache;
+}
+
+const BinaryCacheHeader &BinaryRepoCache::header() const noexcept
+{
+    return *reinterpret_cast<const BinaryCacheHeader *>(this->data);
+}
+
+const BinaryCacheLayerRecord *BinaryRepoCache::records() const noexcept
+{
+    return reinterpret_cast<const BinaryCacheLayerRecord *>(this->data
+                                                            + this->header().recordsOffset);
+}
+
+std::string_view BinaryRepoCache::string(const BinaryCacheString &str) const noexcept
+{
+    const auto &header = this->header();
+    if (str.offset > header.stringTableSize || str.size > header.stringTableSize - str.offset) {
+        qWarning() << "string out of range in binary repo cache";
+        Q_ASSERT(false);
+        return {};
+    }
+
+    return { this->data + header.stringTableOffset + str.offset, str.size };
+}
+
+utils::error::Result<api::types::v1::RepositoryCache> BinaryRepoCache::metadata() const noexcept
+{
+    LINGLONG_TRACE("read metadata of binary repo cache");
+
+    const auto &header = this->header();
+    api::types::v1::RepositoryCache cache;
+    cache.llVersion = this->string(header.llVersion);
+    cache.version = this->string(header.version);
+
+    try {
+        auto config = this->string(header.config);
+        cache.config =
+          nlohmann::json::parse(config.begin(), config.end()).get<api::types::v1::RepoConfig>();
+
+        auto stages = this->string(header.migratingStage);
+        if (!stages.empty()) {
+            cache.migratingStage =
+              nlohmann::json::parse(stages.begin(), stages.end()).get<std::vector<int64_t>>();
+        }
+    } catch (const std::exception &e) {
+        return LINGLONG_ERR(e);
+    }
+
+    return cache;
+}
+
+utils::error::Result<api::types::v1::RepositoryCacheLayersItem>
+BinaryRepoCache::decode(const BinaryCacheLayerRecord &record) const noexcept
+{
+    LINGLONG_TRACE("decode layer record");
+
+    api::types::v1::RepositoryCacheLayersItem item;
+    item.commit = this->string(record.commit);
+    item.repo = this->string(record.repo);
+    if ((record.flags & BinaryCacheLayerRecord::IsImage) != 0) {
+        item.image = true;
+    }
+
+    try {
+        auto info = this->string(record.info);
+        item.info =
+          nlohmann::json::from_cbor(info.begin(), info.end()).get<api::types::v1::PackageInfoV2>();
+    } catch (const std::exception &e) {
+        return LINGLONG_ERR(e);
+    }
+
+    return item;
+}
+
+std::vector<api::types::v1::RepositoryCacheLayersItem>
+BinaryRepoCache::query(const repoCacheQuery &query) const noexcept
+{
+    const auto *begin = this->records();
+    const auto *end = begin + this->header().recordCount;
+
+    if (query.id) {
+        std::string_view id = *query.id;
+        begin = std::lower_bound(begin,
+                                 end,
+                                 id,
+                                 [this](const BinaryCacheLayerRecord &record, std::string_view id) {
+                                     return this->string(record.id) < id;
+                                 });
+        end = std::upper_bound(begin,
+                               end,
+                               id,
+                               [this](std::string_view id, const BinaryCacheLayerRecord &record) {
+                                   return id < this->string(record.id);
+                               });
+    }
+
+    std::vector<api::types::v1::RepositoryCacheLayersItem> items;
+    for (const auto *record = begin; record != end; ++record) {
+        if (!matchQuery(this->string(record->repo), query.repo)
+            || !matchQuery(this->string(record->channel), query.channel)
+            || !matchQuery(this->string(record->version), query.version)
+            || !matchQuery(this->string(record->module), query.module)) {
+            continue;
+        }
+
+        if (query.uuid
+            && ((record->flags & BinaryCacheLayerRecord::HasUUID) == 0
+                || this->string(record->uuid) != *query.uuid)) {
+            continue;
+        }
+
+        auto item = this->decode(*record);
+        if (!item) {
+            qWarning() << item.error();
+            continue;
+        }
+
+        items.emplace_back(std::move(item).value());
+    }
+
+    return items;
+}
+
+utils::error::Result<std::vector<api::types::v1::RepositoryCacheLayersItem>>
+BinaryRepoCache::layers() const noexcept
+{
+    LINGLONG_TRACE("decode all layers of binary repo cache");
+
+    const auto *records = this->records();
+    std::vector<api::types::v1::RepositoryCacheLayersItem> items;
+    items.reserve(this->header().recordCount);
+    for (uint64_t i = 0; i < this->header().recordCount; ++i) {
+        auto item = this->decode(records[i]);
+        if (!item) {
+            return LINGLONG_ERR(item);
+        }
+
+        items.emplace_back(std::move(item).value());
+    }
+
+    return items;
+}
+
+utils::error::Result<void>
+writeBinaryRepoCache(const std::filesystem::path &file,
+                     const api::types::v1::RepositoryCache &cache) noexcept
+{
+    LINGLONG_TRACE(QString("write binary repo cache to %1").arg(file.c_str()));
+
+    std::string strings;
+    std::unordered_map<std::string, BinaryCacheString> interned;
+    auto append = [&strings](std::string_view str) {
+        BinaryCacheString ret{ static_cast<uint32_t>(strings.size()),
+                               static_cast<uint32_t>(str.size()) };
+        strings.append(str);
+        return ret;
+    };
+    // ids, channels, arches and repos repeat a lot, store each of them only once
+    auto intern = [&interned, &append](const std::string &str) {
+        auto [it, inserted] = interned.try_emplace(str);
+        if (inserted) {
+            it->second = append(str);
+        }
+        return it->second;
+    };
+
+    std::vector<std::size_t> order(cache.layers.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&cache](std::size_t lhs, std::size_t rhs) {
+        const auto &l = cache.layers[lhs].info;
+        const auto &r = cache.layers[rhs].info;
+        return std::tie(l.id, l.channel, l.version, l.packageInfoV2Module)
+          < std::tie(r.id, r.channel, r.version, r.packageInfoV2Module);
+    });
+
+    BinaryCacheHeader header{};
+    std::vector<BinaryCacheLayerRecord> records;
+    records.reserve(cache.layers.size());
+
+    try {
+        header.llVersion = intern(cache.llVersion);
+        header.version = intern(cache.version);
+        header.config = append(nlohmann::json(cache.config).dump());
+        if (cache.migratingStage) {
+            header.migratingStage = append(nlohmann::json(*cache.migratingStage).dump());
+        }
+
+        for (auto index : order) {
+            const auto &layer = cache.layers[index];
+            BinaryCacheLayerRecord record{};
+            record.id = intern(layer.info.id);
+            record.channel = intern(layer.info.channel);
+            record.version = intern(layer.info.version);
+            record.module = intern(layer.info.packageInfoV2Module);
+            record.arch = intern(layer.info.arch.empty() ? "" : layer.info.arch.front());
+            record.repo = intern(layer.repo);
+            record.commit = append(layer.commit);
+            if (layer.info.uuid) {
+                record.uuid = append(*layer.info.uuid);
+                record.flags |= BinaryCacheLayerRecord::HasUUID;
+            }
+            if (layer.image.value_or(false)) {
+                record.flags |= BinaryCacheLayerRecord::IsImage;
+            }
+
+            auto info = nlohmann::json::to_cbor(nlohmann::json(layer.info));
+            record.info = append({ reinterpret_cast<const char *>(info.data()), info.size() });
+            records.emplace_back(record);
+        }
+    } catch (const std::exception &e) {
+        return LINGLONG_ERR(e);
+    }
+
+    if (strings.size() > std::numeric_limits<uint32_t>::max()) {
+        return LINGLONG_ERR("string table is too large");
+    }
+
+    // keep records aligned, they are accessed in place through the mapping
+    strings.resize((strings.size() + alignof(BinaryCacheLayerRecord) - 1)
+                   / alignof(BinaryCacheLayerRecord) * alignof(BinaryCacheLayerRecord));
+
+    header.magic = binaryCacheMagic;
+    header.formatVersion = binaryCacheFormatVersion;
+    header.recordSize = sizeof(BinaryCacheLayerRecord);
+    header.stringTableOffset = sizeof(BinaryCacheHeader);
+    header.stringTableSize = strings.size();
+    header.recordsOffset = header.stringTableOffset + header.stringTableSize;
+    header.recordCount = records.size();
+    header.fileSize = header.recordsOffset + records.size() * sizeof(BinaryCacheLayerRecord);
+
+    // QSaveFile writes to a temporary file and renames it on commit, so readers never see a
+    // partially written cache
+    QSaveFile out(QString::fromStdString(file.string()));
+    if (!out.open(QIODevice::WriteOnly)) {
+        return LINGLONG_ERR(out.errorString());
+    }
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(strings.data(), static_cast<qint64>(strings.size()));
+    out.write(reinterpret_cast<const char *>(records.data()),
+              static_cast<qint64>(records.size() * sizeof(BinaryCacheLayerRecord)));
+    if (!out.commit()) {
+        return LINGLONG_ERR(out.errorString());
+    }
+
+    return LINGLONG_OK;
+}
+
+} // namespace linglong::repo
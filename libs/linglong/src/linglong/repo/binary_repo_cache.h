@@ -0,0 +1,108 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "linglong/api/types/v1/RepositoryCache.hpp"
+#include "linglong/repo/repo_cache.h"
+#include "linglong/utils/error/error.h"
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+namespace linglong::repo {
+
+// BinaryRepoCache file format, all integers are stored in host byte order:
+//
+// Name              Length (bytes)             Starts at (bytes)
+// header            sizeof(BinaryCacheHeader)  0
+// string table      stringTableSize            stringTableOffset
+// layer records     recordCount * recordSize   recordsOffset
+//
+// Layer records are sorted by (id, channel, version, module), so that a query by id is a binary
+// search which only touches the pages holding the matching records and their strings.
+
+struct BinaryCacheString
+{
+    uint32_t offset; // relative to the string table
+    uint32_t size;
+};
+
+struct BinaryCacheHeader
+{
+    std::array<char, 8> magic;
+    uint32_t formatVersion;
+    uint32_t recordSize;
+    uint64_t fileSize;
+    uint64_t stringTableOffset;
+    uint64_t stringTableSize;
+    uint64_t recordsOffset;
+    uint64_t recordCount;
+    BinaryCacheString llVersion;
+    BinaryCacheString version;
+    BinaryCacheString config;         // RepoConfig in json
+    BinaryCacheString migratingStage; // json array, empty if there is no pending migration
+};
+
+struct BinaryCacheLayerRecord
+{
+    enum Flags : uint32_t { HasUUID = 1, IsImage = 2 };
+
+    BinaryCacheString id;
+    BinaryCacheString channel;
+    BinaryCacheString version;
+    BinaryCacheString module;
+    BinaryCacheString arch;
+    BinaryCacheString repo;
+    BinaryCacheString commit;
+    BinaryCacheString uuid;
+    BinaryCacheString info; // PackageInfoV2 in cbor
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+constexpr std::array<char, 8> binaryCacheMagic{ 'L', 'L', 'C', 'A', 'C', 'H', 'E', '\0' };
+constexpr uint32_t binaryCacheFormatVersion = 1;
+
+// BinaryRepoCache is a read only view of a mmaped binary cache file.
+class BinaryRepoCache
+{
+public:
+    BinaryRepoCache(const BinaryRepoCache &) = delete;
+    BinaryRepoCache &operator=(const BinaryRepoCache &) = delete;
+    BinaryRepoCache(BinaryRepoCache &&other) = delete;
+    BinaryRepoCache &operator=(BinaryRepoCache &&other) = delete;
+    ~BinaryRepoCache();
+
+    static utils::error::Result<std::unique_ptr<BinaryRepoCache>>
+    open(const std::filesystem::path &file) noexcept;
+
+    // all fields of the cache except layers
+    [[nodiscard]] utils::error::Result<api::types::v1::RepositoryCache> metadata() const noexcept;
+    [[nodiscard]] std::vector<api::types::v1::RepositoryCacheLayersItem>
+    query(const repoCacheQuery &query) const noexcept;
+    [[nodiscard]] utils::error::Result<std::vector<api::types::v1::RepositoryCacheLayersItem>>
+    layers() const noexcept;
+
+private:
+    BinaryRepoCache() = default;
+    [[nodiscard]] const BinaryCacheHeader &header() const noexcept;
+    [[nodiscard]] const BinaryCacheLayerRecord *records() const noexcept;
+    [[nodiscard]] std::string_view string(const BinaryCacheString &str) const noexcept;
+    [[nodiscard]] utils::error::Result<api::types::v1::RepositoryCacheLayersItem>
+    decode(const BinaryCacheLayerRecord &record) const noexcept;
+
+    const char *data{ nullptr };
+    std::size_t size{ 0 };
+};
+
+utils::error::Result<void>
+writeBinaryRepoCache(const std::filesystem::path &file,
+                     const api::types::v1::RepositoryCache &cache) noexcept;
+
+} // namespace linglong::repo
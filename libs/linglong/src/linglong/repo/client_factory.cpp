@@ -8,24 +8,139 @@
 
 #include "api/ClientAPI.h"
 
+#include <QDebug>
+
+#include <array>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace linglong::repo {
 
+namespace {
+
+// enough for the concurrent queries of OSTreeRepo, the others are cleaned up once finished
+constexpr std::size_t maxIdleHandles = 8;
+
+} // namespace
+
+class ClientPool
+{
+public:
+    ClientPool()
+    {
+        curl_global_init(CURL_GLOBAL_ALL);
+
+        this->share = curl_share_init();
+        if (this->share == nullptr) {
+            qWarning() << "failed to create curl share handle, caches won't be shared";
+            return;
+        }
+
+        curl_share_setopt(this->share, CURLSHOPT_LOCKFUNC, &ClientPool::lock);
+        curl_share_setopt(this->share, CURLSHOPT_UNLOCKFUNC, &ClientPool::unlock);
+        curl_share_setopt(this->share, CURLSHOPT_USERDATA, this);
+        for (auto data :
+             { CURL_LOCK_DATA_DNS, CURL_LOCK_DATA_SSL_SESSION, CURL_LOCK_DATA_CONNECT }) {
+            auto ret = curl_share_setopt(this->share, CURLSHOPT_SHARE, data);
+            if (ret != CURLSHE_OK) {
+                qWarning() << "failed to share curl data" << data << curl_share_strerror(ret);
+            }
+        }
+    }
+
+    ClientPool(const ClientPool &) = delete;
+    ClientPool(ClientPool &&) = delete;
+    ClientPool &operator=(const ClientPool &) = delete;
+    ClientPool &operator=(ClientPool &&) = delete;
+
+    ~ClientPool()
+    {
+        // handles using the share must be cleaned up before it
+        for (auto *handle : this->idleHandles) {
+            curl_easy_cleanup(handle);
+        }
+
+        if (this->share != nullptr) {
+            curl_share_cleanup(this->share);
+        }
+
+        curl_global_cleanup();
+    }
+
+    [[nodiscard]] CURLSH *getShare() const noexcept { return this->share; }
+
+    CURL *acquire() noexcept
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->handlesMutex);
+            if (!this->idleHandles.empty()) {
+                auto *handle = this->idleHandles.back();
+                this->idleHandles.pop_back();
+                return handle;
+            }
+        }
+
+        return curl_easy_init();
+    }
+
+    void release(CURL *handle) noexcept
+    {
+        if (handle == nullptr) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(this->handlesMutex);
+            if (this->idleHandles.size() < maxIdleHandles) {
+                this->idleHandles.emplace_back(handle);
+                return;
+            }
+        }
+
+        curl_easy_cleanup(handle);
+    }
+
+private:
+    static void lock(CURL * /*handle*/,
+                     curl_lock_data data,
+                     curl_lock_access /*access*/,
+                     void *userptr) noexcept
+    {
+        static_cast<ClientPool *>(userptr)->shareMutexes.at(data).lock();
+    }
+
+    static void unlock(CURL * /*handle*/, curl_lock_data data, void *userptr) noexcept
+    {
+        static_cast<ClientPool *>(userptr)->shareMutexes.at(data).unlock();
+    }
+
+    CURLSH *share{ nullptr };
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> shareMutexes;
+    std::mutex handlesMutex;
+    std::vector<CURL *> idleHandles;
+};
+
 ClientFactory::ClientFactory(const QString &server)
     : m_server(server)
+    , m_pool(std::make_shared<ClientPool>())
 {
 }
 
 ClientFactory::ClientFactory(const std::string &server)
-    : m_server(QString::fromStdString(server))
+    : ClientFactory(QString::fromStdString(server))
 {
 }
 
 std::shared_ptr<apiClient_t> ClientFactory::createClientV2()
 {
     auto client = apiClient_create_with_base_path(m_server.toStdString().c_str(), nullptr, nullptr);
-    return std::shared_ptr<apiClient_t>(client, apiClient_free);
+    client->curlHandle = m_pool->acquire();
+    client->curlShare = m_pool->getShare();
+    return std::shared_ptr<apiClient_t>(client, [pool = m_pool](apiClient_t *client) {
+        pool->release(client->curlHandle);
+        apiClient_free(client);
+    });
 }
 
 void ClientFactory::setServer(QString server)
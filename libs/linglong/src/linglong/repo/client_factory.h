@@ -17,6 +17,12 @@ extern "C" {
 
 namespace linglong::repo {
 
+class ClientPool;
+
+// Clients created by ClientFactory share the DNS, TLS session and connection caches, and reuse
+// the CURL handles of the finished requests, so only the first request to the server pays for
+// the handshakes. createClientV2 could be called from multiple threads, but a client should be
+// used by one thread at a time.
 class ClientFactory : public QObject
 {
     Q_OBJECT
@@ -30,5 +36,7 @@ public:
 
 private:
     QString m_server;
+    // clients may outlive the factory, they keep the pool alive
+    std::shared_ptr<ClientPool> m_pool;
 };
 } // namespace linglong::repo
@@ -10,15 +10,20 @@
 #include "linglong/api/types/helper.h"
 #include "linglong/api/types/v1/Generators.hpp"
 #include "linglong/api/types/v1/PackageInfoV2.hpp"
+#include "linglong/package/erofs.h"
 #include "linglong/package/fuzzy_reference.h"
 #include "linglong/package/layer_dir.h"
 #include "linglong/package/reference.h"
+#include "linglong/package/uab_merkle.h"
 #include "linglong/package_manager/task.h"
 #include "linglong/repo/config.h"
+#include "linglong/repo/remote_search_cache.h"
+#include "linglong/utils/async/await.h"
 #include "linglong/utils/command/env.h"
 #include "linglong/utils/error/error.h"
 #include "linglong/utils/finally/finally.h"
 #include "linglong/utils/packageinfo_handler.h"
+#include "linglong/utils/serialize/json_list_stream.h"
 #include "linglong/utils/transaction.h"
 
 #include <gio/gio.h>
@@ -26,30 +31,37 @@
 #include <nlohmann/json_fwd.hpp>
 #include <ostree-repo.h>
 
+#include <QCoreApplication>
 #include <QDebug>
 #include <QDir>
 #include <QDirIterator>
-#include <QEventLoop>
 #include <QProcess>
 #include <QTemporaryDir>
-#include <QTimer>
+#include <QThread>
+#include <QUuid>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <cstddef>
 #include <cstring>
-#include <future>
 #include <memory>
 #include <string>
 #include <thread>
 #include <utility>
 
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 namespace linglong::repo {
 
 namespace {
 
+// the number of queries sent to the server at the same time by clearRemoteReferences
+constexpr std::size_t remoteQueryJobs = 8;
+
 struct ostreeUserData
 {
     bool scanning{ false };
@@ -270,6 +282,42 @@ ostreeSpecFromReferenceV2(const package::Reference &ref,
     return ret + "_" + subRef.value();
 }
 
+// Desktop files are made executable for KDE while exporting. Files of layers could be hardlinks to
+// the objects of the repository, such a file is replaced by a copy first, or the object would be
+// corrupted.
+bool makeExecutable(const QString &path) noexcept
+{
+    constexpr mode_t executable = 0755;
+    const auto file = path.toLocal8Bit();
+
+    struct stat st
+    {
+    };
+
+    if (::stat(file.constData(), &st) == -1) {
+        return false;
+    }
+
+    if ((st.st_mode & 07777) == executable) {
+        return true;
+    }
+
+    if (st.st_nlink > 1) {
+        const auto copy = path + ".linglong-copy";
+        QFile::remove(copy);
+        if (!QFile::copy(path, copy)) {
+            return false;
+        }
+
+        if (::rename(copy.toLocal8Bit().constData(), file.constData()) == -1) {
+            QFile::remove(copy);
+            return false;
+        }
+    }
+
+    return ::chmod(file.constData(), executable) == 0;
+}
+
 utils::error::Result<QString> commitDirToRepo(GFile *dir,
                                               OstreeRepo *repo,
                                               const char *refspec) noexcept
@@ -428,6 +476,17 @@ utils::error::Result<OstreeRepo *> createOstreeRepo(const QDir &location,
     return static_cast<OstreeRepo *>(g_steal_pointer(&ostreeRepo));
 }
 
+// NOTE: the binary cache is optional for now, it's enabled by LINGLONG_REPO_CACHE_FORMAT=binary.
+// Readers always pick up whichever format the writer left on disk.
+RepoCacheFormat repoCacheFormat() noexcept
+{
+    if (qgetenv("LINGLONG_REPO_CACHE_FORMAT") == "binary") {
+        return RepoCacheFormat::Binary;
+    }
+
+    return RepoCacheFormat::JSON;
+}
+
 utils::error::Result<package::Reference> clearReferenceLocal(const linglong::repo::RepoCache &cache,
                                                              package::FuzzyReference fuzzy) noexcept
 {
@@ -453,27 +512,26 @@ utils::error::Result<package::Reference> clearReferenceLocal(const linglong::rep
         return LINGLONG_ERR("package not found:" % fuzzy.toString());
     }
 
+    // Layers are sorted by their pre-parsed versions, the newest first. Versions are canonical
+    // numbers without leading zeros, so they are matched as strings here rather than parsed.
+    std::string version;
+    if (fuzzy.version) {
+        version = fuzzy.version->toString().toStdString();
+    }
     utils::error::Result<linglong::api::types::v1::RepositoryCacheLayersItem> foundRef =
       LINGLONG_ERR("compatible layer not found");
     for (const auto &ref : availablePackage) {
-        auto ver = QString::fromStdString(ref.info.version);
-        auto pkgVer = linglong::package::Version::parse(ver);
-        if (!pkgVer) {
-            qFatal("internal error: broken data of repo cache: %s", ver.toStdString().c_str());
-        }
-
-        qDebug() << "available layer found:" << ver;
+        qDebug() << "available layer found:" << ref.info.version.c_str();
         if (fuzzy.version) {
-            if (!fuzzy.version->tweak) {
-                pkgVer->tweak = std::nullopt;
-            }
-
-            if (*pkgVer == fuzzy.version.value()) {
-                foundRef = ref;
-                break;
+            // a fuzzy version without tweak matches all tweaks of it
+            const auto &layerVersion = ref.info.version;
+            auto matched = layerVersion == version
+              || (!fuzzy.version->tweak && layerVersion.size() > version.size()
+                  && layerVersion.compare(0, version.size(), version) == 0
+                  && layerVersion[version.size()] == '.');
+            if (!matched) {
+                continue;
             }
-
-            continue;
         }
 
         foundRef = ref;
@@ -492,6 +550,231 @@ utils::error::Result<package::Reference> clearReferenceLocal(const linglong::rep
                                       *arch);
 };
 
+// stores the value of the ETag and Last-Modified headers of a response into the entry
+void readValidators(const char *header, size_t len, void *userdata)
+{
+    auto *entry = static_cast<RemoteSearchCache::Entry *>(userdata);
+    std::string_view line(header, len);
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos) {
+        return;
+    }
+
+    auto name = QByteArray(line.data(), static_cast<int>(colon)).trimmed().toLower();
+    auto value = QByteArray(line.data() + colon + 1, static_cast<int>(line.size() - colon - 1))
+                   .trimmed()
+                   .toStdString();
+    if (name == "etag") {
+        entry->etag = std::move(value);
+    } else if (name == "last-modified") {
+        entry->lastModified = std::move(value);
+    }
+}
+
+// Sends the search request, a stale entry is revalidated with its ETag or Last-Modified and
+// std::nullopt is returned if the server answers 304 Not Modified.
+utils::error::Result<std::optional<RemoteSearchCache::Entry>>
+searchRemote(apiClient_t *client,
+             const std::string &repoName,
+             const package::FuzzyReference &fuzzyRef,
+             const RemoteSearchCache::Entry *stale = nullptr) noexcept
+{
+    LINGLONG_TRACE("search " + fuzzyRef.toString() + " from remote");
+
+    std::string id, repo, channel, version, arch;
+    id = fuzzyRef.id.toStdString();
+    repo = repoName;
+    if (fuzzyRef.channel) {
+        channel = fuzzyRef.channel->toStdString();
+    }
+    if (fuzzyRef.version) {
+        version = fuzzyRef.version->toString().toStdString();
+    }
+    if (fuzzyRef.arch) {
+        arch = fuzzyRef.arch->toString().toStdString();
+    } else {
+        arch = package::Architecture::currentCPUArchitecture()->toString().toStdString();
+    }
+    request_fuzzy_search_req_t req;
+    req.channel = channel.data();
+    req.version = version.data();
+    req.arch = arch.data();
+    req.app_id = id.data();
+    req.repo_name = repo.data();
+
+    // The request is the one of ClientAPI_fuzzySearchApp, but the response is parsed while it is
+    // received rather than buffered and parsed as a whole.
+    auto pkgInfos = std::vector<api::types::v1::PackageInfoV2>{};
+    utils::serialize::JsonListStream stream("data", [&pkgInfos](nlohmann::json &&entry) {
+        auto str = [&entry](const char *key) -> std::string {
+            auto it = entry.find(key);
+            return it != entry.end() && it->is_string() ? it->get<std::string>() : "";
+        };
+        auto size = entry.find("size");
+        pkgInfos.emplace_back(api::types::v1::PackageInfoV2{
+          .arch = { str("arch") },
+          .channel = str("channel"),
+          .description = str("description"),
+          .id = str("appId"),
+          .kind = str("kind"),
+          .packageInfoV2Module = str("module"),
+          .name = str("name"),
+          .runtime = str("runtime"),
+          .size = size != entry.end() && size->is_number() ? size->get<int64_t>() : 0,
+          .version = str("version"),
+        });
+    });
+
+    cJSON *body = request_fuzzy_search_req_convertToJSON(&req);
+    char *bodyStr = body ? cJSON_Print(body) : nullptr;
+    list_t *headerType = list_createList();
+    list_t *contentType = list_createList();
+    list_t *headers = list_createList();
+    auto freeRequest = utils::finally::finally([&]() {
+        client->stream_func = nullptr;
+        client->stream_data = nullptr;
+        client->header_func = nullptr;
+        client->header_data = nullptr;
+        listEntry_t *listEntry = nullptr;
+        list_ForEach(listEntry, headers) {
+            keyValuePair_free(static_cast<keyValuePair_t *>(listEntry->data));
+        }
+        list_freeList(headers);
+        list_freeList(headerType);
+        list_freeList(contentType);
+        cJSON_Delete(body);
+        free(bodyStr);
+    });
+    if (!bodyStr) {
+        return LINGLONG_ERR("failed to encode request");
+    }
+
+    list_addElement(headerType, const_cast<char *>("application/json"));
+    list_addElement(contentType, const_cast<char *>("application/json"));
+    if (stale && !stale->etag.empty()) {
+        list_addElement(headers,
+                        keyValuePair_create(const_cast<char *>("If-None-Match"),
+                                            const_cast<char *>(stale->etag.c_str())));
+    }
+    if (stale && !stale->lastModified.empty()) {
+        list_addElement(headers,
+                        keyValuePair_create(const_cast<char *>("If-Modified-Since"),
+                                            const_cast<char *>(stale->lastModified.c_str())));
+    }
+
+    RemoteSearchCache::Entry entry;
+    client->header_data = &entry;
+    client->header_func = readValidators;
+    client->stream_data = &stream;
+    client->stream_func = [](const char *data, size_t len, void *userdata) -> size_t {
+        auto *stream = static_cast<utils::serialize::JsonListStream *>(userdata);
+        return stream->feed({ data, len }) ? len : 0;
+    };
+    apiClient_invoke(client,
+                     "/api/v0/apps/fuzzysearchapp",
+                     nullptr,
+                     headers,
+                     nullptr,
+                     headerType,
+                     contentType,
+                     bodyStr,
+                     "POST");
+    if (stale && client->response_code == 304) {
+        return std::nullopt;
+    }
+
+    auto envelope = stream.finish();
+    if (!envelope) {
+        return LINGLONG_ERR("cannot send request to remote server", envelope);
+    }
+
+    auto code = envelope->find("code");
+    if (code == envelope->end() || !code->is_number() || code->get<int>() != 200) {
+        auto msg = envelope->find("msg");
+        return LINGLONG_ERR(msg != envelope->end() && msg->is_string()
+                              ? QString::fromStdString(msg->get<std::string>())
+                              : QString("unexpected response from remote server"));
+    }
+
+    entry.packages = std::move(pkgInfos);
+    return entry;
+}
+
+// picks the reference of the latest version matching the fuzzy reference from remote records
+utils::error::Result<package::Reference>
+latestReference(const package::FuzzyReference &fuzzy,
+                const std::vector<api::types::v1::PackageInfoV2> &list) noexcept
+{
+    LINGLONG_TRACE("find the latest reference of " + fuzzy.toString());
+
+    utils::error::Result<package::Reference> reference = LINGLONG_ERR("reference not exists");
+    for (const auto &record : list) {
+        auto recordStr = nlohmann::json(record).dump();
+        if (fuzzy.channel && fuzzy.channel->toStdString() != record.channel) {
+            continue;
+        }
+        if (fuzzy.id.toStdString() != record.id) {
+            continue;
+        }
+        auto version = package::Version::tryParse(std::string_view(record.version));
+        if (!version) {
+            qWarning() << "Ignore invalid package record" << recordStr.c_str()
+                       << package::versionErrorString(version.error());
+            continue;
+        }
+        if (record.arch.empty()) {
+            qWarning() << "Ignore invalid package record";
+            continue;
+        }
+        auto arch = package::Architecture::parse(record.arch[0]);
+        if (!arch) {
+            qWarning() << "Ignore invalid package record" << recordStr.c_str() << arch.error();
+            continue;
+        }
+        auto channel = QString::fromStdString(record.channel);
+        auto currentRef = package::Reference::create(channel, fuzzy.id, *version, *arch);
+        if (!currentRef) {
+            qWarning() << "Ignore invalid package record" << recordStr.c_str()
+                       << currentRef.error();
+            continue;
+        }
+        if (!reference) {
+            reference = *currentRef;
+            continue;
+        }
+
+        if (reference->version >= currentRef->version) {
+            continue;
+        }
+
+        reference = *currentRef;
+    }
+    if (!reference) {
+        return LINGLONG_ERR("filter ref from list");
+    }
+    return reference;
+}
+
+// Pulls running on the main thread share the context with the event loop of Qt. The other threads
+// iterate a context of their own, otherwise they would compete with the main thread for the
+// default one and progress would be reported from the main thread.
+[[nodiscard]] auto pushThreadDefaultContext() noexcept
+{
+    GMainContext *context = nullptr;
+    if (QCoreApplication::instance() == nullptr
+        || QThread::currentThread() != QCoreApplication::instance()->thread()) {
+        context = g_main_context_new();
+        g_main_context_push_thread_default(context);
+    }
+
+    return utils::finally::finally([context]() {
+        if (context != nullptr) {
+            g_main_context_pop_thread_default(context);
+            g_main_context_unref(context);
+        }
+    });
+}
+
 } // namespace
 
 utils::error::Result<void>
@@ -535,8 +818,41 @@ OSTreeRepo::removeOstreeRef(const api::types::v1::RepositoryCacheLayersItem &lay
     return LINGLONG_OK;
 }
 
-utils::error::Result<void> OSTreeRepo::handleRepositoryUpdate(
-  QDir layerDir, const api::types::v1::RepositoryCacheLayersItem &layer) noexcept
+utils::error::Result<void>
+OSTreeRepo::removeLayerImage(const api::types::v1::RepositoryCacheLayersItem &layer) noexcept
+{
+    LINGLONG_TRACE("remove layer image " + QString::fromStdString(layer.commit));
+
+    const auto layerDir =
+      this->repoDir.absoluteFilePath(QString::fromStdString("layers/" + layer.commit));
+    if (package::LayerDir{ layerDir }.valid()) {
+        auto ret = package::umountErofs(layerDir);
+        if (!ret) {
+            return LINGLONG_ERR(ret);
+        }
+    }
+
+    auto ret = this->cache->deleteLayerItem(layer);
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    if (!QFile::remove(this->layerImagePath(layer.commit))) {
+        qWarning() << "failed to remove" << this->layerImagePath(layer.commit);
+    }
+
+    return LINGLONG_OK;
+}
+
+QString OSTreeRepo::layerImagePath(const std::string &commit) const noexcept
+{
+    return this->repoDir.absoluteFilePath(QString::fromStdString("images/" + commit + ".layer"));
+}
+
+utils::error::Result<void>
+OSTreeRepo::handleRepositoryUpdate(OstreeRepo *repo,
+                                   QDir layerDir,
+                                   const api::types::v1::RepositoryCacheLayersItem &layer) noexcept
 {
     std::string refspec = ostreeRefSpecFromLayerItem(layer);
     LINGLONG_TRACE(QString("checkout %1 from ostree repository to layers dir")
@@ -563,7 +879,7 @@ utils::error::Result<void> OSTreeRepo::handleRepositoryUpdate(
     g_autoptr(GError) gErr = nullptr;
     g_autofree char *commit{ nullptr };
 
-    if (ostree_repo_resolve_rev_ext(this->ostreeRepo.get(),
+    if (ostree_repo_resolve_rev_ext(repo,
                                     refspec.c_str(),
                                     FALSE,
                                     OstreeRepoResolveRevExtFlags::OSTREE_REPO_RESOLVE_REV_EXT_NONE,
@@ -573,8 +889,9 @@ utils::error::Result<void> OSTreeRepo::handleRepositoryUpdate(
         return LINGLONG_ERR("ostree_repo_resolve_rev", gErr);
     }
 
-    if (ostree_repo_checkout_at(this->ostreeRepo.get(),
-                                nullptr,
+    auto options = layerCheckoutOptions();
+    if (ostree_repo_checkout_at(repo,
+                                &options,
                                 root,
                                 path.toUtf8().constData(),
                                 commit,
@@ -592,6 +909,35 @@ utils::error::Result<void> OSTreeRepo::handleRepositoryUpdate(
     return LINGLONG_OK;
 }
 
+OstreeRepoCheckoutAtOptions layerCheckoutOptions() noexcept
+{
+    OstreeRepoCheckoutAtOptions options{};
+    // files of a bare-user-only repository are hardlinked only in user mode
+    options.mode = OSTREE_REPO_CHECKOUT_MODE_USER;
+    options.overwrite_mode = OSTREE_REPO_CHECKOUT_OVERWRITE_NONE;
+    // files are copied where they couldn't be linked, e.g. the layers are on another filesystem,
+    // ostree clones the extents then if the filesystem supports reflinks
+    options.no_copy_fallback = FALSE;
+    // a file could only have 65000 links on ext4, empty files are shared by too many layers
+    options.force_copy_zerosized = TRUE;
+    return options;
+}
+
+auto OSTreeRepo::openOstreeRepo() const noexcept
+  -> utils::error::Result<std::unique_ptr<OstreeRepo, OstreeRepoDeleter>>
+{
+    LINGLONG_TRACE("open a new handle of ostree repo");
+
+    g_autoptr(GError) gErr = nullptr;
+    g_autoptr(OstreeRepo) repo = ostree_repo_new(ostree_repo_get_path(this->ostreeRepo.get()));
+    if (ostree_repo_open(repo, nullptr, &gErr) == FALSE) {
+        return LINGLONG_ERR("ostree_repo_open", gErr);
+    }
+
+    return std::unique_ptr<OstreeRepo, OstreeRepoDeleter>(
+      static_cast<OstreeRepo *>(g_steal_pointer(&repo)));
+}
+
 QDir OSTreeRepo::createLayerQDir(const std::string &commit) const noexcept
 {
     QDir dir = this->repoDir.absoluteFilePath(QString::fromStdString("layers/" + commit));
@@ -631,6 +977,9 @@ OSTreeRepo::OSTreeRepo(const QDir &path,
     g_autoptr(OstreeRepo) ostreeRepo = nullptr;
 
     this->repoDir = path;
+    this->remoteCache = std::make_unique<RemoteSearchCache>(
+      this->repoDir.absoluteFilePath("remote_search_cache.json").toStdString(),
+      remoteSearchCacheTTL());
 
     {
         LINGLONG_TRACE("use linglong repo at " + path.absolutePath());
@@ -653,7 +1002,8 @@ OSTreeRepo::OSTreeRepo(const QDir &path,
             auto ret = linglong::repo::RepoCache::create(
               this->repoDir.absoluteFilePath("states.json").toStdString(),
               this->cfg,
-              *(this->ostreeRepo));
+              *(this->ostreeRepo),
+              repoCacheFormat());
             if (!ret) {
                 qCritical() << LINGLONG_ERRV(ret);
                 qFatal("abort");
@@ -684,7 +1034,8 @@ OSTreeRepo::OSTreeRepo(const QDir &path,
     auto ret =
       linglong::repo::RepoCache::create(this->repoDir.absoluteFilePath("states.json").toStdString(),
                                         this->cfg,
-                                        *(this->ostreeRepo));
+                                        *(this->ostreeRepo),
+                                        repoCacheFormat());
     if (!ret) {
         qCritical() << LINGLONG_ERRV(ret);
         qFatal("abort");
@@ -809,7 +1160,12 @@ utils::error::Result<package::LayerDir> OSTreeRepo::importLayerDir(
     // NOTE: we save repo info in cache, if import a local layer dir, set repo to 'local'
     auto refspec =
       ostreeSpecFromReferenceV2(*reference, std::nullopt, info->packageInfoV2Module, subRef);
-    auto commitID = commitDirToRepo(gFile, this->ostreeRepo.get(), refspec.c_str());
+    auto repo = this->openOstreeRepo();
+    if (!repo) {
+        return LINGLONG_ERR(repo);
+    }
+
+    auto commitID = commitDirToRepo(gFile, repo->get(), refspec.c_str());
     if (!commitID) {
         return LINGLONG_ERR(commitID);
     }
@@ -821,7 +1177,7 @@ utils::error::Result<package::LayerDir> OSTreeRepo::importLayerDir(
     item.repo = "local";
 
     auto layerDir = this->createLayerQDir((*commitID).toStdString());
-    auto result = this->handleRepositoryUpdate(layerDir, item);
+    auto result = this->handleRepositoryUpdate(repo->get(), layerDir, item);
     if (!result) {
         return LINGLONG_ERR(result);
     }
@@ -842,6 +1198,143 @@ utils::error::Result<package::LayerDir> OSTreeRepo::importLayerDir(
     return package::LayerDir{ layerDir.absolutePath() };
 }
 
+utils::error::Result<package::LayerDir>
+OSTreeRepo::importLayerFile(package::LayerFile &file) noexcept
+{
+    LINGLONG_TRACE("import layer file " + file.fileName());
+
+    auto metaInfo = file.metaInfo();
+    if (!metaInfo) {
+        return LINGLONG_ERR(metaInfo);
+    }
+
+    auto info = utils::parsePackageInfo(metaInfo->info);
+    if (!info) {
+        return LINGLONG_ERR(info);
+    }
+
+    auto reference = package::Reference::fromPackageInfo(*info);
+    if (!reference) {
+        return LINGLONG_ERR(reference);
+    }
+
+    if (this->getLayerDir(*reference, info->packageInfoV2Module)) {
+        return LINGLONG_ERR(reference->toString() + " exists.", 0);
+    }
+
+    auto offset = file.binaryDataOffset();
+    if (!offset) {
+        return LINGLONG_ERR(offset);
+    }
+
+    QDir imagesDir = this->repoDir.absoluteFilePath("images");
+    if (!imagesDir.mkpath(".")) {
+        return LINGLONG_ERR(QString{ "couldn't create directory %1" }.arg(imagesDir.path()));
+    }
+
+    utils::Transaction transaction;
+
+    // the copy is hashed rather than the source, which could be modified meanwhile
+    auto imagePath =
+      imagesDir.absoluteFilePath(QUuid::createUuid().toString(QUuid::Id128) + ".tmp");
+    if (!QFile::copy(file.fileName(), imagePath)) {
+        return LINGLONG_ERR(QString{ "couldn't copy %1 to %2" }.arg(file.fileName(), imagePath));
+    }
+    transaction.addRollBack([&imagePath]() noexcept {
+        QFile::remove(imagePath);
+    });
+
+    QFile image(imagePath);
+    if (!image.open(QIODevice::ReadOnly)) {
+        return LINGLONG_ERR(image);
+    }
+    auto digest = package::calculateDigest(image.handle(), 0, image.size());
+    image.close();
+    if (!digest) {
+        return LINGLONG_ERR(digest);
+    }
+
+    if (::rename(imagePath.toLocal8Bit().constData(),
+                 this->layerImagePath(*digest).toLocal8Bit().constData())
+        == -1) {
+        return LINGLONG_ERR(QString{ "rename %1: %2" }.arg(imagePath, ::strerror(errno)));
+    }
+    imagePath = this->layerImagePath(*digest);
+
+    auto layerDir = this->createLayerQDir(*digest);
+    // the package manager mounts the image, but every user runs it
+    auto ret = package::mountErofs(imagePath, *offset, 0, layerDir.absolutePath(), true);
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+    transaction.addRollBack([&layerDir]() noexcept {
+        auto ret = package::umountErofs(layerDir.absolutePath());
+        if (!ret) {
+            qCritical() << "failed to umount" << layerDir.absolutePath() << ret.error();
+        }
+    });
+
+    api::types::v1::RepositoryCacheLayersItem item;
+    item.commit = *digest;
+    item.image = true;
+    item.info = std::move(info).value();
+    item.repo = "local";
+    ret = this->cache->addLayerItem(item);
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    transaction.commit();
+    return package::LayerDir{ layerDir.absolutePath() };
+}
+
+void OSTreeRepo::mountLayerImages() noexcept
+{
+    LINGLONG_TRACE("mount layer images");
+
+    for (const auto &item : this->cache->queryLayerItem()) {
+        if (!item.image.value_or(false)) {
+            continue;
+        }
+
+        // erofsfuse is killed along with the service when it's stopped or restarted, the mounts it
+        // leaves behind fail with ENOTCONN until they are unmounted
+        const auto layerPath =
+          this->repoDir.absoluteFilePath(QString::fromStdString("layers/" + item.commit));
+        struct stat st{};
+        if (::stat(layerPath.toLocal8Bit().constData(), &st) == -1 && errno == ENOTCONN) {
+            auto ret = package::umountErofs(layerPath);
+            if (!ret) {
+                qCritical() << LINGLONG_ERRV(ret);
+                continue;
+            }
+        }
+
+        auto layerDir = this->createLayerQDir(item.commit);
+        if (package::LayerDir{ layerDir.absolutePath() }.valid()) {
+            continue;
+        }
+
+        auto file = package::LayerFile::New(this->layerImagePath(item.commit));
+        if (!file) {
+            qCritical() << LINGLONG_ERRV(file);
+            continue;
+        }
+
+        auto offset = (*file)->binaryDataOffset();
+        if (!offset) {
+            qCritical() << LINGLONG_ERRV(offset);
+            continue;
+        }
+
+        auto ret =
+          package::mountErofs((*file)->fileName(), *offset, 0, layerDir.absolutePath(), true);
+        if (!ret) {
+            qCritical() << LINGLONG_ERRV(ret);
+        }
+    }
+}
+
 [[nodiscard]] utils::error::Result<void> OSTreeRepo::push(const package::Reference &reference,
                                                           const std::string &module) const noexcept
 {
@@ -966,11 +1459,16 @@ utils::error::Result<void> OSTreeRepo::remove(const package::Reference &ref,
         return LINGLONG_ERR(layer);
     }
     auto layerDir = this->getLayerDir(*layer);
+    // a layer image which couldn't be mounted could still be removed
+    if (!layerDir && layer->image.value_or(false)) {
+        layerDir = package::LayerDir{ this->createLayerQDir(layer->commit).absolutePath() };
+    }
     if (!layerDir) {
         return LINGLONG_ERR(layerDir);
     }
 
-    auto ret = this->removeOstreeRef(*layer);
+    auto ret = layer->image.value_or(false) ? this->removeLayerImage(*layer)
+                                            : this->removeOstreeRef(*layer);
     if (!ret) {
         return LINGLONG_ERR(ret);
     }
@@ -1004,13 +1502,116 @@ utils::error::Result<void> OSTreeRepo::prune()
     return LINGLONG_OK;
 }
 
+void OSTreeRepo::lockPullRefs(const std::vector<std::string> &refs) noexcept
+{
+    // all refs are taken at once, so tasks pulling overlapping sets of refs couldn't deadlock
+    std::unique_lock<std::mutex> lock(this->pullMutex);
+    this->pullFinished.wait(lock, [this, &refs]() {
+        return std::none_of(refs.begin(), refs.end(), [this](const std::string &ref) {
+            return this->pullingRefs.find(ref) != this->pullingRefs.end();
+        });
+    });
+    this->pullingRefs.insert(refs.begin(), refs.end());
+}
+
+void OSTreeRepo::unlockPullRefs(const std::vector<std::string> &refs) noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(this->pullMutex);
+        for (const auto &ref : refs) {
+            this->pullingRefs.erase(ref);
+        }
+    }
+    this->pullFinished.notify_all();
+}
+
+utils::error::Result<api::types::v1::RepositoryCacheLayersItem>
+OSTreeRepo::importPulledLayer(OstreeRepo *repo,
+                              const std::string &ref,
+                              GCancellable *cancellable) noexcept
+{
+    LINGLONG_TRACE("import pulled layer " + QString::fromStdString(ref));
+
+    g_autofree char *commit = nullptr;
+    g_autoptr(GFile) layerRootDir = nullptr;
+    g_autoptr(GError) gErr = nullptr;
+    if (ostree_repo_read_commit(repo, ref.c_str(), &layerRootDir, &commit, cancellable, &gErr)
+        == 0) {
+        return LINGLONG_ERR("ostree_repo_read_commit", gErr);
+    }
+
+    g_autoptr(GFile) infoFile = g_file_resolve_relative_path(layerRootDir, "info.json");
+    auto info = utils::parsePackageInfo(infoFile);
+    if (!info) {
+        return LINGLONG_ERR(info);
+    }
+
+    api::types::v1::RepositoryCacheLayersItem item;
+    item.commit = commit;
+    item.info = *info;
+    item.repo = this->cfg.defaultRepo;
+
+    auto layerDir = this->createLayerQDir(item.commit);
+    auto result = this->handleRepositoryUpdate(repo, layerDir, item);
+    if (!result) {
+        return LINGLONG_ERR(result);
+    }
+
+    return item;
+}
+
+void OSTreeRepo::rollbackPulledLayer(
+  const api::types::v1::RepositoryCacheLayersItem &item) noexcept
+{
+    QDir layerDir = this->repoDir.absoluteFilePath(QString::fromStdString("layers/" + item.commit));
+    if (!layerDir.removeRecursively()) {
+        qCritical() << "remove layer dir failed: " << layerDir.absolutePath();
+        Q_ASSERT(false);
+    }
+
+    auto result = this->removeOstreeRef(item);
+    if (!result) {
+        qCritical() << result.error();
+        Q_ASSERT(false);
+    }
+}
+
 void OSTreeRepo::pull(service::InstallTask &taskContext,
                       const package::Reference &reference,
                       const std::string &module) noexcept
 {
     auto refString = ostreeSpecFromReferenceV2(reference, std::nullopt, module);
+
+    this->lockPullRefs({ refString });
+    auto releaseRef = utils::finally::finally([this, refString]() {
+        this->unlockPullRefs({ refString });
+    });
+
+    // the layer may have been pulled by another task while we were waiting. Like a pull which
+    // succeeds, the status is left to the caller, which sends Success once the whole task is done.
+    if (this->getLayerDir(reference, module)) {
+        qInfo() << refString.c_str() << "has been pulled by another task";
+        return;
+    }
+
+    this->pullLocked(taskContext, reference, module);
+}
+
+void OSTreeRepo::pullLocked(service::InstallTask &taskContext,
+                            const package::Reference &reference,
+                            const std::string &module) noexcept
+{
+    auto refString = ostreeSpecFromReferenceV2(reference, std::nullopt, module);
     LINGLONG_TRACE("pull " + QString::fromStdString(refString));
 
+    auto repo = this->openOstreeRepo();
+    if (!repo) {
+        taskContext.reportError(LINGLONG_ERRV(repo));
+        return;
+    }
+
+    auto popContext = pushThreadDefaultContext();
+
     utils::Transaction transaction;
     auto *cancellable = taskContext.cancellable();
 
@@ -1021,8 +1622,10 @@ void OSTreeRepo::pull(service::InstallTask &taskContext,
 
     g_autoptr(GError) gErr = nullptr;
 
-    // 这里不能使用g_main_context_push_thread_default，因为会阻塞Qt的事件循环
-    auto status = ostree_repo_pull(this->ostreeRepo.get(),
+    // The pull iterates the thread default context until it's done. On the main thread that's
+    // still the global default context, which is shared with Qt's event loop. A worker thread
+    // iterates a private context that nothing else waits on, so pushing it blocks nothing.
+    auto status = ostree_repo_pull(repo->get(),
                                    this->cfg.defaultRepo.c_str(),
                                    const_cast<char **>(refs.data()), // NOLINT
                                    OSTREE_REPO_PULL_FLAGS_NONE,
@@ -1041,7 +1644,7 @@ void OSTreeRepo::pull(service::InstallTask &taskContext,
         refs[0] = refString.c_str();
         g_clear_error(&gErr);
 
-        status = ostree_repo_pull(this->ostreeRepo.get(),
+        status = ostree_repo_pull(repo->get(),
                                   this->cfg.defaultRepo.c_str(),
                                   const_cast<char **>(refs.data()), // NOLINT
                                   OSTREE_REPO_PULL_FLAGS_NONE,
@@ -1055,53 +1658,141 @@ void OSTreeRepo::pull(service::InstallTask &taskContext,
         }
     }
 
-    g_autofree char *commit = nullptr;
-    g_autoptr(GFile) layerRootDir = nullptr;
-    api::types::v1::RepositoryCacheLayersItem item;
+    auto item = this->importPulledLayer(repo->get(), refString, cancellable);
+    if (!item) {
+        taskContext.reportError(LINGLONG_ERRV(item));
+        return;
+    }
 
-    g_clear_error(&gErr);
-    if (ostree_repo_read_commit(this->ostreeRepo.get(),
-                                refs[0],
-                                &layerRootDir,
-                                &commit,
-                                cancellable,
-                                &gErr)
-        == 0) {
-        taskContext.reportError(LINGLONG_ERRV("ostree_repo_read_commit", gErr));
+    transaction.addRollBack([this, layer = *item]() noexcept {
+        this->rollbackPulledLayer(layer);
+    });
+
+    transaction.commit();
+}
+
+void OSTreeRepo::pullMany(service::InstallTask &taskContext,
+                          const std::vector<package::Reference> &references,
+                          const std::string &module) noexcept
+{
+    LINGLONG_TRACE(QString("pull %1 references").arg(references.size()));
+
+    std::vector<std::string> refStrings;
+    refStrings.reserve(references.size());
+    for (const auto &reference : references) {
+        auto refString = ostreeSpecFromReferenceV2(reference, std::nullopt, module);
+        if (std::find(refStrings.begin(), refStrings.end(), refString) == refStrings.end()) {
+            refStrings.emplace_back(std::move(refString));
+        }
+    }
+
+    this->lockPullRefs(refStrings);
+    auto releaseRefs = utils::finally::finally([this, refStrings]() {
+        this->unlockPullRefs(refStrings);
+    });
+
+    std::vector<package::Reference> missing;
+    std::vector<std::string> specs;
+    for (const auto &reference : references) {
+        auto refString = ostreeSpecFromReferenceV2(reference, std::nullopt, module);
+        if (std::find(specs.begin(), specs.end(), refString) != specs.end()) {
+            continue;
+        }
+
+        if (this->getLayerDir(reference, module)) {
+            qInfo() << QString::fromStdString(refString) << "has been pulled, skip it";
+            continue;
+        }
+
+        missing.emplace_back(reference);
+        specs.emplace_back(std::move(refString));
+    }
+
+    if (missing.empty()) {
         return;
     }
 
-    g_autoptr(GFile) infoFile = g_file_resolve_relative_path(layerRootDir, "info.json");
-    auto info = utils::parsePackageInfo(infoFile);
-    if (!info) {
-        taskContext.reportError(LINGLONG_ERRV(info));
+    if (missing.size() == 1) {
+        this->pullLocked(taskContext, missing.front(), module);
         return;
     }
 
-    item.commit = commit;
-    item.info = *info;
-    item.repo = this->cfg.defaultRepo;
+    auto repo = this->openOstreeRepo();
+    if (!repo) {
+        taskContext.reportError(LINGLONG_ERRV(repo));
+        return;
+    }
 
-    auto layerDir = this->createLayerQDir(item.commit);
-    auto result = this->handleRepositoryUpdate(layerDir, item);
+    auto popContext = pushThreadDefaultContext();
+    auto *cancellable = taskContext.cancellable();
 
-    if (!result) {
-        taskContext.reportError(LINGLONG_ERRV(result));
-        return;
+    // a single pull fetches the objects shared by the layers only once
+    std::vector<const char *> refs;
+    refs.reserve(specs.size() + 1);
+    for (const auto &spec : specs) {
+        refs.emplace_back(spec.c_str());
     }
+    refs.emplace_back(nullptr);
 
-    transaction.addRollBack([this, &item, &layerDir]() noexcept {
-        if (!layerDir.removeRecursively()) {
-            qCritical() << "remove layer dir failed: " << layerDir.absolutePath();
-            Q_ASSERT(false);
+    ostreeUserData data{ .taskContext = &taskContext };
+    auto *progress = ostree_async_progress_new_and_connect(progress_changed, (void *)&data);
+    Q_ASSERT(progress != nullptr);
+
+    g_autoptr(GError) gErr = nullptr;
+    auto status = ostree_repo_pull(repo->get(),
+                                   this->cfg.defaultRepo.c_str(),
+                                   const_cast<char **>(refs.data()), // NOLINT
+                                   OSTREE_REPO_PULL_FLAGS_NONE,
+                                   progress,
+                                   cancellable,
+                                   &gErr);
+    ostree_async_progress_finish(progress);
+    if (status == FALSE) {
+        if (g_cancellable_is_cancelled(cancellable) == TRUE) {
+            taskContext.reportError(LINGLONG_ERRV("ostree_repo_pull", gErr));
+            return;
         }
 
-        auto result = this->removeOstreeRef(item);
-        if (!result) {
-            qCritical() << result.error();
-            Q_ASSERT(false);
+        // some of the refs may only exist in the old spec, pull them one by one
+        qWarning() << gErr->message;
+        qWarning() << "fallback to pull references one by one";
+        // like the single pull, either all of the refs are pulled or none of them is kept
+        utils::Transaction transaction;
+        for (const auto &reference : missing) {
+            this->pullLocked(taskContext, reference, module);
+            if (taskContext.currentStatus() == service::InstallTask::Failed
+                || taskContext.currentStatus() == service::InstallTask::Canceled) {
+                return;
+            }
+
+            transaction.addRollBack([this, reference, module]() noexcept {
+                auto result = this->remove(reference, module);
+                if (!result) {
+                    qCritical() << "rollback pull failed:" << result.error().message();
+                }
+            });
+        }
+        transaction.commit();
+        return;
+    }
+
+    // ostree only reports the progress of the whole pull, the progress of each ref is reported
+    // once its layer has been imported
+    utils::Transaction transaction;
+    for (std::size_t i = 0; i < specs.size(); ++i) {
+        auto item = this->importPulledLayer(repo->get(), specs[i], cancellable);
+        if (!item) {
+            taskContext.reportError(LINGLONG_ERRV(item));
+            return;
         }
-    });
+
+        transaction.addRollBack([this, layer = *item]() noexcept {
+            this->rollbackPulledLayer(layer);
+        });
+        taskContext.updateTask(static_cast<double>(i + 1),
+                               static_cast<double>(specs.size()),
+                               QString::fromStdString(specs[i]) + " has been pulled");
+    }
 
     transaction.commit();
 }
@@ -1131,50 +1822,8 @@ utils::error::Result<package::Reference> OSTreeRepo::clearReference(
     if (!list.has_value()) {
         return LINGLONG_ERR("get ref list from remote", list);
     }
-    for (auto record : *list) {
-        auto recordStr = nlohmann::json(record).dump();
-        if (fuzzy.channel && fuzzy.channel->toStdString() != record.channel) {
-            continue;
-        }
-        if (fuzzy.id.toStdString() != record.id) {
-            continue;
-        }
-        auto version = package::Version::parse(QString::fromStdString(record.version));
-        if (!version) {
-            qWarning() << "Ignore invalid package record" << recordStr.c_str() << version.error();
-            continue;
-        }
-        if (record.arch.empty()) {
-            qWarning() << "Ignore invalid package record";
-            continue;
-        }
-        auto arch = package::Architecture::parse(record.arch[0]);
-        if (!arch) {
-            qWarning() << "Ignore invalid package record" << recordStr.c_str() << arch.error();
-            continue;
-        }
-        auto channel = QString::fromStdString(record.channel);
-        auto currentRef = package::Reference::create(channel, fuzzy.id, *version, *arch);
-        if (!currentRef) {
-            qWarning() << "Ignore invalid package record" << recordStr.c_str()
-                       << currentRef.error();
-            continue;
-        }
-        if (!reference) {
-            reference = *currentRef;
-            continue;
-        }
-
-        if (reference->version >= currentRef->version) {
-            continue;
-        }
 
-        reference = *currentRef;
-    }
-    if (!reference) {
-        return LINGLONG_ERR("filter ref from list");
-    }
-    return reference;
+    return latestReference(fuzzy, *list);
 }
 
 utils::error::Result<std::vector<api::types::v1::PackageInfoV2>>
@@ -1199,73 +1848,92 @@ OSTreeRepo::listRemote(const package::FuzzyReference &fuzzyRef) const noexcept
 {
     LINGLONG_TRACE("list remote references");
 
-    auto client = m_clientFactory.createClientV2();
-    std::string id, repo, channel, version, arch;
-    id = fuzzyRef.id.toStdString();
-    repo = this->cfg.defaultRepo;
-    if (fuzzyRef.channel) {
-        channel = fuzzyRef.channel->toStdString();
+    auto pkgInfos = this->remoteCache->search(
+      this->remoteSearchKey(fuzzyRef),
+      [this, &fuzzyRef](const RemoteSearchCache::Entry *stale) {
+          auto client = m_clientFactory.createClientV2();
+          // wait http request to finish
+          return utils::async::runAndWait([this, client, &fuzzyRef, stale]() {
+              return searchRemote(client.get(), this->cfg.defaultRepo, fuzzyRef, stale);
+          });
+      });
+    if (!pkgInfos) {
+        return LINGLONG_ERR(pkgInfos);
     }
-    if (fuzzyRef.version) {
-        version = fuzzyRef.version->toString().toStdString();
-    }
-    if (fuzzyRef.arch) {
-        arch = fuzzyRef.arch->toString().toStdString();
-    } else {
-        arch = package::Architecture::currentCPUArchitecture()->toString().toStdString();
-    }
-    request_fuzzy_search_req_t req;
-    req.channel = channel.data();
-    req.version = version.data();
-    req.arch = arch.data();
-    req.app_id = id.data();
-    req.repo_name = repo.data();
-    // wait http request to finish
-    auto httpFuture = std::async(std::launch::async, [client, &req]() {
-        return ClientAPI_fuzzySearchApp(client.get(), &req);
-    });
-    QEventLoop loop;
-    QTimer timer;
-    connect(&timer, &QTimer::timeout, [&loop, &httpFuture]() {
-        if (httpFuture.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
-            loop.quit();
+    return pkgInfos;
+}
+
+std::string OSTreeRepo::remoteSearchKey(const package::FuzzyReference &fuzzyRef) const noexcept
+{
+    return RemoteSearchCache::key(this->cfg.repos.at(this->cfg.defaultRepo),
+                                  this->cfg.defaultRepo,
+                                  fuzzyRef);
+}
+
+RemoteSearchCacheStats OSTreeRepo::remoteSearchCacheStats() const noexcept
+{
+    return this->remoteCache->stats();
+}
+
+std::vector<utils::error::Result<package::Reference>>
+OSTreeRepo::clearRemoteReferences(const std::vector<package::FuzzyReference> &fuzzyRefs) const
+  noexcept
+{
+    LINGLONG_TRACE(QString("clear %1 references from remote").arg(fuzzyRefs.size()));
+
+    std::vector<utils::error::Result<package::Reference>> references;
+    references.reserve(fuzzyRefs.size());
+    for (const auto &fuzzyRef : fuzzyRefs) {
+        references.emplace_back(LINGLONG_ERR(fuzzyRef.toString() + " is not resolved"));
+    }
+    if (fuzzyRefs.empty()) {
+        return references;
+    }
+
+    // Every query is a round trip to the server, a few of them are sent at the same time. Each
+    // worker uses a client of its own, as apiClient_t couldn't be shared between threads.
+    auto jobs = std::min<std::size_t>(fuzzyRefs.size(), remoteQueryJobs);
+    std::atomic<std::size_t> next{ 0 };
+    utils::async::runAndWait([this, &fuzzyRefs, &references, &next, jobs]() {
+        auto worker = [this, &fuzzyRefs, &references, &next]() {
+            auto client = m_clientFactory.createClientV2();
+            for (auto i = next++; i < fuzzyRefs.size(); i = next++) {
+                auto list = this->remoteCache->search(
+                  this->remoteSearchKey(fuzzyRefs[i]),
+                  [this, &client, &fuzzyRef = fuzzyRefs[i]](const RemoteSearchCache::Entry *stale) {
+                      return searchRemote(client.get(), this->cfg.defaultRepo, fuzzyRef, stale);
+                  });
+                if (!list) {
+                    references[i] = tl::unexpected(std::move(list).error());
+                    continue;
+                }
+
+                references[i] = latestReference(fuzzyRefs[i], *list);
+            }
         };
+
+        std::vector<std::thread> workers;
+        for (std::size_t i = 1; i < jobs; ++i) {
+            try {
+                workers.emplace_back(worker);
+            } catch (const std::system_error &e) {
+                qWarning() << "failed to start query worker:" << e.what();
+                break;
+            }
+        }
+        worker();
+        for (auto &thread : workers) {
+            thread.join();
+        }
     });
-    timer.start(100);
-    loop.exec();
 
-    auto res = httpFuture.get();
-    if (!res) {
-        return LINGLONG_ERR("cannot send request to remote server");
-    }
-    if (res->code != 200) {
-        return LINGLONG_ERR(res->msg);
-    }
-    if (!res->data) {
-        return {};
-    }
-    auto pkgInfos = std::vector<api::types::v1::PackageInfoV2>{};
-    for (auto entry = res->data->firstEntry; entry != nullptr; entry = entry->nextListEntry) {
-        auto item = (request_register_struct_t *)entry->data;
-        pkgInfos.emplace_back(api::types::v1::PackageInfoV2{
-          .arch = { item->arch },
-          .channel = item->channel,
-          .description = item->description,
-          .id = item->app_id,
-          .kind = item->kind,
-          .packageInfoV2Module = item->module,
-          .name = item->name,
-          .runtime = item->runtime,
-          .size = item->size,
-          .version = item->version,
-        });
-    }
-    fuzzy_search_app_200_response_free(res);
-    return pkgInfos;
+    return references;
 }
 
 void OSTreeRepo::removeDanglingXDGIntergation() noexcept
 {
+    std::lock_guard<std::recursive_mutex> lock(this->exportMutex);
+
     QDir entriesDir = this->repoDir.absoluteFilePath("entries/share");
     QDirIterator it(entriesDir.absolutePath(),
                     QDir::AllEntries | QDir::NoDot | QDir::NoDotDot | QDir::System,
@@ -1299,6 +1967,8 @@ void OSTreeRepo::removeDanglingXDGIntergation() noexcept
 
 void OSTreeRepo::unexportReference(const package::Reference &ref) noexcept
 {
+    std::lock_guard<std::recursive_mutex> lock(this->exportMutex);
+
     auto layerDir = this->getLayerDir(ref);
     if (!layerDir) {
         Q_ASSERT(false);
@@ -1339,6 +2009,8 @@ void OSTreeRepo::unexportReference(const package::Reference &ref) noexcept
 
 void OSTreeRepo::exportReference(const package::Reference &ref) noexcept
 {
+    std::lock_guard<std::recursive_mutex> lock(this->exportMutex);
+
     bool shouldExport = true;
 
     [&ref, this, &shouldExport]() {
@@ -1442,11 +2114,7 @@ void OSTreeRepo::exportReference(const package::Reference &ref) noexcept
             // In KDE environment, every desktop should own the executable permission
             // We just set the file permission to 0755 here.
             if (info.suffix() == "desktop") {
-                if (!QFile::setPermissions(info.absoluteFilePath(),
-                                           QFileDevice::ReadOwner | QFileDevice::WriteOwner
-                                             | QFileDevice::ExeOwner | QFileDevice::ReadGroup
-                                             | QFileDevice::ExeGroup | QFileDevice::ReadOther
-                                             | QFileDevice::ExeOther)) {
+                if (!makeExecutable(info.absoluteFilePath())) {
                     qCritical() << "Failed to chmod" << info.absoluteFilePath();
                     Q_ASSERT(false);
                 }
@@ -1568,6 +2236,12 @@ auto OSTreeRepo::getLayerDir(const api::types::v1::RepositoryCacheLayersItem &la
         return LINGLONG_ERR(dir.absolutePath() + " doesn't exist");
     }
 
+    if (layer.image.value_or(false) && !package::LayerDir{ dir.absolutePath() }.valid()) {
+        // the images are mounted by ll-package-manager when it starts
+        return LINGLONG_ERR("the image of " + dir.absolutePath()
+                            + " is not mounted, is org.deepin.linglong.PackageManager running?");
+    }
+
     qCritical() << QString::fromStdString(layer.info.id)
                 << QString::fromStdString(layer.info.version);
     return dir.absolutePath();
@@ -1773,10 +2447,11 @@ utils::error::Result<void> OSTreeRepo::migrateRefs() noexcept
         }
     });
 
+    auto options = layerCheckoutOptions();
     for (auto [oldRef, commit] : refs) {
         auto layerDir = oldLayers / commit;
         if (ostree_repo_checkout_at(this->ostreeRepo.get(),
-                                    nullptr,
+                                    &options,
                                     root,
                                     layerDir.c_str(),
                                     commit.data(),
@@ -9,14 +9,20 @@
 #include "linglong/api/types/v1/RepoConfig.hpp"
 #include "linglong/package/fuzzy_reference.h"
 #include "linglong/package/layer_dir.h"
+#include "linglong/package/layer_file.h"
 #include "linglong/package/reference.h"
 #include "linglong/package_manager/task.h"
 #include "linglong/repo/client_factory.h"
+#include "linglong/repo/remote_search_cache.h"
 #include "linglong/repo/repo_cache.h"
 #include "linglong/utils/error/error.h"
 
 #include <ostree.h>
 
+#include <condition_variable>
+#include <mutex>
+#include <unordered_set>
+
 namespace linglong::repo {
 
 struct clearReferenceOption
@@ -46,6 +52,12 @@ public:
     importLayerDir(const package::LayerDir &dir,
                    const std::optional<std::string> &subRef = std::nullopt) noexcept;
 
+    // Keeps the layer file as is instead of committing its files to ostree, the erofs image in it
+    // is mounted on the layer directory. The file is copied into the repository once.
+    utils::error::Result<package::LayerDir> importLayerFile(package::LayerFile &file) noexcept;
+    // mounts the layers imported by importLayerFile again, e.g. after a reboot
+    void mountLayerImages() noexcept;
+
     [[nodiscard]] utils::error::Result<package::LayerDir>
     getLayerDir(const package::Reference &ref,
                 const std::string &module = "binary",
@@ -62,6 +74,11 @@ public:
     void pull(service::InstallTask &taskContext,
               const package::Reference &reference,
               const std::string &module = "binary") noexcept;
+    // pullMany fetches all references in a single pull, so the objects shared by them are
+    // downloaded only once.
+    void pullMany(service::InstallTask &taskContext,
+                  const std::vector<package::Reference> &references,
+                  const std::string &module = "binary") noexcept;
 
     [[nodiscard]] utils::error::Result<package::Reference> clearReference(
       const package::FuzzyReference &fuzz, const clearReferenceOption &opts) const noexcept;
@@ -69,12 +86,25 @@ public:
     utils::error::Result<std::vector<api::types::v1::PackageInfoV2>> listLocal() const noexcept;
     utils::error::Result<std::vector<api::types::v1::PackageInfoV2>>
     listRemote(const package::FuzzyReference &fuzzyRef) const noexcept;
+    // Resolves the latest remote reference of each fuzzy reference, the queries are sent
+    // concurrently. A fuzzy reference which couldn't be resolved gets an error of its own.
+    [[nodiscard]] std::vector<utils::error::Result<package::Reference>>
+    clearRemoteReferences(const std::vector<package::FuzzyReference> &fuzzyRefs) const noexcept;
+    // remote searches are cached for LINGLONG_REMOTE_CACHE_TTL seconds, then revalidated
+    [[nodiscard]] RemoteSearchCacheStats remoteSearchCacheStats() const noexcept;
 
     utils::error::Result<void>
     remove(const package::Reference &ref,
            const std::string &module = "binary",
            const std::optional<std::string> &subRef = std::nullopt) noexcept;
 
+    // Layers pulled, imported or removed while the returned batch is open are flushed to disk
+    // together when it ends, so a task changing several layers pays for a single flush.
+    [[nodiscard]] RepoCacheBatch batchCacheUpdates() noexcept
+    {
+        return RepoCacheBatch(*this->cache);
+    }
+
     utils::error::Result<void> prune();
 
     void removeDanglingXDGIntergation() noexcept;
@@ -103,15 +133,46 @@ private:
     std::unique_ptr<OstreeRepo, OstreeRepoDeleter> ostreeRepo = nullptr;
     QDir repoDir;
     std::unique_ptr<linglong::repo::RepoCache> cache{ nullptr };
+    std::unique_ptr<RemoteSearchCache> remoteCache{ nullptr };
     ClientFactory &m_clientFactory;
+    // refs being pulled, a task pulling the same ref waits for the running one
+    std::mutex pullMutex;
+    std::condition_variable pullFinished;
+    std::unordered_set<std::string> pullingRefs;
+    // entries/share is shared by all layers
+    std::recursive_mutex exportMutex;
+
+    // OstreeRepo allows only one transaction at a time, operations which may run in parallel
+    // use their own handle of the repository
+    [[nodiscard]] utils::error::Result<std::unique_ptr<OstreeRepo, OstreeRepoDeleter>>
+    openOstreeRepo() const noexcept;
+
+    // waits until none of the refs is being pulled by another task, then takes all of them
+    void lockPullRefs(const std::vector<std::string> &refs) noexcept;
+    void unlockPullRefs(const std::vector<std::string> &refs) noexcept;
+    // pulls a reference which has been locked by lockPullRefs
+    void pullLocked(service::InstallTask &taskContext,
+                    const package::Reference &reference,
+                    const std::string &module) noexcept;
+    utils::error::Result<api::types::v1::RepositoryCacheLayersItem>
+    importPulledLayer(OstreeRepo *repo, const std::string &ref, GCancellable *cancellable) noexcept;
+    void rollbackPulledLayer(const api::types::v1::RepositoryCacheLayersItem &item) noexcept;
+
+    [[nodiscard]] std::string
+    remoteSearchKey(const package::FuzzyReference &fuzzyRef) const noexcept;
 
     utils::error::Result<void> updateConfig(const api::types::v1::RepoConfig &newCfg) noexcept;
     QDir ostreeRepoDir() const noexcept;
     QDir createLayerQDir(const std::string &commit) const noexcept;
-    utils::error::Result<void> handleRepositoryUpdate(
-      QDir layerDir, const api::types::v1::RepositoryCacheLayersItem &layer) noexcept;
+    utils::error::Result<void>
+    handleRepositoryUpdate(OstreeRepo *repo,
+                           QDir layerDir,
+                           const api::types::v1::RepositoryCacheLayersItem &layer) noexcept;
     utils::error::Result<void>
     removeOstreeRef(const api::types::v1::RepositoryCacheLayersItem &layer) noexcept;
+    utils::error::Result<void>
+    removeLayerImage(const api::types::v1::RepositoryCacheLayersItem &layer) noexcept;
+    [[nodiscard]] QString layerImagePath(const std::string &commit) const noexcept;
     [[nodiscard]] utils::error::Result<package::LayerDir>
     getLayerDir(const api::types::v1::RepositoryCacheLayersItem &layer) const noexcept;
 
@@ -121,4 +182,8 @@ private:
                  const std::optional<std::string> &subRef = std::nullopt) const noexcept;
 };
 
+// Layers are checked out as hardlinks to the objects of the repository, so they take no extra
+// space. Files of a layer directory mustn't be modified in place.
+OstreeRepoCheckoutAtOptions layerCheckoutOptions() noexcept;
+
 } // namespace linglong::repo
@@ -0,0 +1,184 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "remote_search_cache.h"
+
+#include "linglong/api/types/v1/Generators.hpp"
+
+#include <QDebug>
+
+#include <fstream>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace linglong::repo {
+
+namespace {
+
+// entries which haven't been refreshed for so long are not worth revalidating any more
+constexpr int64_t maxEntryAge = 7 * 24 * 60 * 60;
+
+int64_t now() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+std::chrono::seconds remoteSearchCacheTTL() noexcept
+{
+    bool ok{ false };
+    auto ttl = qEnvironmentVariableIntValue("LINGLONG_REMOTE_CACHE_TTL", &ok);
+    if (!ok || ttl < 0) {
+        return std::chrono::minutes(5);
+    }
+
+    return std::chrono::seconds(ttl);
+}
+
+RemoteSearchCache::RemoteSearchCache(std::filesystem::path file, std::chrono::seconds ttl) noexcept
+    : file(std::move(file))
+    , ttl(ttl)
+{
+    this->load();
+}
+
+std::string RemoteSearchCache::key(const std::string &server,
+                                   const std::string &repo,
+                                   const package::FuzzyReference &fuzzyRef) noexcept
+{
+    return server + "\n" + repo + "\n" + fuzzyRef.toString().toStdString();
+}
+
+utils::error::Result<std::vector<api::types::v1::PackageInfoV2>>
+RemoteSearchCache::search(const std::string &key, const Fetch &fetch) noexcept
+{
+    LINGLONG_TRACE("search remote with cache");
+
+    auto timestamp = now();
+    std::optional<Entry> stale;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto it = this->entries.find(key);
+        if (it != this->entries.end()) {
+            auto age = timestamp - it->second.fetchedAt;
+            if (age >= 0 && age < this->ttl.count()) {
+                ++this->hits;
+                return it->second.packages;
+            }
+
+            stale = it->second;
+        }
+    }
+
+    // the lock is not held during the round trip, concurrent misses of a key just fetch it twice
+    auto ret = fetch(stale ? &*stale : nullptr);
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    Entry entry;
+    if (!*ret) {
+        if (!stale) {
+            return LINGLONG_ERR("server reports not modified, but nothing is cached");
+        }
+
+        ++this->revalidations;
+        entry = std::move(stale).value();
+    } else {
+        ++this->misses;
+        entry = std::move(*ret).value();
+    }
+
+    entry.fetchedAt = timestamp;
+    auto packages = entry.packages;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->entries[key] = std::move(entry);
+    }
+    this->save();
+
+    return packages;
+}
+
+RemoteSearchCacheStats RemoteSearchCache::stats() const noexcept
+{
+    return { this->hits.load(), this->revalidations.load(), this->misses.load() };
+}
+
+void RemoteSearchCache::load() noexcept
+{
+    std::error_code ec;
+    if (!std::filesystem::exists(this->file, ec)) {
+        return;
+    }
+
+    try {
+        std::ifstream ifs(this->file);
+        auto json = nlohmann::json::parse(ifs);
+        for (const auto &[key, value] : json.at("entries").items()) {
+            this->entries.emplace(
+              key,
+              Entry{ value.at("packages").get<std::vector<api::types::v1::PackageInfoV2>>(),
+                     value.at("etag").get<std::string>(),
+                     value.at("lastModified").get<std::string>(),
+                     value.at("fetchedAt").get<int64_t>() });
+        }
+    } catch (const std::exception &e) {
+        // the cache would be rewritten by the next search
+        qDebug() << "ignore invalid remote search cache" << this->file.c_str() << e.what();
+        this->entries.clear();
+    }
+}
+
+void RemoteSearchCache::save() noexcept
+{
+    std::string content;
+    try {
+        nlohmann::json items = nlohmann::json::object();
+        auto timestamp = now();
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (const auto &[key, entry] : this->entries) {
+            if (timestamp - entry.fetchedAt > maxEntryAge) {
+                continue;
+            }
+
+            items[key] = { { "packages", entry.packages },
+                           { "etag", entry.etag },
+                           { "lastModified", entry.lastModified },
+                           { "fetchedAt", entry.fetchedAt } };
+        }
+        content = nlohmann::json{ { "version", 1 }, { "entries", items } }.dump();
+    } catch (const std::exception &e) {
+        qWarning() << "failed to serialize remote search cache:" << e.what();
+        return;
+    }
+
+    // a cache which couldn't be written, e.g. by an unprivileged ll-cli, still works in memory
+    auto tmpFile = this->file;
+    // the gettid wrapper is only available since glibc 2.30
+    tmpFile +=
+      "." + std::to_string(::getpid()) + "." + std::to_string(::syscall(SYS_gettid)) + ".tmp";
+    {
+        std::ofstream ofs(tmpFile, std::ios::trunc);
+        if (!ofs.is_open() || !(ofs << content).flush()) {
+            qDebug() << "failed to write remote search cache" << tmpFile.c_str();
+            return;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpFile, this->file, ec);
+    if (ec) {
+        qDebug() << "failed to replace remote search cache:" << ec.message().c_str();
+        std::filesystem::remove(tmpFile, ec);
+    }
+}
+
+} // namespace linglong::repo
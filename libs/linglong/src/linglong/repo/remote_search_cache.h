@@ -0,0 +1,82 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "linglong/api/types/v1/PackageInfoV2.hpp"
+#include "linglong/package/fuzzy_reference.h"
+#include "linglong/utils/error/error.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace linglong::repo {
+
+struct RemoteSearchCacheStats
+{
+    std::size_t hits{ 0 };
+    // stale entries confirmed by the server with 304 Not Modified
+    std::size_t revalidations{ 0 };
+    std::size_t misses{ 0 };
+};
+
+// RemoteSearchCache keeps the results of remote searches in memory and in a json file. An entry
+// younger than the TTL is returned without asking the server, an older one is revalidated with
+// its ETag or Last-Modified. All methods could be called from multiple threads.
+class RemoteSearchCache
+{
+public:
+    struct Entry
+    {
+        std::vector<api::types::v1::PackageInfoV2> packages;
+        std::string etag;
+        std::string lastModified;
+        int64_t fetchedAt{ 0 }; // seconds since epoch
+    };
+
+    // Fetches the search result from the server. A stale entry is passed in for revalidation,
+    // std::nullopt is returned if the server reports it's not modified.
+    using Fetch = std::function<utils::error::Result<std::optional<Entry>>(const Entry *stale)>;
+
+    RemoteSearchCache(std::filesystem::path file, std::chrono::seconds ttl) noexcept;
+    RemoteSearchCache(const RemoteSearchCache &) = delete;
+    RemoteSearchCache &operator=(const RemoteSearchCache &) = delete;
+    RemoteSearchCache(RemoteSearchCache &&other) = delete;
+    RemoteSearchCache &operator=(RemoteSearchCache &&other) = delete;
+    ~RemoteSearchCache() = default;
+
+    [[nodiscard]] static std::string key(const std::string &server,
+                                         const std::string &repo,
+                                         const package::FuzzyReference &fuzzyRef) noexcept;
+
+    utils::error::Result<std::vector<api::types::v1::PackageInfoV2>>
+    search(const std::string &key, const Fetch &fetch) noexcept;
+
+    [[nodiscard]] RemoteSearchCacheStats stats() const noexcept;
+
+private:
+    void load() noexcept;
+    void save() noexcept;
+
+    std::filesystem::path file;
+    std::chrono::seconds ttl;
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    std::atomic<std::size_t> hits{ 0 };
+    std::atomic<std::size_t> revalidations{ 0 };
+    std::atomic<std::size_t> misses{ 0 };
+};
+
+// the TTL of remote search results, could be overridden by LINGLONG_REMOTE_CACHE_TTL in seconds
+std::chrono::seconds remoteSearchCacheTTL() noexcept;
+
+} // namespace linglong::repo
@@ -6,19 +6,444 @@
 
 #include "repo_cache.h"
 
+#include "linglong/package/layer_file.h"
+#include "linglong/repo/binary_repo_cache.h"
 #include "linglong/utils/configure.h"
+#include "linglong/utils/finally/finally.h"
 #include "linglong/utils/packageinfo_handler.h"
 #include "linglong/utils/serialize/json.h"
 
+#include <QSaveFile>
+
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
 
 namespace linglong::repo {
 
+namespace {
+
+std::string refIndexKey(const std::string &id,
+                        const std::string &channel,
+                        const std::string &version,
+                        const std::string &module) noexcept
+{
+    return channel + "/" + id + "/" + version + "/" + module;
+}
+
+void replaceInIndex(std::unordered_map<std::string, std::vector<std::size_t>> &index,
+                    const std::string &key,
+                    std::size_t from,
+                    std::optional<std::size_t> to) noexcept
+{
+    auto bucket = index.find(key);
+    if (bucket == index.end()) {
+        Q_ASSERT(false);
+        return;
+    }
+
+    auto &positions = bucket->second;
+    auto it = std::find(positions.begin(), positions.end(), from);
+    if (it == positions.end()) {
+        Q_ASSERT(false);
+        return;
+    }
+
+    if (to) {
+        *it = *to;
+        return;
+    }
+
+    positions.erase(it);
+    if (positions.empty()) {
+        index.erase(bucket);
+    }
+}
+
+bool isSameLayerItem(const api::types::v1::RepositoryCacheLayersItem &lhs,
+                     const api::types::v1::RepositoryCacheLayersItem &rhs) noexcept
+{
+    return !(lhs.commit != rhs.commit || lhs.repo != rhs.repo
+             || lhs.info.channel != rhs.info.channel || lhs.info.id != rhs.info.id
+             || lhs.info.version != rhs.info.version
+             || lhs.info.arch.front() != rhs.info.arch.front()
+             || lhs.info.packageInfoV2Module != rhs.info.packageInfoV2Module);
+}
+
+// versions are parsed once when a layer is added, queries only compare the packed integers
+package::PackedVersion packVersion(const std::string &version) noexcept
+{
+    auto parsed = package::Version::tryParse(std::string_view(version));
+    if (!parsed) {
+        qWarning() << "invalid version of layer:" << version.c_str()
+                   << package::versionErrorString(parsed.error());
+        return 0;
+    }
+
+    return parsed->pack();
+}
+
+// orders pairs of (packed version, layer) from the newest to the oldest
+constexpr auto newerLayer = [](const auto &lhs, const auto &rhs) noexcept {
+    return lhs.first > rhs.first;
+};
+
+bool matchQuery(const api::types::v1::RepositoryCacheLayersItem &layer,
+                const repoCacheQuery &query) noexcept
+{
+    if (query.id && query.id.value() != layer.info.id) {
+        return false;
+    }
+
+    if (query.repo && query.repo.value() != layer.repo) {
+        return false;
+    }
+
+    if (query.channel && query.channel.value() != layer.info.channel) {
+        return false;
+    }
+
+    if (query.version && query.version.value() != layer.info.version) {
+        return false;
+    }
+
+    if (query.module && query.module.value() != layer.info.packageInfoV2Module) {
+        return false;
+    }
+
+    if (query.uuid) {
+        if (!layer.info.uuid) {
+            return false;
+        }
+
+        if (query.uuid.value() != layer.info.uuid.value()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::filesystem::path binaryCacheFileOf(const std::filesystem::path &cacheFile) noexcept
+{
+    return std::filesystem::path{ cacheFile }.replace_extension(".bin");
+}
+
+utils::error::Result<void> writeJSON(const std::filesystem::path &cacheFile,
+                                     const api::types::v1::RepositoryCache &cache)
+{
+    LINGLONG_TRACE("save repo cache to json");
+
+    std::error_code ec;
+    if (!std::filesystem::exists(cacheFile.parent_path(), ec)) {
+        return LINGLONG_ERR("The parent directory of state.json doesn't exist:"
+                            + QString::fromStdString(ec.message()));
+    }
+
+    // QSaveFile replaces the file by rename, a crash never leaves a truncated cache behind
+    QSaveFile out(QString::fromStdString(cacheFile.string()));
+    if (!out.open(QIODevice::WriteOnly)) { // dump all info
+        auto dumpStatus = [](const std::filesystem::path &p, std::error_code &ec) {
+            LINGLONG_TRACE("dump status")
+            auto status = std::filesystem::status(p, ec);
+            if (ec) {
+                return;
+            }
+
+            auto targetPerm = status.permissions();
+
+            using std::filesystem::perms;
+            auto out = qInfo().nospace();
+            out << QString::fromStdString(p.string()) << ":";
+            auto show = [&out, targetPerm](char op, perms perm) {
+                out << (perms::none == (perm & targetPerm) ? '-' : op);
+            };
+            show('r', perms::owner_read);
+            show('w', perms::owner_write);
+            show('x', perms::owner_exec);
+            show('r', perms::group_read);
+            show('w', perms::group_write);
+            show('x', perms::group_exec);
+            show('r', perms::others_read);
+            show('w', perms::others_write);
+            show('x', perms::others_exec);
+        };
+
+        qInfo() << "process uid:" << ::getuid() << "process gid:" << ::getgid();
+
+        dumpStatus(cacheFile.parent_path(), ec);
+        if (ec) {
+            QString msg = "get status of directory"
+              + QString::fromStdString(cacheFile.parent_path())
+              + "error:" + QString::fromStdString(ec.message());
+            return LINGLONG_ERR(msg);
+        }
+
+        if (std::filesystem::exists(cacheFile, ec)) {
+            dumpStatus(cacheFile, ec);
+            if (ec) {
+                QString msg = "get status of file"
+                  + QString::fromStdString(cacheFile.string())
+                  + "error:" + QString::fromStdString(ec.message());
+                return LINGLONG_ERR(msg);
+            }
+        }
+
+        if (ec) {
+            QString msg = "check file" + QString::fromStdString(cacheFile.string())
+              + "exist error:" + QString::fromStdString(ec.message());
+            return LINGLONG_ERR(msg);
+        }
+
+        qWarning() << "couldn't write" << cacheFile.c_str() << out.errorString();
+        return LINGLONG_OK;
+    }
+
+    auto data = nlohmann::json(cache).dump();
+    out.write(data.data(), static_cast<qint64>(data.size()));
+    if (!out.commit()) {
+        return LINGLONG_ERR(out.errorString());
+    }
+
+    return LINGLONG_OK;
+}
+
+utils::error::Result<void> writeSnapshot(RepoCacheFormat format,
+                                         const std::filesystem::path &cacheFile,
+                                         const api::types::v1::RepositoryCache &cache)
+{
+    LINGLONG_TRACE("save repo cache");
+
+    std::error_code ec;
+    if (format == RepoCacheFormat::JSON) {
+        // a binary cache left by previous runs is outdated from now on
+        std::filesystem::remove(binaryCacheFileOf(cacheFile), ec);
+        if (ec) {
+            qWarning() << "failed to remove" << binaryCacheFileOf(cacheFile).c_str()
+                       << ec.message().c_str();
+        }
+
+        auto ret = writeJSON(cacheFile, cache);
+        if (!ret) {
+            return LINGLONG_ERR(ret);
+        }
+    } else {
+        auto ret = writeBinaryRepoCache(binaryCacheFileOf(cacheFile), cache);
+        if (!ret) {
+            return LINGLONG_ERR(ret);
+        }
+
+        // states.json is only a debug view now, never leave an outdated one behind
+        if (!qgetenv("LINGLONG_DEBUG").isEmpty()) {
+            ret = writeJSON(cacheFile, cache);
+            if (!ret) {
+                return LINGLONG_ERR(ret);
+            }
+        } else {
+            std::filesystem::remove(cacheFile, ec);
+            if (ec) {
+                qWarning() << "failed to remove" << cacheFile.c_str() << ec.message().c_str();
+            }
+        }
+    }
+
+    // make the rename durable before the journal covered by this snapshot is dropped
+    auto ret = syncDirectory(cacheFile.parent_path());
+    if (!ret) {
+        qWarning() << ret.error();
+    }
+
+    return LINGLONG_OK;
+}
+
+// the number of threads used to read commits while rebuilding the cache, could be overridden by
+// LINGLONG_REBUILD_CACHE_JOBS
+std::size_t rebuildJobs(std::size_t refs) noexcept
+{
+    bool ok{ false };
+    auto jobs = qEnvironmentVariableIntValue("LINGLONG_REBUILD_CACHE_JOBS", &ok);
+    if (!ok || jobs <= 0) {
+        // reading commits is mostly I/O bound, but too many threads only thrash the disk
+        jobs = static_cast<int>(std::clamp(std::thread::hardware_concurrency(), 1U, 8U));
+    }
+
+    return std::clamp<std::size_t>(refs, 1, jobs);
+}
+
+utils::error::Result<api::types::v1::RepositoryCacheLayersItem> loadLayer(OstreeRepo *repo,
+                                                                          std::string_view ref)
+{
+    LINGLONG_TRACE(QString("load layer of ref %1").arg(ref.data()));
+
+    api::types::v1::RepositoryCacheLayersItem item;
+    item.repo = ref.substr(0, ref.find(':'));
+
+    g_autofree char *commit{ nullptr };
+    g_autoptr(GError) gErr{ nullptr };
+    g_autoptr(GFile) root{ nullptr };
+    if (ostree_repo_read_commit(repo, ref.data(), &root, &commit, nullptr, &gErr) == FALSE) {
+        return LINGLONG_ERR("ostree_repo_read_commit", gErr);
+    }
+    item.commit = commit;
+
+    // ostree ls --repo repo ref, the file path of info.json is /info.json.
+    g_autoptr(GFile) infoFile = g_file_resolve_relative_path(root, "info.json");
+    auto info = utils::parsePackageInfo(infoFile);
+    if (!info) {
+        return LINGLONG_ERR(info);
+    }
+    item.info = *info;
+
+    return item;
+}
+
+// Layers installed as erofs images aren't ostree refs, they are found by their layer files in
+// images/ next to the cache file, which are named after their sha256.
+std::vector<api::types::v1::RepositoryCacheLayersItem>
+loadImageLayers(const std::filesystem::path &dir) noexcept
+{
+    std::vector<api::types::v1::RepositoryCacheLayersItem> items;
+    std::error_code ec;
+    for (auto it = std::filesystem::directory_iterator(dir, ec);
+         !ec && it != std::filesystem::directory_iterator();
+         it.increment(ec)) {
+        const auto &path = it->path();
+        if (path.extension() != ".layer") {
+            continue;
+        }
+
+        auto file = package::LayerFile::New(QString::fromStdString(path.string()));
+        if (!file) {
+            qWarning() << "ignore invalid layer image" << path.c_str() << file.error();
+            continue;
+        }
+
+        auto metaInfo = (*file)->metaInfo();
+        if (!metaInfo) {
+            qWarning() << "ignore invalid layer image" << path.c_str() << metaInfo.error();
+            continue;
+        }
+
+        auto info = utils::parsePackageInfo(metaInfo->info);
+        if (!info) {
+            qWarning() << "ignore invalid layer image" << path.c_str() << info.error();
+            continue;
+        }
+
+        api::types::v1::RepositoryCacheLayersItem item;
+        item.commit = path.stem().string();
+        item.image = true;
+        item.info = std::move(info).value();
+        item.repo = "local";
+
+        items.emplace_back(std::move(item));
+    }
+
+    // the order of a directory is unspecified, sort layers to get the same cache on every rebuild
+    std::sort(items.begin(), items.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.commit < rhs.commit;
+    });
+    return items;
+}
+
+// Reads the commit and info.json of each ref by a pool of threads. OstreeRepo isn't thread safe,
+// so every thread opens its own handle of the same repository. Layers are returned in the order
+// of refs, no matter which thread reads them.
+utils::error::Result<std::vector<api::types::v1::RepositoryCacheLayersItem>>
+loadLayers(OstreeRepo &repo, const std::vector<std::string_view> &refs) noexcept
+{
+    LINGLONG_TRACE("load layers from ostree refs");
+
+    std::vector<std::optional<api::types::v1::RepositoryCacheLayersItem>> layers(refs.size());
+    std::atomic_size_t next{ 0 };
+    std::atomic_size_t done{ 0 };
+    std::atomic_bool failed{ false };
+    std::mutex errorMutex;
+    utils::error::Result<void> error = LINGLONG_OK;
+    const auto progressStep = std::max<std::size_t>(refs.size() / 10, 1);
+
+    auto fail = [&](utils::error::Result<void> &&ret) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!failed.exchange(true)) {
+            error = std::move(ret);
+        }
+    };
+
+    auto worker = [&]() {
+        LINGLONG_TRACE("load layers");
+
+        g_autoptr(GError) gErr = nullptr;
+        g_autoptr(OstreeRepo) workerRepo = ostree_repo_new(ostree_repo_get_path(&repo));
+        if (ostree_repo_open(workerRepo, nullptr, &gErr) == FALSE) {
+            fail(LINGLONG_ERR("ostree_repo_open", gErr));
+            return;
+        }
+
+        for (auto index = next.fetch_add(1); index < refs.size() && !failed;
+             index = next.fetch_add(1)) {
+            auto layer = loadLayer(workerRepo, refs[index]);
+            if (!layer) {
+                fail(LINGLONG_ERR(layer));
+                return;
+            }
+            layers[index] = std::move(layer).value();
+
+            auto finished = done.fetch_add(1) + 1;
+            if (finished % progressStep == 0 || finished == refs.size()) {
+                qInfo().noquote()
+                  << QString("rebuilding repo cache: %1/%2 refs").arg(finished).arg(refs.size());
+            }
+        }
+    };
+
+    auto jobs = rebuildJobs(refs.size());
+    std::vector<std::thread> threads;
+    threads.reserve(jobs - 1);
+    try {
+        for (std::size_t i = 1; i < jobs; ++i) {
+            threads.emplace_back(worker);
+        }
+    } catch (const std::system_error &e) {
+        // fewer threads just take longer
+        qWarning() << "failed to start thread:" << e.what();
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (!error) {
+        return LINGLONG_ERR(error);
+    }
+
+    std::vector<api::types::v1::RepositoryCacheLayersItem> ret;
+    ret.reserve(layers.size());
+    for (auto &layer : layers) {
+        ret.emplace_back(std::move(layer).value());
+    }
+
+    return ret;
+}
+
+// the snapshot is rewritten once the journal holds this many records
+constexpr std::size_t compactionThreshold = 64;
+
+} // namespace
+
+RepoCache::~RepoCache()
+{
+    this->waitCompaction();
+}
+
 utils::error::Result<std::unique_ptr<RepoCache>>
 RepoCache::create(const std::filesystem::path &cacheFile,
                   const api::types::v1::RepoConfig &repoConfig,
-                  OstreeRepo &repo)
+                  OstreeRepo &repo,
+                  RepoCacheFormat format)
 {
     LINGLONG_TRACE("load from RepoCache");
 
@@ -31,44 +456,91 @@ RepoCache::create(const std::filesystem::path &cacheFile,
     // see also: https://seanmiddleditch.github.io/enabling-make-unique-with-private-constructors
     auto repoCache = std::make_unique<enableMaker>();
     repoCache->cacheFile = cacheFile;
+    repoCache->format = format;
+    repoCache->journal = std::make_unique<RepoCacheJournal>(
+      std::filesystem::path{ cacheFile }.replace_extension(".journal"));
+
+    auto ret = repoCache->loadSnapshot(repoConfig, repo);
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    ret = repoCache->replayJournal();
+    if (!ret) {
+        qWarning() << ret.error();
+        std::cout << "invalid cache journal, rebuild cache..." << std::endl;
+        ret = repoCache->rebuildCache(repoConfig, repo);
+        if (!ret) {
+            return LINGLONG_ERR(ret);
+        }
+        return repoCache;
+    }
+
+    std::error_code ec;
+    if (format == RepoCacheFormat::Binary
+        && !std::filesystem::exists(repoCache->binaryCacheFile(), ec)) {
+        // convert the json cache, ll-cli may have no permission to do this
+        ret = repoCache->writeToDisk();
+        if (!ret) {
+            qDebug() << ret.error();
+        }
+    }
+
+    return repoCache;
+}
+
+utils::error::Result<void> RepoCache::loadSnapshot(const api::types::v1::RepoConfig &repoConfig,
+                                                   OstreeRepo &repo) noexcept
+{
+    LINGLONG_TRACE("load repo cache snapshot");
+
+    // a writer removes the cache file of the other format, so states.bin is always preferred when
+    // it exists, no matter which format we are going to write
     std::error_code ec;
-    if (!std::filesystem::exists(repoCache->cacheFile, ec)) {
+    if (std::filesystem::exists(this->binaryCacheFile(), ec)) {
+        // only the header is read here, layers stay in the mapping until they are needed
+        auto mapped = BinaryRepoCache::open(this->binaryCacheFile());
+        if (mapped) {
+            auto metadata = (*mapped)->metadata();
+            if (metadata && metadata->version == "1" && metadata->llVersion == LINGLONG_VERSION) {
+                this->cache = std::move(metadata).value();
+                this->cache.config = repoConfig;
+                this->mapped = std::move(mapped).value();
+                return LINGLONG_OK;
+            }
+        } else {
+            qDebug() << mapped.error();
+        }
+
+        std::cout << "binary cache is invalid or outdated, fallback to json cache..." << std::endl;
+    }
+
+    if (!std::filesystem::exists(this->cacheFile, ec)) {
         if (ec) {
             std::string error = "checking file existence failed: " + ec.message();
             return LINGLONG_ERR(error.c_str());
         }
 
-        auto ret = repoCache->rebuildCache(repoConfig, repo);
-        if (!ret) {
-            return LINGLONG_ERR(ret);
-        }
-        return repoCache;
+        return this->rebuildCache(repoConfig, repo);
     }
 
     auto result = utils::serialize::LoadJSONFile<api::types::v1::RepositoryCache>(
-      QString::fromStdString(repoCache->cacheFile.string()));
+      QString::fromStdString(this->cacheFile.string()));
     if (!result) {
         std::cout << "invalid cache file, rebuild cache..." << std::endl;
-        auto ret = repoCache->rebuildCache(repoConfig, repo);
-        if (!ret) {
-            return LINGLONG_ERR(ret);
-        }
-        return repoCache;
+        return this->rebuildCache(repoConfig, repo);
     }
 
-    repoCache->cache = std::move(result).value();
-    if (repoCache->cache.version != "1" || repoCache->cache.llVersion != LINGLONG_VERSION) {
+    this->cache = std::move(result).value();
+    if (this->cache.version != "1" || this->cache.llVersion != LINGLONG_VERSION) {
         std::cout << "The existing cache is outdated, rebuild cache..." << std::endl;
-        auto ret = repoCache->rebuildCache(repoConfig, repo);
-        if (!ret) {
-            return LINGLONG_ERR(ret);
-        }
-        return repoCache;
+        return this->rebuildCache(repoConfig, repo);
     }
 
     // update repo config
-    repoCache->cache.config = repoConfig;
-    return repoCache;
+    this->cache.config = repoConfig;
+    this->buildIndex();
+    return LINGLONG_OK;
 }
 
 utils::error::Result<void> RepoCache::rebuildCache(const api::types::v1::RepoConfig &repoConfig,
@@ -76,11 +548,16 @@ utils::error::Result<void> RepoCache::rebuildCache(const api::types::v1::RepoCon
 {
     LINGLONG_TRACE("rebuild repo cache");
 
-    this->cache.llVersion = LINGLONG_VERSION;
-    this->cache.config = repoConfig;
-    this->cache.version = "1";
-    this->cache.migratingStage = std::nullopt;
-    this->cache.layers.clear();
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+
+    // the snapshot written below covers everything, a running compaction must not overwrite it
+    this->waitCompaction();
+
+    // the indexes point into the current layers, which are only replaced once all refs are loaded
+    api::types::v1::RepositoryCache cache;
+    cache.llVersion = LINGLONG_VERSION;
+    cache.config = repoConfig;
+    cache.version = "1";
 
     g_autoptr(GHashTable) refsTable = nullptr;
     g_autoptr(GError) gErr = nullptr;
@@ -102,45 +579,39 @@ utils::error::Result<void> RepoCache::rebuildCache(const api::types::v1::RepoCon
       &refs);
 
     bool refsNeedMigrate{ false };
+    std::vector<std::string_view> validRefs;
+    validRefs.reserve(refs.size());
     for (auto ref : refs) {
-        auto pos = ref.find(':');
-        if (pos == std::string::npos) {
+        if (ref.find(':') == std::string::npos) {
             refsNeedMigrate = true;
             qWarning() << "invalid ref: " << ref.data();
             continue;
         }
 
-        api::types::v1::RepositoryCacheLayersItem item;
-        item.repo = ref.substr(0, pos);
-
-        g_autofree char *commit{ nullptr };
-        g_autoptr(GError) gErr{ nullptr };
-        g_autoptr(GFile) root{ nullptr };
-        if (ostree_repo_read_commit(&repo, ref.data(), &root, &commit, nullptr, &gErr) == FALSE) {
-            return LINGLONG_ERR("ostree_repo_read_commit", gErr);
-        }
-        item.commit = commit;
+        validRefs.emplace_back(ref);
+    }
 
-        // ostree ls --repo repo ref, the file path of info.json is /info.json.
-        g_autoptr(GFile) infoFile = g_file_resolve_relative_path(root, "info.json");
-        auto info = utils::parsePackageInfo(infoFile);
-        if (!info) {
-            return LINGLONG_ERR(info);
-        }
-        item.info = *info;
+    // the order of a hash table is unspecified, sort refs to get the same cache on every rebuild
+    std::sort(validRefs.begin(), validRefs.end());
 
-        this->cache.layers.emplace_back(std::move(item));
+    auto layers = loadLayers(repo, validRefs);
+    if (!layers) {
+        return LINGLONG_ERR(layers);
+    }
+    cache.layers = std::move(layers).value();
+    for (auto &item : loadImageLayers(this->cacheFile.parent_path() / "images")) {
+        cache.layers.emplace_back(std::move(item));
     }
 
     if (refsNeedMigrate) {
-        if (!this->cache.migratingStage) {
-            this->cache.migratingStage = std::vector<int64_t>{};
-        }
-
-        this->cache.migratingStage->emplace_back(
-          static_cast<int64_t>(MigrationStage::RefsWithoutRepo));
+        cache.migratingStage =
+          std::vector<int64_t>{ static_cast<int64_t>(MigrationStage::RefsWithoutRepo) };
     }
 
+    this->cache = std::move(cache);
+    this->mapped.reset();
+    this->buildIndex();
+
     auto ret = writeToDisk();
     if (!ret) {
         return LINGLONG_ERR(ret);
@@ -151,6 +622,8 @@ utils::error::Result<void> RepoCache::rebuildCache(const api::types::v1::RepoCon
 
 std::optional<std::vector<MigrationStage>> RepoCache::migrations() const noexcept
 {
+    std::shared_lock<std::shared_mutex> lock(this->mutex);
+
     if (!cache.migratingStage) {
         return std::nullopt;
     }
@@ -168,28 +641,39 @@ RepoCache::addLayerItem(const api::types::v1::RepositoryCacheLayersItem &item)
 {
     LINGLONG_TRACE("add layer item");
 
-    auto it = std::find_if(
-      cache.layers.begin(),
-      cache.layers.end(),
-      [&item](const api::types::v1::RepositoryCacheLayersItem &val) {
-          return !(item.commit != val.commit || item.repo != val.repo
-                   || item.info.channel != val.info.channel || item.info.id != val.info.id
-                   || item.info.version != val.info.version
-                   || item.info.arch.front() != val.info.arch.front()
-                   || item.info.packageInfoV2Module != val.info.packageInfoV2Module);
-      });
-
-    if (it != cache.layers.end()) {
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+
+    auto ret = this->materialize();
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    if (this->findLayerItem(item)) {
         assert(false);
         return LINGLONG_ERR("item already exist");
     }
 
-    cache.layers.emplace_back(item);
-    auto ret = writeToDisk();
+    // the process changing the repository owns the journal from now on
+    ret = this->journal->lock();
     if (!ret) {
         return LINGLONG_ERR(ret);
     }
 
+    // the record must be durable before the change is visible, unless a batch flushes it later
+    ret = this->journal->append(RepoCacheJournal::Operation::Add, item);
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    if (this->batches == 0) {
+        ret = this->journal->sync();
+        if (!ret) {
+            return LINGLONG_ERR(ret);
+        }
+    }
+
+    this->insertLayer(item);
+    this->startCompaction();
     return LINGLONG_OK;
 }
 
@@ -198,146 +682,427 @@ RepoCache::deleteLayerItem(const api::types::v1::RepositoryCacheLayersItem &item
 {
     LINGLONG_TRACE("delete layer item");
 
-    auto it = std::find_if(
-      cache.layers.begin(),
-      cache.layers.end(),
-      [&item](const api::types::v1::RepositoryCacheLayersItem &val) {
-          return !(item.commit != val.commit || item.repo != val.repo
-                   || item.info.channel != val.info.channel || item.info.id != val.info.id
-                   || item.info.version != val.info.version
-                   || item.info.arch.front() != val.info.arch.front()
-                   || item.info.packageInfoV2Module != val.info.packageInfoV2Module);
-      });
-
-    if (it == cache.layers.end()) {
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+
+    auto ret = this->materialize();
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    auto pos = this->findLayerItem(item);
+    if (!pos) {
         assert(false);
         return LINGLONG_ERR("item doesn't exist");
     }
 
-    cache.layers.erase(it);
-    auto ret = writeToDisk();
+    ret = this->journal->lock();
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    ret = this->journal->append(RepoCacheJournal::Operation::Delete, item);
     if (!ret) {
         return LINGLONG_ERR(ret);
     }
 
+    if (this->batches == 0) {
+        ret = this->journal->sync();
+        if (!ret) {
+            return LINGLONG_ERR(ret);
+        }
+    }
+
+    this->eraseLayer(*pos);
+    this->startCompaction();
     return LINGLONG_OK;
 }
 
 std::vector<api::types::v1::RepositoryCacheLayersItem>
 RepoCache::queryLayerItem(const repoCacheQuery &query) const noexcept
 {
-    using itemRef = std::reference_wrapper<const api::types::v1::RepositoryCacheLayersItem>;
-    std::vector<itemRef> layers_view;
-    for (const auto &layer : cache.layers) {
-        if (query.id && query.id.value() != layer.info.id) {
-            continue;
-        }
+    std::shared_lock<std::shared_mutex> lock(this->mutex);
 
-        if (query.repo && query.repo.value() != layer.repo) {
-            continue;
+    if (this->mapped) {
+        std::vector<std::pair<package::PackedVersion, api::types::v1::RepositoryCacheLayersItem>>
+          found;
+        for (auto &item : this->mapped->query(query)) {
+            auto version = packVersion(item.info.version);
+            found.emplace_back(version, std::move(item));
         }
+        std::sort(found.begin(), found.end(), newerLayer);
 
-        if (query.channel && query.channel.value() != layer.info.channel) {
-            continue;
+        std::vector<api::types::v1::RepositoryCacheLayersItem> items;
+        items.reserve(found.size());
+        for (auto &[version, item] : found) {
+            items.emplace_back(std::move(item));
         }
+        return items;
+    }
 
-        if (query.version && query.version.value() != layer.info.version) {
-            continue;
-        }
+    // positions of the matching layers along with their versions
+    std::vector<std::pair<package::PackedVersion, std::size_t>> found;
 
-        if (query.module && query.module.value() != layer.info.packageInfoV2Module) {
-            continue;
-        }
+    // pick the most selective index which could be used by this query, candidates from the index
+    // still have to be checked against the whole query
+    const layerIndex *index{ nullptr };
+    std::string key;
+    if (query.id && query.channel && query.version && query.module) {
+        index = &this->refIndex;
+        key = refIndexKey(*query.id, *query.channel, *query.version, *query.module);
+    } else if (query.uuid) {
+        index = &this->uuidIndex;
+        key = *query.uuid;
+    } else if (query.id) {
+        index = &this->idIndex;
+        key = *query.id;
+    }
 
-        if (query.uuid) {
-            if (!layer.info.uuid) {
-                continue;
+    if (index == nullptr) {
+        for (std::size_t pos = 0; pos < cache.layers.size(); ++pos) {
+            if (matchQuery(cache.layers[pos], query)) {
+                found.emplace_back(this->versionKeys[pos], pos);
             }
-
-            if (query.uuid.value() != layer.info.uuid.value()) {
-                continue;
+        }
+    } else if (auto bucket = index->find(key); bucket != index->end()) {
+        found.reserve(bucket->second.size());
+        for (auto pos : bucket->second) {
+            if (matchQuery(cache.layers[pos], query)) {
+                found.emplace_back(this->versionKeys[pos], pos);
             }
         }
+    }
+
+    std::sort(found.begin(), found.end(), newerLayer);
 
-        layers_view.emplace_back(layer);
+    std::vector<api::types::v1::RepositoryCacheLayersItem> items;
+    items.reserve(found.size());
+    for (const auto &[version, pos] : found) {
+        items.emplace_back(cache.layers[pos]);
     }
+    return items;
+}
 
-    std::sort(layers_view.begin(), layers_view.end(), [](itemRef lhs, itemRef rhs) {
-        return lhs.get().info.version > rhs.get().info.version;
-    });
+std::vector<api::types::v1::RepositoryCacheLayersItem> RepoCache::queryLayerItem() const noexcept
+{
+    std::shared_lock<std::shared_mutex> lock(this->mutex);
+
+    if (!this->mapped) {
+        return this->cache.layers;
+    }
 
-    return { layers_view.cbegin(), layers_view.cend() };
+    auto layers = this->mapped->layers();
+    if (!layers) {
+        qCritical() << layers.error();
+        return {};
+    }
+
+    return std::move(layers).value();
+}
+
+utils::error::Result<void> RepoCache::materialize() noexcept
+{
+    LINGLONG_TRACE("load layers from binary repo cache");
+
+    if (!this->mapped) {
+        return LINGLONG_OK;
+    }
+
+    auto layers = this->mapped->layers();
+    if (!layers) {
+        return LINGLONG_ERR(layers);
+    }
+
+    this->cache.layers = std::move(layers).value();
+    this->mapped.reset();
+    this->buildIndex();
+    return LINGLONG_OK;
 }
 
 utils::error::Result<void> RepoCache::writeToDisk()
 {
     LINGLONG_TRACE("save repo cache");
 
-    std::error_code ec;
-    if (!std::filesystem::exists(this->cacheFile.parent_path(), ec)) {
-        return LINGLONG_ERR("The parent directory of state.json doesn't exist:"
-                            + QString::fromStdString(ec.message()));
+    this->waitCompaction();
+
+    // Processes only reading the repository, like ll-cli, still convert or rebuild the cache, but
+    // they neither write it while the owner of the journal is running nor keep the lock after.
+    auto owned = this->journal->locked();
+    if (!owned && !this->journal->tryLock()) {
+        qInfo() << "another process is writing" << this->cacheFile.c_str()
+                << ", keep the cache in memory";
+        return LINGLONG_OK;
     }
+    auto unlock = utils::finally::finally([this, owned]() {
+        if (!owned) {
+            this->journal->unlock();
+        }
+    });
 
-    auto ofs = std::ofstream(this->cacheFile, std::ofstream::out | std::ofstream::trunc);
-    if (!ofs.is_open()) { // dump all info
-        auto dumpStatus = [](const std::filesystem::path &p, std::error_code &ec) {
-            LINGLONG_TRACE("dump status")
-            auto status = std::filesystem::status(p, ec);
-            if (ec) {
-                return;
-            }
+    auto ret = writeSnapshot(this->format, this->cacheFile, this->cache);
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
 
-            auto targetPerm = status.permissions();
+    // records left in the journal are replayed idempotently, failing to drop them is harmless
+    ret = this->journal->clear();
+    if (!ret) {
+        qWarning() << ret.error();
+    }
 
-            using std::filesystem::perms;
-            auto out = qInfo().nospace();
-            out << QString::fromStdString(p.string()) << ":";
-            auto show = [&out, targetPerm](char op, perms perm) {
-                out << (perms::none == (perm & targetPerm) ? '-' : op);
-            };
-            show('r', perms::owner_read);
-            show('w', perms::owner_write);
-            show('x', perms::owner_exec);
-            show('r', perms::group_read);
-            show('w', perms::group_write);
-            show('x', perms::group_exec);
-            show('r', perms::others_read);
-            show('w', perms::others_write);
-            show('x', perms::others_exec);
-        };
+    return LINGLONG_OK;
+}
 
-        qInfo() << "process uid:" << ::getuid() << "process gid:" << ::getgid();
+utils::error::Result<void> RepoCache::replayJournal() noexcept
+{
+    LINGLONG_TRACE("replay repo cache journal");
 
-        dumpStatus(this->cacheFile.parent_path(), ec);
-        if (ec) {
-            QString msg = "get status of directory"
-              + QString::fromStdString(this->cacheFile.parent_path())
-              + "error:" + QString::fromStdString(ec.message());
-            return LINGLONG_ERR(msg);
-        }
+    auto records = this->journal->read();
+    if (!records) {
+        return LINGLONG_ERR(records);
+    }
 
-        if (std::filesystem::exists(this->cacheFile, ec)) {
-            dumpStatus(this->cacheFile, ec);
-            if (ec) {
-                QString msg = "get status of file"
-                  + QString::fromStdString(this->cacheFile.string())
-                  + "error:" + QString::fromStdString(ec.message());
-                return LINGLONG_ERR(msg);
-            }
+    if (records->empty()) {
+        return LINGLONG_OK;
+    }
+
+    auto ret = this->materialize();
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    for (const auto &record : *records) {
+        auto pos = this->findLayerItem(record.layer);
+        if (record.operation == RepoCacheJournal::Operation::Add && !pos) {
+            this->insertLayer(record.layer);
+        } else if (record.operation == RepoCacheJournal::Operation::Delete && pos) {
+            this->eraseLayer(*pos);
         }
+    }
 
-        if (ec) {
-            QString msg = "check file" + QString::fromStdString(this->cacheFile.string())
-              + "exist error:" + QString::fromStdString(ec.message());
-            return LINGLONG_ERR(msg);
+    this->startCompaction();
+    return LINGLONG_OK;
+}
+
+void RepoCache::startCompaction() noexcept
+{
+    // only the process changing the repository compacts the journal, readers replaying it at
+    // startup leave it alone
+    if (!this->journal->locked() || this->journal->size() < compactionThreshold) {
+        return;
+    }
+
+    if (this->compaction.valid()) {
+        if (this->compaction.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            // records appended meanwhile are left to the next compaction
+            return;
         }
+        this->waitCompaction();
+    }
+
+    // records appended from now on go to a new journal, the rotated one is dropped once the
+    // snapshot covering it is durable
+    auto rotated = this->journal->rotate();
+    if (!rotated) {
+        qWarning() << rotated.error();
+        return;
+    }
+
+    try {
+        this->compaction =
+          std::async(std::launch::async,
+                     [format = this->format,
+                      cacheFile = this->cacheFile,
+                      cache = this->cache,
+                      rotated = std::move(rotated).value()]() -> utils::error::Result<void> {
+                         LINGLONG_TRACE("compact repo cache journal");
+
+                         auto ret = writeSnapshot(format, cacheFile, cache);
+                         if (!ret) {
+                             return LINGLONG_ERR(ret);
+                         }
+
+                         if (rotated) {
+                             std::error_code ec;
+                             std::filesystem::remove(*rotated, ec);
+                             if (ec) {
+                                 return LINGLONG_ERR(ec.message().c_str());
+                             }
+                         }
+
+                         return LINGLONG_OK;
+                     });
+    } catch (const std::exception &e) {
+        // the rotated journal is kept and replayed, so this only delays the compaction
+        qWarning() << "failed to start compaction of repo cache:" << e.what();
+    }
+}
+
+void RepoCache::waitCompaction() noexcept
+{
+    if (!this->compaction.valid()) {
+        return;
+    }
+
+    auto ret = this->compaction.get();
+    if (!ret) {
+        qWarning() << ret.error();
+    }
+}
+
+void RepoCache::beginBatch() noexcept
+{
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+    ++this->batches;
+}
+
+utils::error::Result<void> RepoCache::endBatch() noexcept
+{
+    LINGLONG_TRACE("end batch of repo cache");
+
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+    --this->batches;
+
+    // nothing was appended by this process if it doesn't own the journal
+    if (!this->journal || !this->journal->locked()) {
+        return LINGLONG_OK;
     }
 
-    auto data = nlohmann::json(this->cache).dump();
-    ofs << data;
+    auto ret = this->journal->sync();
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
 
     return LINGLONG_OK;
 }
 
+void RepoCache::insertLayer(const api::types::v1::RepositoryCacheLayersItem &item) noexcept
+{
+    cache.layers.emplace_back(item);
+    this->versionKeys.emplace_back(packVersion(item.info.version));
+    this->indexLayer(cache.layers.size() - 1);
+}
+
+void RepoCache::eraseLayer(std::size_t pos) noexcept
+{
+    // swap the last layer into the hole, so only one item has to be re-indexed
+    auto last = cache.layers.size() - 1;
+    this->unindexLayer(pos);
+    if (pos != last) {
+        this->relocateLayer(last, pos);
+        cache.layers[pos] = std::move(cache.layers[last]);
+        this->versionKeys[pos] = this->versionKeys[last];
+    }
+    cache.layers.pop_back();
+    this->versionKeys.pop_back();
+}
+
+std::filesystem::path RepoCache::binaryCacheFile() const noexcept
+{
+    return binaryCacheFileOf(this->cacheFile);
+}
+
+void RepoCache::buildIndex() noexcept
+{
+    this->idIndex.clear();
+    this->refIndex.clear();
+    this->uuidIndex.clear();
+    this->versionKeys.clear();
+    this->versionKeys.reserve(cache.layers.size());
+
+    for (std::size_t pos = 0; pos < cache.layers.size(); ++pos) {
+        this->versionKeys.emplace_back(packVersion(cache.layers[pos].info.version));
+        this->indexLayer(pos);
+    }
+}
+
+void RepoCache::indexLayer(std::size_t pos) noexcept
+{
+    const auto &layer = cache.layers[pos];
+    this->idIndex[layer.info.id].emplace_back(pos);
+    this->refIndex[refIndexKey(layer.info.id,
+                               layer.info.channel,
+                               layer.info.version,
+                               layer.info.packageInfoV2Module)]
+      .emplace_back(pos);
+    if (layer.info.uuid) {
+        this->uuidIndex[*layer.info.uuid].emplace_back(pos);
+    }
+}
+
+void RepoCache::unindexLayer(std::size_t pos) noexcept
+{
+    const auto &layer = cache.layers[pos];
+    replaceInIndex(this->idIndex, layer.info.id, pos, std::nullopt);
+    replaceInIndex(this->refIndex,
+                   refIndexKey(layer.info.id,
+                               layer.info.channel,
+                               layer.info.version,
+                               layer.info.packageInfoV2Module),
+                   pos,
+                   std::nullopt);
+    if (layer.info.uuid) {
+        replaceInIndex(this->uuidIndex, *layer.info.uuid, pos, std::nullopt);
+    }
+}
+
+void RepoCache::relocateLayer(std::size_t from, std::size_t to) noexcept
+{
+    const auto &layer = cache.layers[from];
+    replaceInIndex(this->idIndex, layer.info.id, from, to);
+    replaceInIndex(this->refIndex,
+                   refIndexKey(layer.info.id,
+                               layer.info.channel,
+                               layer.info.version,
+                               layer.info.packageInfoV2Module),
+                   from,
+                   to);
+    if (layer.info.uuid) {
+        replaceInIndex(this->uuidIndex, *layer.info.uuid, from, to);
+    }
+}
+
+std::optional<std::size_t>
+RepoCache::findLayerItem(const api::types::v1::RepositoryCacheLayersItem &item) const noexcept
+{
+    auto bucket = this->refIndex.find(refIndexKey(item.info.id,
+                                                  item.info.channel,
+                                                  item.info.version,
+                                                  item.info.packageInfoV2Module));
+    if (bucket == this->refIndex.end()) {
+        return std::nullopt;
+    }
+
+    for (auto pos : bucket->second) {
+        if (isSameLayerItem(item, cache.layers[pos])) {
+            return pos;
+        }
+    }
+
+    return std::nullopt;
+}
+
+RepoCacheBatch::RepoCacheBatch(RepoCache &cache) noexcept
+    : cache(&cache)
+{
+    this->cache->beginBatch();
+}
+
+RepoCacheBatch::~RepoCacheBatch()
+{
+    auto ret = this->end();
+    if (!ret) {
+        qWarning() << ret.error();
+    }
+}
+
+utils::error::Result<void> RepoCacheBatch::end() noexcept
+{
+    if (this->cache == nullptr) {
+        return LINGLONG_OK;
+    }
+
+    auto *cache = std::exchange(this->cache, nullptr);
+    return cache->endBatch();
+}
+
 } // namespace linglong::repo
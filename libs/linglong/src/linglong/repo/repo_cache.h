@@ -9,11 +9,16 @@
 #include "linglong/api/types/v1/RepoConfig.hpp"
 #include "linglong/api/types/v1/RepositoryCache.hpp"
 #include "linglong/package/architecture.h"
+#include "linglong/package/version.h"
+#include "linglong/repo/repo_cache_journal.h"
 #include "linglong/utils/error/error.h"
 
 #include <ostree.h>
 
 #include <filesystem>
+#include <future>
+#include <shared_mutex>
+#include <unordered_map>
 
 namespace linglong::repo {
 
@@ -39,6 +44,15 @@ struct repoCacheQuery
 
 enum class MigrationStage : int64_t { RefsWithoutRepo };
 
+// JSON stores the cache in states.json, Binary stores it in states.bin which is read through mmap
+// and leaves states.json as a debug view only.
+enum class RepoCacheFormat { JSON, Binary };
+
+class BinaryRepoCache;
+class RepoCacheBatch;
+
+// All public methods of RepoCache could be called from multiple threads, mutations are serialized
+// while queries run in parallel.
 class RepoCache
 {
 public:
@@ -46,12 +60,13 @@ public:
     RepoCache &operator=(const RepoCache &) = delete;
     RepoCache(RepoCache &&other) = delete;
     RepoCache &operator=(RepoCache &&other) = delete;
-    ~RepoCache() = default;
+    ~RepoCache();
 
     static utils::error::Result<std::unique_ptr<RepoCache>>
     create(const std::filesystem::path &cacheFile,
            const api::types::v1::RepoConfig &repoConfig,
-           OstreeRepo &repo);
+           OstreeRepo &repo,
+           RepoCacheFormat format = RepoCacheFormat::JSON);
     utils::error::Result<void> addLayerItem(const api::types::v1::RepositoryCacheLayersItem &item);
     utils::error::Result<void>
     deleteLayerItem(const api::types::v1::RepositoryCacheLayersItem &item) noexcept;
@@ -61,20 +76,74 @@ public:
     [[nodiscard]] std::vector<api::types::v1::RepositoryCacheLayersItem>
     queryLayerItem(const repoCacheQuery &query) const noexcept;
 
-    [[nodiscard]] const std::vector<api::types::v1::RepositoryCacheLayersItem> &
-    queryLayerItem() const noexcept
-    {
-        return this->cache.layers;
-    }
+    [[nodiscard]] std::vector<api::types::v1::RepositoryCacheLayersItem>
+    queryLayerItem() const noexcept;
 
     utils::error::Result<void> rebuildCache(const api::types::v1::RepoConfig &repoConfig,
                                             OstreeRepo &repo) noexcept;
     [[nodiscard]] std::optional<std::vector<MigrationStage>> migrations() const noexcept;
 
 private:
+    friend class RepoCacheBatch;
+
+    // maps a key to the positions of matching layers in cache.layers
+    using layerIndex = std::unordered_map<std::string, std::vector<std::size_t>>;
+
     RepoCache() = default;
+    utils::error::Result<void> loadSnapshot(const api::types::v1::RepoConfig &repoConfig,
+                                            OstreeRepo &repo) noexcept;
     utils::error::Result<void> writeToDisk();
+    utils::error::Result<void> materialize() noexcept;
+    utils::error::Result<void> replayJournal() noexcept;
+    void startCompaction() noexcept;
+    void waitCompaction() noexcept;
+    void beginBatch() noexcept;
+    utils::error::Result<void> endBatch() noexcept;
+    [[nodiscard]] std::filesystem::path binaryCacheFile() const noexcept;
+    void insertLayer(const api::types::v1::RepositoryCacheLayersItem &item) noexcept;
+    void eraseLayer(std::size_t pos) noexcept;
+    void buildIndex() noexcept;
+    void indexLayer(std::size_t pos) noexcept;
+    void unindexLayer(std::size_t pos) noexcept;
+    void relocateLayer(std::size_t from, std::size_t to) noexcept;
+    [[nodiscard]] std::optional<std::size_t>
+    findLayerItem(const api::types::v1::RepositoryCacheLayersItem &item) const noexcept;
+
     api::types::v1::RepositoryCache cache;
     std::filesystem::path cacheFile;
+    RepoCacheFormat format{ RepoCacheFormat::JSON };
+    // layers are left in the mapped file until the first mutation
+    std::unique_ptr<BinaryRepoCache> mapped;
+    // mutations since the last snapshot, which is rewritten in background once it grows too long
+    std::unique_ptr<RepoCacheJournal> journal;
+    std::future<utils::error::Result<void>> compaction;
+    // the number of open batches, the journal is synced by each mutation only if it's zero
+    std::size_t batches{ 0 };
+    mutable std::shared_mutex mutex;
+    layerIndex idIndex;
+    layerIndex refIndex; // keyed on (id, channel, version, module)
+    layerIndex uuidIndex;
+    // the packed info.version of each layer in cache.layers, so queries are sorted without parsing
+    std::vector<package::PackedVersion> versionKeys;
+};
+
+// Layers added to or deleted from the cache while a batch is open share a single flush of the
+// journal when the batch ends, instead of flushing it once per layer. Batches may overlap, e.g.
+// in concurrent tasks, each of them flushes all records appended so far when it ends.
+class RepoCacheBatch
+{
+public:
+    explicit RepoCacheBatch(RepoCache &cache) noexcept;
+    RepoCacheBatch(const RepoCacheBatch &) = delete;
+    RepoCacheBatch &operator=(const RepoCacheBatch &) = delete;
+    RepoCacheBatch(RepoCacheBatch &&other) = delete;
+    RepoCacheBatch &operator=(RepoCacheBatch &&other) = delete;
+    ~RepoCacheBatch();
+
+    // the batch ends on destruction otherwise, failures are only logged then
+    utils::error::Result<void> end() noexcept;
+
+private:
+    RepoCache *cache;
 };
 } // namespace linglong::repo
@@ -0,0 +1,374 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "repo_cache_journal.h"
+
+#include "linglong/api/types/v1/Generators.hpp"
+#include "linglong/utils/finally/finally.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace linglong::repo {
+
+namespace {
+
+// parses all complete lines of a journal file, returns the length of them
+utils::error::Result<std::size_t> readJournal(const std::filesystem::path &file,
+                                              std::vector<RepoCacheJournal::Record> &records)
+{
+    LINGLONG_TRACE(QString("read journal %1").arg(file.c_str()));
+
+    std::error_code ec;
+    if (!std::filesystem::exists(file, ec)) {
+        if (ec) {
+            return LINGLONG_ERR(ec.message().c_str());
+        }
+
+        return 0;
+    }
+
+    std::ifstream ifs(file, std::ios::binary);
+    if (!ifs.is_open()) {
+        return LINGLONG_ERR("couldn't open file");
+    }
+
+    std::stringstream buffer;
+    buffer << ifs.rdbuf();
+    auto content = buffer.str();
+
+    std::size_t begin{ 0 };
+    for (auto end = content.find('\n'); end != std::string::npos;
+         begin = end + 1, end = content.find('\n', begin)) {
+        try {
+            auto line = nlohmann::json::parse(content.begin() + begin, content.begin() + end);
+            auto operation = line.at("op").get<std::string>();
+            if (operation != "add" && operation != "delete") {
+                return LINGLONG_ERR(QString("unknown operation %1").arg(operation.c_str()));
+            }
+
+            records.emplace_back(RepoCacheJournal::Record{
+              operation == "add" ? RepoCacheJournal::Operation::Add
+                                 : RepoCacheJournal::Operation::Delete,
+              line.at("layer").get<api::types::v1::RepositoryCacheLayersItem>() });
+        } catch (const std::exception &e) {
+            return LINGLONG_ERR(e);
+        }
+    }
+
+    if (begin != content.size()) {
+        qWarning() << "drop torn tail of" << file.c_str();
+    }
+
+    return begin;
+}
+
+} // namespace
+
+RepoCacheJournal::RepoCacheJournal(std::filesystem::path file) noexcept
+    : file(std::move(file))
+{
+    this->rotatedFile = this->file;
+    this->rotatedFile += ".old";
+    this->lockFile = this->file;
+    this->lockFile += ".lock";
+}
+
+RepoCacheJournal::~RepoCacheJournal()
+{
+    this->close();
+    this->unlock();
+}
+
+utils::error::Result<void> RepoCacheJournal::lock() noexcept
+{
+    LINGLONG_TRACE(QString("lock journal %1").arg(this->file.c_str()));
+
+    auto ret = this->acquire(true);
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    return LINGLONG_OK;
+}
+
+bool RepoCacheJournal::tryLock() noexcept
+{
+    auto ret = this->acquire(false);
+    if (!ret) {
+        qDebug() << ret.error();
+        return false;
+    }
+
+    return *ret;
+}
+
+void RepoCacheJournal::unlock() noexcept
+{
+    if (this->lockFd != -1) {
+        // the journal may be changed by the next owner
+        this->close();
+        ::close(this->lockFd);
+        this->lockFd = -1;
+    }
+}
+
+utils::error::Result<bool> RepoCacheJournal::acquire(bool wait) noexcept
+{
+    LINGLONG_TRACE(QString("acquire lock %1").arg(this->lockFile.c_str()));
+
+    if (this->lockFd != -1) {
+        return true;
+    }
+
+    auto fd = ::open(this->lockFile.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return LINGLONG_ERR(QString("open: %1").arg(::strerror(errno)));
+    }
+
+    auto lockFile = [fd](int operation) {
+        int ret{ -1 };
+        do {
+            ret = ::flock(fd, operation);
+        } while (ret == -1 && errno == EINTR);
+        return ret;
+    };
+
+    auto ret = lockFile(LOCK_EX | LOCK_NB);
+    if (ret == -1 && errno == EWOULDBLOCK && wait) {
+        qInfo() << "waiting for another process writing" << this->file.c_str();
+        ret = lockFile(LOCK_EX);
+    }
+    if (ret == -1) {
+        auto err = errno;
+        ::close(fd);
+        if (err == EWOULDBLOCK) {
+            return false;
+        }
+
+        return LINGLONG_ERR(QString("flock: %1").arg(::strerror(err)));
+    }
+
+    // the previous owner may have rotated or cleared the journal, count what is left from scratch
+    this->close();
+    std::vector<Record> current;
+    auto size = readJournal(this->file, current);
+    if (!size) {
+        ::flock(fd, LOCK_UN);
+        ::close(fd);
+        return LINGLONG_ERR(size);
+    }
+
+    this->lockFd = fd;
+    this->records = current.size();
+    this->validSize = *size;
+    return true;
+}
+
+void RepoCacheJournal::close() noexcept
+{
+    if (this->fd != -1) {
+        // the records may still be replayed from this file, e.g. after rotating it
+        auto ret = this->sync();
+        if (!ret) {
+            qWarning() << ret.error();
+        }
+        this->unsynced = false;
+        ::close(this->fd);
+        this->fd = -1;
+    }
+}
+
+utils::error::Result<std::vector<RepoCacheJournal::Record>> RepoCacheJournal::read() noexcept
+{
+    LINGLONG_TRACE("read repo cache journal");
+
+    // NOTE: the journal is read before the rotated one, if a writer rotates the journal in between,
+    // the same records are read twice rather than missed.
+    std::vector<Record> current;
+    auto size = readJournal(this->file, current);
+    if (!size) {
+        return LINGLONG_ERR(size);
+    }
+
+    std::vector<Record> records;
+    auto rotatedSize = readJournal(this->rotatedFile, records);
+    if (!rotatedSize) {
+        return LINGLONG_ERR(rotatedSize);
+    }
+
+    records.insert(records.end(),
+                   std::make_move_iterator(current.begin()),
+                   std::make_move_iterator(current.end()));
+
+    this->records = current.size();
+    this->validSize = *size;
+    return records;
+}
+
+utils::error::Result<void>
+RepoCacheJournal::append(Operation operation,
+                         const api::types::v1::RepositoryCacheLayersItem &layer) noexcept
+{
+    LINGLONG_TRACE(QString("append to journal %1").arg(this->file.c_str()));
+
+    std::string line;
+    try {
+        line = nlohmann::json{ { "op", operation == Operation::Add ? "add" : "delete" },
+                               { "layer", layer } }
+                 .dump()
+          + "\n";
+    } catch (const std::exception &e) {
+        return LINGLONG_ERR(e);
+    }
+
+    if (this->fd == -1) {
+        this->fd = ::open(this->file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (this->fd == -1) {
+            return LINGLONG_ERR(QString("open: %1").arg(::strerror(errno)));
+        }
+
+        struct stat st{};
+        if (::fstat(this->fd, &st) == -1) {
+            return LINGLONG_ERR(QString("fstat: %1").arg(::strerror(errno)));
+        }
+
+        // drop the torn tail left by a crashed writer, or the next record would be glued to it
+        if (static_cast<std::size_t>(st.st_size) != this->validSize
+            && ::ftruncate(this->fd, static_cast<off_t>(this->validSize)) == -1) {
+            return LINGLONG_ERR(QString("ftruncate: %1").arg(::strerror(errno)));
+        }
+
+        if (st.st_size == 0) {
+            auto ret = syncDirectory(this->file.parent_path());
+            if (!ret) {
+                return LINGLONG_ERR(ret);
+            }
+        }
+    }
+
+    std::size_t written{ 0 };
+    while (written < line.size()) {
+        auto ret = ::write(this->fd, line.data() + written, line.size() - written);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            auto err = QString("write: %1").arg(::strerror(errno));
+            // a partial record would be dropped as a torn tail on the next read
+            if (::ftruncate(this->fd, static_cast<off_t>(this->validSize)) == -1) {
+                qWarning() << "failed to truncate" << this->file.c_str() << ::strerror(errno);
+            }
+            return LINGLONG_ERR(err);
+        }
+
+        written += ret;
+    }
+
+    ++this->records;
+    this->validSize += line.size();
+    this->unsynced = true;
+    return LINGLONG_OK;
+}
+
+utils::error::Result<void> RepoCacheJournal::sync() noexcept
+{
+    LINGLONG_TRACE(QString("sync journal %1").arg(this->file.c_str()));
+
+    if (this->fd == -1 || !this->unsynced) {
+        return LINGLONG_OK;
+    }
+
+    if (::fdatasync(this->fd) == -1) {
+        return LINGLONG_ERR(QString("fdatasync: %1").arg(::strerror(errno)));
+    }
+
+    this->unsynced = false;
+    return LINGLONG_OK;
+}
+
+utils::error::Result<std::optional<std::filesystem::path>> RepoCacheJournal::rotate() noexcept
+{
+    LINGLONG_TRACE(QString("rotate journal %1").arg(this->file.c_str()));
+
+    this->close();
+
+    // The last compaction failed, the rotated journal is still there and will be covered by the
+    // next snapshot as well, keep appending to the current one. Its records are covered by that
+    // snapshot too and replaying them again is harmless, so they aren't counted any more.
+    std::error_code ec;
+    if (std::filesystem::exists(this->rotatedFile, ec)) {
+        this->records = 0;
+        return this->rotatedFile;
+    }
+    if (ec) {
+        return LINGLONG_ERR(ec.message().c_str());
+    }
+
+    if (!std::filesystem::exists(this->file, ec)) {
+        if (ec) {
+            return LINGLONG_ERR(ec.message().c_str());
+        }
+
+        return std::nullopt;
+    }
+
+    std::filesystem::rename(this->file, this->rotatedFile, ec);
+    if (ec) {
+        return LINGLONG_ERR(ec.message().c_str());
+    }
+
+    this->records = 0;
+    this->validSize = 0;
+    return this->rotatedFile;
+}
+
+utils::error::Result<void> RepoCacheJournal::clear() noexcept
+{
+    LINGLONG_TRACE(QString("clear journal %1").arg(this->file.c_str()));
+
+    this->close();
+
+    for (const auto &path : { this->file, this->rotatedFile }) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        if (ec) {
+            return LINGLONG_ERR(ec.message().c_str());
+        }
+    }
+
+    this->records = 0;
+    this->validSize = 0;
+    return LINGLONG_OK;
+}
+
+utils::error::Result<void> syncDirectory(const std::filesystem::path &dir) noexcept
+{
+    LINGLONG_TRACE(QString("sync directory %1").arg(dir.c_str()));
+
+    auto fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return LINGLONG_ERR(QString("open: %1").arg(::strerror(errno)));
+    }
+    auto closeFd = utils::finally::finally([fd]() {
+        ::close(fd);
+    });
+
+    if (::fsync(fd) == -1) {
+        return LINGLONG_ERR(QString("fsync: %1").arg(::strerror(errno)));
+    }
+
+    return LINGLONG_OK;
+}
+
+} // namespace linglong::repo
@@ -0,0 +1,86 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "linglong/api/types/v1/RepositoryCacheLayersItem.hpp"
+#include "linglong/utils/error/error.h"
+
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+namespace linglong::repo {
+
+// RepoCacheJournal is an append-only log of the layer items added to or deleted from RepoCache
+// since the last snapshot. Each record is a json object on its own line, a line which isn't
+// terminated by '\n' is a torn write and will be dropped.
+//
+// Replaying a record is idempotent: adding an existing item or deleting a missing one does
+// nothing. So replaying records which are already part of the snapshot is harmless, the last
+// record of each item always wins.
+//
+// The journal and the snapshot are shared by all processes opening the repository, but only the
+// process holding the lock of the journal may append, rotate or clear it, or write a snapshot.
+class RepoCacheJournal
+{
+public:
+    enum class Operation { Add, Delete };
+
+    struct Record
+    {
+        Operation operation;
+        api::types::v1::RepositoryCacheLayersItem layer;
+    };
+
+    explicit RepoCacheJournal(std::filesystem::path file) noexcept;
+    RepoCacheJournal(const RepoCacheJournal &) = delete;
+    RepoCacheJournal &operator=(const RepoCacheJournal &) = delete;
+    RepoCacheJournal(RepoCacheJournal &&other) = delete;
+    RepoCacheJournal &operator=(RepoCacheJournal &&other) = delete;
+    ~RepoCacheJournal();
+
+    // Takes the lock of the journal, which is held until unlock() or destruction. The journal may
+    // have been rotated or cleared by the previous owner, so it's reopened afterwards.
+    utils::error::Result<void> lock() noexcept;
+    // like lock(), but returns false at once if another process holds the lock
+    bool tryLock() noexcept;
+    void unlock() noexcept;
+
+    [[nodiscard]] bool locked() const noexcept { return this->lockFd != -1; }
+
+    // records of the rotated journal come first
+    utils::error::Result<std::vector<Record>> read() noexcept;
+    // Appended records aren't durable until sync(), so several of them could share one flush.
+    utils::error::Result<void>
+    append(Operation operation, const api::types::v1::RepositoryCacheLayersItem &layer) noexcept;
+    utils::error::Result<void> sync() noexcept;
+    // Moves the records to the rotated journal and starts a new one. The returned file should be
+    // removed once a snapshot covering it has been written.
+    utils::error::Result<std::optional<std::filesystem::path>> rotate() noexcept;
+    utils::error::Result<void> clear() noexcept;
+
+    [[nodiscard]] std::size_t size() const noexcept { return this->records; }
+
+private:
+    void close() noexcept;
+    utils::error::Result<bool> acquire(bool wait) noexcept;
+
+    std::filesystem::path file;
+    std::filesystem::path rotatedFile;
+    std::filesystem::path lockFile;
+    int fd{ -1 };
+    int lockFd{ -1 };
+    std::size_t records{ 0 };
+    // records were appended since the last sync
+    bool unsynced{ false };
+    // the length of the journal without a torn tail
+    std::size_t validSize{ 0 };
+};
+
+utils::error::Result<void> syncDirectory(const std::filesystem::path &dir) noexcept;
+
+} // namespace linglong::repo
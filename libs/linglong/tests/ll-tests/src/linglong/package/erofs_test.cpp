@@ -0,0 +1,223 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/package/erofs.h"
+
+#include "linglong/utils/command/env.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace linglong::package;
+
+TEST(Erofs, ValidateCompression)
+{
+    for (const auto *compression : { "lz4", "lz4hc", "lz4hc,9", "lzma,6", "zstd", "zstd,15" }) {
+        EXPECT_TRUE(validateErofsCompression(compression).has_value()) << compression;
+    }
+
+    for (const auto *compression : { "", "gzip", "zstd,", "zstd,high", "lz4hc,9,1", ",9" }) {
+        EXPECT_FALSE(validateErofsCompression(compression).has_value()) << compression;
+    }
+}
+
+TEST(Erofs, Mkfs)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir source(tmp.filePath("source"));
+    ASSERT_TRUE(source.mkpath("."));
+    QFile file(source.filePath("file"));
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    ASSERT_EQ(file.write("erofs\n"), 6);
+    file.close();
+
+    // an invalid compression is rejected before mkfs.erofs is run
+    auto image = tmp.filePath("image.erofs");
+    EXPECT_FALSE(mkfsErofs(image, source.absolutePath(), { "gzip", 1 }).has_value());
+    EXPECT_FALSE(QFileInfo::exists(image));
+
+    if (QStandardPaths::findExecutable("mkfs.erofs").isEmpty()) {
+        GTEST_SKIP() << "mkfs.erofs is not installed";
+    }
+
+    auto ret = mkfsErofs(image, source.absolutePath(), { "lz4", 1 });
+    ASSERT_TRUE(ret.has_value()) << ret.error().message().toStdString();
+    EXPECT_GT(QFileInfo(image).size(), 0);
+}
+
+// Benchmarks are disabled by default, run them with
+// ll-tests --gtest_also_run_disabled_tests --gtest_filter='Erofs.*Benchmark'
+TEST(Erofs, DISABLED_CompressionBenchmark)
+{
+    if (QStandardPaths::findExecutable("mkfs.erofs").isEmpty()) {
+        GTEST_SKIP() << "mkfs.erofs is not installed";
+    }
+
+    // text like content compresses like the binaries and resources of applications
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir source(tmp.filePath("source"));
+    ASSERT_TRUE(source.mkpath("."));
+    qint64 sourceSize{ 0 };
+    for (int i = 0; i < 64; ++i) {
+        QByteArray data;
+        for (int line = 0; data.size() < 1024 * 1024; ++line) {
+            auto text = QString{ "file %1 line %2 value %3\n" }.arg(i).arg(line).arg(line * i % 97);
+            data.append(text.toUtf8());
+        }
+        QFile file(source.filePath(QString::number(i)));
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        ASSERT_EQ(file.write(data), data.size());
+        sourceSize += data.size();
+    }
+
+    const auto cores = std::max(std::thread::hardware_concurrency(), 1U);
+    std::cout << "compression, workers, seconds, size of " << sourceSize << " bytes" << std::endl;
+    for (const auto *compression : { "lz4", "lz4hc,9", "lzma,6", "zstd,3", "zstd,15" }) {
+        for (auto workers : { 1U, cores }) {
+            auto image = tmp.filePath("image.erofs");
+            QFile::remove(image);
+
+            auto start = std::chrono::steady_clock::now();
+            auto ret = mkfsErofs(image, source.absolutePath(), { compression, workers });
+            auto duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+            if (!ret) {
+                // the compressor isn't built into this mkfs.erofs
+                std::cout << compression << ", " << workers << ", unsupported" << std::endl;
+                continue;
+            }
+
+            std::cout << compression << ", " << workers << ", " << duration.count() << ", "
+                      << QFileInfo(image).size() << std::endl;
+        }
+    }
+}
+
+TEST(Erofs, MountWithLoop)
+{
+    if (::geteuid() != 0 || !QFileInfo::exists("/dev/loop-control")
+        || QStandardPaths::findExecutable("mkfs.erofs").isEmpty()) {
+        GTEST_SKIP() << "root, loop devices and mkfs.erofs are required";
+    }
+
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir source(tmp.filePath("source"));
+    ASSERT_TRUE(source.mkpath("."));
+    QFile content(source.filePath("file"));
+    ASSERT_TRUE(content.open(QIODevice::WriteOnly));
+    ASSERT_EQ(content.write("erofs\n"), 6);
+    content.close();
+
+    // the image is put behind some data, like the bundle in an uab or the image in a layer file
+    constexpr int offset = 4096;
+    auto image = tmp.filePath("image.erofs");
+    ASSERT_TRUE(mkfsErofs(image, source.absolutePath(), {}).has_value());
+    QFile imageFile(image);
+    ASSERT_TRUE(imageFile.open(QIODevice::ReadOnly));
+    QFile file(tmp.filePath("file"));
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    ASSERT_EQ(file.write(QByteArray(offset, 'x') + imageFile.readAll()),
+              offset + imageFile.size());
+    file.close();
+
+    auto mountPoint = tmp.filePath("mount");
+    ASSERT_TRUE(QDir().mkpath(mountPoint));
+    auto ret = mountErofsWithLoop(file.fileName(), offset, 0, mountPoint);
+    ASSERT_TRUE(ret.has_value()) << ret.error().message().toStdString();
+    QFile mounted(QDir(mountPoint).filePath("file"));
+    EXPECT_TRUE(mounted.open(QIODevice::ReadOnly));
+    EXPECT_EQ(mounted.readAll(), "erofs\n");
+    mounted.close();
+    EXPECT_TRUE(linglong::utils::command::Exec("umount", { mountPoint }).has_value());
+}
+
+TEST(Erofs, DISABLED_MountBenchmark)
+{
+    if (::geteuid() != 0 || !QFileInfo::exists("/dev/loop-control")
+        || QStandardPaths::findExecutable("mkfs.erofs").isEmpty()
+        || QStandardPaths::findExecutable("erofsfuse").isEmpty()) {
+        GTEST_SKIP() << "root, loop devices, mkfs.erofs and erofsfuse are required";
+    }
+
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir source(tmp.filePath("source"));
+    ASSERT_TRUE(source.mkpath("."));
+    for (int i = 0; i < 32; ++i) {
+        QFile file(source.filePath(QString::number(i)));
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        ASSERT_EQ(file.write(QByteArray(4 * 1024 * 1024, static_cast<char>('a' + i % 26))),
+                  4 * 1024 * 1024);
+    }
+
+    // the image is put behind some data, like the bundle in an uab or the image in a layer file
+    constexpr int offset = 4096;
+    auto image = tmp.filePath("image.erofs");
+    ASSERT_TRUE(mkfsErofs(image, source.absolutePath(), {}).has_value());
+    QFile imageFile(image);
+    ASSERT_TRUE(imageFile.open(QIODevice::ReadOnly));
+    QFile file(tmp.filePath("file"));
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    ASSERT_EQ(file.write(QByteArray(offset, 'x') + imageFile.readAll()),
+              offset + imageFile.size());
+    file.close();
+
+    auto readAll = [](const QString &dir) {
+        qint64 total{ 0 };
+        QDirIterator it(dir, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            QFile file(it.next());
+            if (!file.open(QIODevice::ReadOnly)) {
+                return qint64{ -1 };
+            }
+            total += file.readAll().size();
+        }
+        return total;
+    };
+
+    auto mountPoint = tmp.filePath("mount");
+    ASSERT_TRUE(QDir().mkpath(mountPoint));
+    auto measure = [&](auto &&mount) {
+        if (!mount()) {
+            return -1.0;
+        }
+        auto start = std::chrono::steady_clock::now();
+        auto size = readAll(mountPoint);
+        auto duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+        EXPECT_TRUE(linglong::utils::command::Exec("umount", { mountPoint }).has_value());
+        EXPECT_EQ(size, 32 * 4 * 1024 * 1024);
+        return static_cast<double>(size) / duration.count() / (1 << 20);
+    };
+
+    auto kernel = measure([&]() {
+        auto ret = mountErofsWithLoop(file.fileName(), offset, 0, mountPoint);
+        EXPECT_TRUE(ret.has_value()) << ret.error().message().toStdString();
+        return ret.has_value();
+    });
+    auto fuse = measure([&]() {
+        auto ret = linglong::utils::command::Exec(
+          "erofsfuse",
+          { QString{ "--offset=%1" }.arg(offset), file.fileName(), mountPoint });
+        EXPECT_TRUE(ret.has_value());
+        return ret.has_value();
+    });
+    std::cout << "read 128MiB: kernel erofs " << kernel << "MiB/s, erofsfuse " << fuse << "MiB/s"
+              << std::endl;
+}
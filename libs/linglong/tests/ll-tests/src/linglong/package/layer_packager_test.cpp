@@ -0,0 +1,70 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/api/types/v1/Generators.hpp"
+#include "linglong/package/layer_packager.h"
+
+#include <QFile>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+
+using namespace linglong::package;
+
+TEST(LayerPackager, Pack)
+{
+    if (QStandardPaths::findExecutable("mkfs.erofs").isEmpty()) {
+        GTEST_SKIP() << "mkfs.erofs is not installed";
+    }
+
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir root(tmp.path());
+    ASSERT_TRUE(root.mkpath("layer/files/bin"));
+
+    linglong::api::types::v1::PackageInfoV2 info{
+        .arch = { "x86_64" },
+        .channel = "main",
+        .id = "org.deepin.calculator",
+        .kind = "app",
+        .packageInfoV2Module = "binary",
+        .name = "calculator",
+        .version = "1.0.0.0",
+    };
+    QFile infoFile(root.filePath("layer/info.json"));
+    ASSERT_TRUE(infoFile.open(QIODevice::WriteOnly));
+    infoFile.write(QByteArray::fromStdString(nlohmann::json(info).dump()));
+    infoFile.close();
+
+    QFile binary(root.filePath("layer/files/bin/calculator"));
+    ASSERT_TRUE(binary.open(QIODevice::WriteOnly));
+    binary.write(QByteArray(100 * 1024, 'x'));
+    binary.close();
+
+    LayerPackager packager(QDir(root.filePath("work")));
+    auto layerFilePath = root.filePath("calculator.layer");
+    auto layer = packager.pack(LayerDir(root.filePath("layer")), layerFilePath);
+    ASSERT_TRUE(layer.has_value()) << layer.error().message().toStdString();
+
+    // the temporary image next to the layer file is consumed
+    EXPECT_FALSE(QFile::exists(layerFilePath + ".erofs"));
+
+    auto metaInfo = (*layer)->metaInfo();
+    ASSERT_TRUE(metaInfo.has_value()) << metaInfo.error().message().toStdString();
+    EXPECT_EQ(metaInfo->info.get<linglong::api::types::v1::PackageInfoV2>().id, info.id);
+
+    auto offset = (*layer)->binaryDataOffset();
+    ASSERT_TRUE(offset.has_value()) << offset.error().message().toStdString();
+    EXPECT_EQ(*offset % 4096, 0);
+
+    // the erofs super block is at 1024 bytes of the image
+    QFile file(layerFilePath);
+    ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+    ASSERT_TRUE(file.seek(*offset + 1024));
+    auto magic = file.read(4);
+    EXPECT_EQ(magic, QByteArray::fromHex("e2e1f5e0"));
+}
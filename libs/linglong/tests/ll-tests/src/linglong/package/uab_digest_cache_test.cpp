@@ -0,0 +1,91 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/package/uab_digest_cache.h"
+
+#include <QTemporaryDir>
+
+#include <array>
+#include <chrono>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using linglong::package::UABDigestCache;
+
+namespace {
+
+void writeAll(int fd, std::string_view content)
+{
+    ASSERT_EQ(::pwrite(fd, content.data(), content.size(), 0),
+              static_cast<ssize_t>(content.size()));
+}
+
+} // namespace
+
+TEST(UABDigestCache, Verified)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    std::filesystem::path root = dir.path().toStdString();
+    UABDigestCache cache{ root / "cache" };
+
+    auto bundle = root / "demo.uab";
+    auto fd = ::open(bundle.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    ASSERT_NE(fd, -1);
+    writeAll(fd, "bundle content");
+
+    EXPECT_FALSE(cache.contains(fd, "digest"));
+    cache.insert(fd, "digest");
+    EXPECT_TRUE(cache.contains(fd, "digest"));
+    // another expected digest, e.g. the metadata was replaced, is not trusted
+    EXPECT_FALSE(cache.contains(fd, "other"));
+
+    auto reopened = ::open(bundle.c_str(), O_RDONLY | O_CLOEXEC);
+    ASSERT_NE(reopened, -1);
+    EXPECT_TRUE(UABDigestCache{ root / "cache" }.contains(reopened, "digest"));
+    ::close(reopened);
+    ::close(fd);
+}
+
+TEST(UABDigestCache, TamperingInvalidates)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    std::filesystem::path root = dir.path().toStdString();
+    UABDigestCache cache{ root / "cache" };
+
+    auto bundle = root / "demo.uab";
+    auto fd = ::open(bundle.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    ASSERT_NE(fd, -1);
+    writeAll(fd, "bundle content");
+    cache.insert(fd, "digest");
+    ASSERT_TRUE(cache.contains(fd, "digest"));
+
+    struct stat before
+    {
+    };
+
+    ASSERT_EQ(::fstat(fd, &before), 0);
+    // ctime has the granularity of a timer tick
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // same size, and the mtime is restored afterwards, only the ctime tells the change
+    writeAll(fd, "BUNDLE content");
+    std::array<timespec, 2> times{ before.st_atim, before.st_mtim };
+    ASSERT_EQ(::futimens(fd, times.data()), 0);
+    EXPECT_FALSE(cache.contains(fd, "digest"));
+
+    cache.insert(fd, "digest");
+    EXPECT_TRUE(cache.contains(fd, "digest"));
+    ASSERT_EQ(::ftruncate(fd, 4), 0);
+    EXPECT_FALSE(cache.contains(fd, "digest"));
+    ::close(fd);
+}
@@ -0,0 +1,184 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/api/types/v1/Generators.hpp"
+#include "linglong/package/uab_merkle.h"
+
+#include <QCryptographicHash>
+#include <QTemporaryFile>
+
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+using namespace linglong::package;
+
+namespace {
+
+QByteArray content(int size)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i) {
+        data[i] = static_cast<char>(i * 31 + i / 4096);
+    }
+    return data;
+}
+
+} // namespace
+
+TEST(UABMerkle, Chunks)
+{
+    constexpr int chunkSize = 64 * 1024;
+    constexpr int offset = 123; // not aligned to pages, like a section in an ELF file
+    auto data = content(chunkSize * 5 + 17);
+
+    QTemporaryFile file;
+    ASSERT_TRUE(file.open());
+    ASSERT_EQ(file.write(QByteArray(offset, 'x') + data), offset + data.size());
+    ASSERT_TRUE(file.flush());
+
+    auto merkle = calculateMerkle(file.handle(), offset, data.size(), chunkSize, 4);
+    ASSERT_TRUE(merkle.has_value()) << merkle.error().message().toStdString();
+    EXPECT_EQ(merkle->chunkSize, chunkSize);
+    ASSERT_EQ(merkle->chunks.size(), 6);
+
+    QCryptographicHash root{ QCryptographicHash::Sha256 };
+    for (std::size_t i = 0; i < merkle->chunks.size(); ++i) {
+        auto chunk = data.mid(static_cast<int>(i) * chunkSize, chunkSize);
+        auto hash = QCryptographicHash::hash(chunk, QCryptographicHash::Sha256);
+        EXPECT_EQ(merkle->chunks[i], hash.toHex().toStdString()) << "chunk " << i;
+        root.addData(hash);
+    }
+    EXPECT_EQ(merkleRoot(merkle->chunks), root.result().toHex().toStdString());
+
+    auto serial = calculateMerkle(file.handle(), offset, data.size(), chunkSize, 1);
+    ASSERT_TRUE(serial.has_value());
+    EXPECT_EQ(serial->chunks, merkle->chunks);
+
+    auto empty = calculateMerkle(file.handle(), offset, 0, chunkSize);
+    ASSERT_TRUE(empty.has_value());
+    EXPECT_TRUE(empty->chunks.empty());
+    EXPECT_FALSE(calculateMerkle(file.handle(), offset, data.size(), 0).has_value());
+    EXPECT_FALSE(
+      calculateMerkle(file.handle(), offset, data.size(), maxMerkleChunkSize + 1).has_value());
+
+    // a range exceeding the file, like the section of a truncated bundle, fails instead of
+    // reading past the end of the mapping
+    EXPECT_FALSE(calculateMerkle(file.handle(), offset, data.size() + 1, chunkSize).has_value());
+    EXPECT_FALSE(calculateMerkle(file.handle(), offset + data.size() + 4096, 1, chunkSize)
+                   .has_value());
+    EXPECT_FALSE(calculateDigest(file.handle(), offset, data.size() + 4096).has_value());
+}
+
+TEST(UABMerkle, Digest)
+{
+    constexpr int offset = 4097;
+    auto data = content(1024 * 1024 + 3);
+
+    // the data after the range, like the sections behind the bundle, mustn't be hashed
+    QTemporaryFile file;
+    ASSERT_TRUE(file.open());
+    ASSERT_TRUE(file.write(QByteArray(offset, 'x') + data + QByteArray(100, 'y')) > 0);
+    ASSERT_TRUE(file.flush());
+
+    auto digest = calculateDigest(file.handle(), offset, data.size());
+    ASSERT_TRUE(digest.has_value()) << digest.error().message().toStdString();
+    EXPECT_EQ(*digest,
+              QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex().toStdString());
+
+    auto empty = calculateDigest(file.handle(), offset, 0);
+    ASSERT_TRUE(empty.has_value());
+    EXPECT_EQ(*empty,
+              QCryptographicHash::hash({}, QCryptographicHash::Sha256).toHex().toStdString());
+}
+
+TEST(UABMerkle, DISABLED_DigestBenchmark)
+{
+    constexpr int size = 256 * 1024 * 1024;
+    QTemporaryFile file;
+    ASSERT_TRUE(file.open());
+    auto data = content(size);
+    ASSERT_EQ(file.write(data), size);
+    ASSERT_TRUE(file.flush());
+    data.clear();
+
+    // the way UABFile::verify used to hash the bundle
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_TRUE(file.seek(0));
+    std::array<char, 4096> buf{};
+    QCryptographicHash cryptor{ QCryptographicHash::Sha256 };
+    qint64 bytesRead{ 0 };
+    while ((bytesRead = file.read(buf.data(), buf.size())) > 0) {
+        cryptor.addData(buf.data(), static_cast<int>(bytesRead));
+    }
+    auto before = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    auto digest = calculateDigest(file.handle(), 0, size);
+    auto after = std::chrono::steady_clock::now() - start;
+    ASSERT_TRUE(digest.has_value());
+    EXPECT_EQ(*digest, cryptor.result().toHex().toStdString());
+
+    auto throughput = [](auto duration) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        return static_cast<double>(size) / std::max<long long>(us, 1) / 1000;
+    };
+    std::cout << "sha256 of 256MiB: QFile::read with QCryptographicHash " << throughput(before)
+              << "GB/s, mmap with OpenSSL " << throughput(after) << "GB/s" << std::endl;
+}
+
+TEST(UABMerkle, MetaInfoCompatibility)
+{
+    // bundles with a single digest are still accepted
+    auto old = nlohmann::json::parse(R"({"version":"1","digest":"abc","uuid":"id",)"
+                                     R"("sections":{"bundle":"linglong.bundle"},"layers":[]})");
+    auto meta = old.get<linglong::api::types::v1::UabMetaInfo>();
+    EXPECT_EQ(meta.version, linglong::api::types::v1::Version::The1);
+    EXPECT_FALSE(meta.merkle.has_value());
+    EXPECT_FALSE(nlohmann::json(meta).contains("merkle"));
+
+    meta.version = linglong::api::types::v1::Version::The2;
+    meta.merkle = linglong::api::types::v1::UabMerkle{ { "00", "11" }, defaultMerkleChunkSize };
+    auto parsed = nlohmann::json(meta).get<linglong::api::types::v1::UabMetaInfo>();
+    EXPECT_EQ(parsed.version, linglong::api::types::v1::Version::The2);
+    ASSERT_TRUE(parsed.merkle.has_value());
+    EXPECT_EQ(parsed.merkle->chunks, meta.merkle->chunks);
+    EXPECT_EQ(parsed.merkle->chunkSize, defaultMerkleChunkSize);
+}
+
+// Benchmarks are disabled by default, run them with
+// ll-tests --gtest_also_run_disabled_tests --gtest_filter='UABMerkle.*Benchmark'
+TEST(UABMerkle, DISABLED_ThroughputBenchmark)
+{
+    constexpr int size = 256 * 1024 * 1024;
+    QTemporaryFile file;
+    ASSERT_TRUE(file.open());
+    auto data = content(size);
+    ASSERT_EQ(file.write(data), size);
+    ASSERT_TRUE(file.flush());
+
+    auto start = std::chrono::steady_clock::now();
+    auto flat = QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+    auto flatTime = std::chrono::steady_clock::now() - start;
+    ASSERT_FALSE(flat.isEmpty());
+
+    auto jobs = std::max(std::thread::hardware_concurrency(), 1U);
+    start = std::chrono::steady_clock::now();
+    auto merkle = calculateMerkle(file.handle(), 0, size, defaultMerkleChunkSize, jobs);
+    auto merkleTime = std::chrono::steady_clock::now() - start;
+    ASSERT_TRUE(merkle.has_value());
+
+    auto throughput = [](auto duration) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        return static_cast<double>(size) / std::max<long long>(us, 1) * 1000000 / (1 << 20);
+    };
+    std::cout << "sha256 of 256MiB: flat " << throughput(flatTime) << "MiB/s, "
+              << merkle->chunks.size() << " chunks on " << jobs << " threads "
+              << throughput(merkleTime) << "MiB/s" << std::endl;
+}
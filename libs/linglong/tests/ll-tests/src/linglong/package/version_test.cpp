@@ -8,8 +8,80 @@
 
 #include "linglong/package/version.h"
 
+#include <QRegularExpression>
+
+#include <chrono>
+#include <iostream>
+
 using namespace linglong::package;
 
+namespace {
+
+constexpr bool matches(std::string_view raw)
+{
+    return detail::parseVersionNumbers(raw).error == VersionError::None;
+}
+
+static_assert(matches("0.0.0"));
+static_assert(matches("1.2.3.4"));
+static_assert(matches("10.20.30.40"));
+static_assert(!matches(""));
+static_assert(!matches("1.2"));
+static_assert(!matches("1.2.3."));
+static_assert(!matches(".1.2.3"));
+static_assert(!matches("1..2.3"));
+static_assert(!matches("1.2.3.4.5"));
+static_assert(!matches("01.2.3"));
+static_assert(!matches("1.2.3.00"));
+static_assert(!matches("1.2.3-alpha"));
+static_assert(!matches("1.2.3.4+meta"));
+static_assert(detail::parseVersionNumbers("1.2.3").count == 3);
+static_assert(detail::parseVersionNumbers("1.2.3.4").numbers[3] == 4);
+static_assert(detail::parseVersionNumbers("9223372036854775807.0.0").numbers[0]
+              == std::numeric_limits<qlonglong>::max());
+static_assert(detail::parseVersionNumbers("0.9223372036854775808.0").error
+              == VersionError::MinorTooLarge);
+// a mismatch wins over an overflow, as the regex was matched first
+static_assert(detail::parseVersionNumbers("9223372036854775808.0.0-rc").error
+              == VersionError::Mismatched);
+
+// the regex based parser which was used before, kept to check and benchmark the new one against
+std::optional<Version> regexParse(const QString &raw)
+{
+    static QRegularExpression regexExp(
+      R"(^(0|[1-9]\d*)\.(0|[1-9]\d*)\.(0|[1-9]\d*)(?:\.(0|[1-9]\d*))?$)");
+
+    auto matched = regexExp.match(raw);
+    if (!matched.hasMatch()) {
+        return std::nullopt;
+    }
+
+    Version version("0.0.0");
+    bool ok = false;
+    version.major = matched.captured(1).toLongLong(&ok);
+    if (!ok) {
+        return std::nullopt;
+    }
+    version.minor = matched.captured(2).toLongLong(&ok);
+    if (!ok) {
+        return std::nullopt;
+    }
+    version.patch = matched.captured(3).toLongLong(&ok);
+    if (!ok) {
+        return std::nullopt;
+    }
+    if (!matched.captured(4).isNull()) {
+        version.tweak = matched.captured(4).toLongLong(&ok);
+        if (!ok) {
+            return std::nullopt;
+        }
+    }
+
+    return version;
+}
+
+} // namespace
+
 TEST(Package, VersionRegex101)
 {
     // tests modified from https://regex101.com/r/vkijKf/1/
@@ -181,3 +253,105 @@ TEST(Package, VersionCompare)
         }
     }
 }
+
+TEST(Package, VersionPack)
+{
+    QStringList versions = { "0.0.0", "0.0.0.0", "0.0.0.1", "1.2.3",     "1.2.3.4",
+                             "1.2.10.0", "9.0.0.0", "10.0.0.0", "10.0.0.99", "4294967295.0.0.0" };
+    for (int i = 0; i < versions.size() - 1; i++) {
+        for (int j = i + 1; j < versions.size(); j++) {
+            auto x = Version::parse(versions[i]);
+            ASSERT_TRUE(x.has_value()) << versions[i].toStdString() << " is valid.";
+            auto y = Version::parse(versions[j]);
+            ASSERT_TRUE(y.has_value()) << versions[j].toStdString() << " is valid.";
+
+            EXPECT_LT(x->pack(), y->pack())
+              << "x: " << x->toString().toStdString() << " y:" << y->toString().toStdString();
+        }
+    }
+
+    // numbers out of 32 bits saturate
+    auto x = Version::parse("4294967296.0.0.0");
+    ASSERT_TRUE(x.has_value());
+    EXPECT_EQ(x->pack(), Version::parse("4294967295.0.0.0")->pack());
+}
+
+TEST(Package, VersionTryParse)
+{
+    QStringList cases = { "0.0.0",
+                          "0.0.0.0",
+                          "1.2.3.4",
+                          "10.20.30.40",
+                          "9223372036854775807.0.0.9223372036854775807",
+                          "9223372036854775808.0.0.0",
+                          "0.0.0.9223372036854775808",
+                          "",
+                          "1",
+                          "1.2",
+                          "1.2.3.",
+                          "01.2.3",
+                          "1.02.3",
+                          "1.2.3.04",
+                          "1.2.3.4.5",
+                          "1.2.3.4-rc.1",
+                          "1.2.3.4+meta",
+                          " 1.2.3",
+                          "1.2.3 ",
+                          "1.2.3.\u0661",
+                          "-1.2.3" };
+
+    for (const auto &raw : cases) {
+        auto expected = regexParse(raw);
+        auto fromQString = Version::tryParse(QStringView(raw));
+        auto utf8 = raw.toStdString();
+        auto fromStdString = Version::tryParse(std::string_view(utf8));
+
+        ASSERT_EQ(fromQString.has_value(), expected.has_value()) << utf8;
+        ASSERT_EQ(fromStdString.has_value(), expected.has_value()) << utf8;
+        ASSERT_EQ(Version::parse(raw).has_value(), expected.has_value()) << utf8;
+        if (!expected) {
+            continue;
+        }
+
+        EXPECT_EQ(*fromQString, *expected) << utf8;
+        EXPECT_EQ(*fromStdString, *expected) << utf8;
+        EXPECT_EQ(fromQString->toString(), raw);
+    }
+
+    EXPECT_EQ(Version::tryParse(std::string_view("1.2")).error(), VersionError::Mismatched);
+    EXPECT_EQ(Version::tryParse(std::string_view("1.2.3.9223372036854775808")).error(),
+              VersionError::TweakTooLarge);
+    EXPECT_THROW(Version("1.2"), std::runtime_error);
+}
+
+TEST(Package, DISABLED_VersionParseBenchmark)
+{
+    QStringList versions = { "1.0.0.0", "23.1.0.5", "6.5.20.1", "1.2.3", "not.a.version" };
+    constexpr std::size_t rounds = 20000;
+    std::size_t valid = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < rounds; ++i) {
+        for (const auto &version : versions) {
+            valid += regexParse(version).has_value() ? 1 : 0;
+        }
+    }
+    auto regex = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < rounds; ++i) {
+        for (const auto &version : versions) {
+            valid -= Version::tryParse(QStringView(version)).has_value() ? 1 : 0;
+        }
+    }
+    auto handWritten = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(valid, 0);
+    EXPECT_LT(handWritten, regex);
+    auto perParse = [&versions](auto duration) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()
+          / static_cast<long long>(rounds * versions.size());
+    };
+    std::cout << "parse version: regex " << perParse(regex) << "ns each, hand-written "
+              << perParse(handWritten) << "ns each" << std::endl;
+}
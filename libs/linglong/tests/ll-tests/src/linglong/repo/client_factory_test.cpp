@@ -0,0 +1,191 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <gtest/gtest.h>
+
+#include "linglong/repo/client_factory.h"
+#include "linglong/repo/mock_server.h"
+#include "linglong/utils/serialize/json_list_stream.h"
+
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+using linglong::repo::test::MockServer;
+
+void invoke(apiClient_t *client)
+{
+    apiClient_invoke(client,
+                     "/api/v1/repos/stable",
+                     nullptr,
+                     nullptr,
+                     nullptr,
+                     nullptr,
+                     nullptr,
+                     nullptr,
+                     "GET");
+}
+
+bool get(apiClient_t *client)
+{
+    invoke(client);
+    free(client->dataReceived);
+    client->dataReceived = nullptr;
+    client->dataReceivedLen = 0;
+    return client->response_code == 200;
+}
+
+// a search response of n entries, about 300 bytes each
+std::string searchResponse(std::size_t n)
+{
+    std::string body = R"({"code":200,"msg":"ok","data":[)";
+    for (std::size_t i = 0; i < n; ++i) {
+        body += (i == 0 ? "" : ",");
+        body += R"({"appId":"org.deepin.app)" + std::to_string(i)
+          + R"(","arch":"x86_64","channel":"main","description":"a synthetic application used )"
+            R"(to fill a large response, with a description long enough to look real",)"
+            R"("kind":"app","module":"binary","name":"app","repoName":"stable",)"
+            R"("runtime":"main:org.deepin.runtime.dtk/23.1.0/x86_64","size":1024,)"
+            R"("version":"1.0.0.)"
+          + std::to_string(i % 10) + "\"}";
+    }
+    return body + "]}";
+}
+
+} // namespace
+
+TEST(ClientFactoryTest, ReuseConnections)
+{
+    MockServer server;
+    linglong::repo::ClientFactory factory(server.url());
+
+    constexpr std::size_t rounds = 50;
+    for (std::size_t i = 0; i < rounds; ++i) {
+        auto client = factory.createClientV2();
+        ASSERT_TRUE(get(client.get()));
+    }
+
+    EXPECT_EQ(server.requests.load(), rounds);
+    EXPECT_EQ(server.accepted.load(), 1);
+
+    // concurrent clients could use more connections, but not one per request
+    std::vector<std::future<bool>> jobs;
+    for (std::size_t i = 0; i < 4; ++i) {
+        jobs.emplace_back(std::async(std::launch::async, [&factory]() {
+            bool ok{ true };
+            for (std::size_t i = 0; i < rounds; ++i) {
+                ok = get(factory.createClientV2().get()) && ok;
+            }
+            return ok;
+        }));
+    }
+    for (auto &job : jobs) {
+        EXPECT_TRUE(job.get());
+    }
+
+    EXPECT_EQ(server.requests.load(), rounds * 5);
+    EXPECT_LE(server.accepted.load(), 5);
+}
+
+TEST(ClientFactoryTest, DISABLED_HandshakeBenchmark)
+{
+    MockServer server;
+    linglong::repo::ClientFactory factory(server.url());
+    constexpr std::size_t rounds = 500;
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < rounds; ++i) {
+        std::shared_ptr<apiClient_t> client(
+          apiClient_create_with_base_path(server.url().c_str(), nullptr, nullptr),
+          apiClient_free);
+        ASSERT_TRUE(get(client.get()));
+    }
+    auto fresh = std::chrono::steady_clock::now() - start;
+    auto freshAccepted = server.accepted.load();
+
+    start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < rounds; ++i) {
+        ASSERT_TRUE(get(factory.createClientV2().get()));
+    }
+    auto pooled = std::chrono::steady_clock::now() - start;
+    auto pooledAccepted = server.accepted.load() - freshAccepted;
+
+    EXPECT_EQ(freshAccepted, rounds);
+    EXPECT_EQ(pooledAccepted, 1);
+    std::cout << rounds << " requests: fresh handles " << freshAccepted << " connections "
+              << std::chrono::duration_cast<std::chrono::microseconds>(fresh).count()
+              << "us, pooled handles " << pooledAccepted << " connections "
+              << std::chrono::duration_cast<std::chrono::microseconds>(pooled).count() << "us"
+              << std::endl;
+}
+
+TEST(ClientFactoryTest, LargeResponse)
+{
+    auto body = searchResponse(20000);
+    ASSERT_GT(body.size(), 4 * 1024 * 1024);
+
+    for (bool contentLength : { true, false }) {
+        MockServer server(body, contentLength);
+        std::shared_ptr<apiClient_t> client(
+          apiClient_create_with_base_path(server.url().c_str(), nullptr, nullptr),
+          apiClient_free);
+
+        auto start = std::chrono::steady_clock::now();
+        invoke(client.get());
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        auto len = static_cast<std::size_t>(client->dataReceivedLen);
+        auto capacity = static_cast<std::size_t>(client->dataReceivedCapacity);
+        ASSERT_EQ(len, body.size());
+        EXPECT_EQ(std::string_view(static_cast<char *>(client->dataReceived), len), body);
+        if (contentLength) {
+            // presized, the body is copied once
+            EXPECT_EQ(capacity, len + 1);
+        } else {
+            EXPECT_LT(capacity, 2 * (len + 1));
+        }
+        free(client->dataReceived);
+        client->dataReceived = nullptr;
+
+        std::cout << body.size() << " bytes " << (contentLength ? "with" : "without")
+                  << " Content-Length: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()
+                  << "us" << std::endl;
+    }
+}
+
+TEST(ClientFactoryTest, StreamResponse)
+{
+    constexpr std::size_t entries = 20000;
+    MockServer server(searchResponse(entries), false);
+    linglong::repo::ClientFactory factory(server.url());
+    auto client = factory.createClientV2();
+
+    std::size_t count{ 0 };
+    std::size_t versions{ 0 };
+    linglong::utils::serialize::JsonListStream stream("data", [&](nlohmann::json &&entry) {
+        ++count;
+        versions += entry.at("version") == "1.0.0.9" ? 1 : 0;
+    });
+    client->stream_data = &stream;
+    client->stream_func = [](const char *data, size_t len, void *userdata) -> size_t {
+        auto *stream = static_cast<linglong::utils::serialize::JsonListStream *>(userdata);
+        return stream->feed({ data, len }) ? len : 0;
+    };
+    invoke(client.get());
+    client->stream_func = nullptr;
+
+    // nothing is buffered by the client
+    EXPECT_EQ(client->dataReceived, nullptr);
+    EXPECT_EQ(count, entries);
+    EXPECT_EQ(versions, entries / 10);
+    auto envelope = stream.finish();
+    ASSERT_TRUE(envelope.has_value());
+    EXPECT_EQ(envelope->at("code"), 200);
+    EXPECT_TRUE(envelope->at("data").empty());
+}
@@ -0,0 +1,146 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace linglong::repo::test {
+
+// MockServer answers every request on 127.0.0.1 with the same json and keeps the connections
+// alive, it counts the connections accepted, i.e. the handshakes paid by the clients. Without a
+// Content-Length, the end of the body is marked by closing the connection.
+class MockServer
+{
+public:
+    explicit MockServer(const std::string &body = R"({"code":200})", bool contentLength = true)
+    {
+        response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n";
+        response += contentLength ? "Content-Length: " + std::to_string(body.size())
+                                  : std::string{ "Connection: close" };
+        response += "\r\n\r\n" + body;
+        closeAfterResponse = !contentLength;
+
+        listenFd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        socklen_t len = sizeof(addr);
+        if (::bind(listenFd, reinterpret_cast<sockaddr *>(&addr), len) == -1
+            || ::listen(listenFd, SOMAXCONN) == -1
+            || ::getsockname(listenFd, reinterpret_cast<sockaddr *>(&addr), &len) == -1) {
+            return;
+        }
+
+        port = ntohs(addr.sin_port);
+        worker = std::thread([this]() {
+            serve();
+        });
+    }
+
+    MockServer(const MockServer &) = delete;
+    MockServer &operator=(const MockServer &) = delete;
+
+    ~MockServer()
+    {
+        stopped = true;
+        if (worker.joinable()) {
+            worker.join();
+        }
+        ::close(listenFd);
+    }
+
+    [[nodiscard]] std::string url() const { return "http://127.0.0.1:" + std::to_string(port); }
+
+    std::atomic<std::size_t> accepted{ 0 };
+    std::atomic<std::size_t> requests{ 0 };
+
+private:
+    void serve()
+    {
+        std::vector<pollfd> fds{ { listenFd, POLLIN, 0 } };
+        std::vector<std::string> buffers{ "" };
+        while (!stopped) {
+            if (::poll(fds.data(), fds.size(), 10) <= 0) {
+                continue;
+            }
+
+            for (std::size_t i = fds.size(); i-- > 0;) {
+                if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0) {
+                    continue;
+                }
+
+                if (fds[i].fd == listenFd) {
+                    auto fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+                    if (fd != -1) {
+                        ++accepted;
+                        fds.push_back({ fd, POLLIN, 0 });
+                        buffers.emplace_back();
+                    }
+                    continue;
+                }
+
+                std::array<char, 4096> buf{};
+                auto ret = ::read(fds[i].fd, buf.data(), buf.size());
+                if (ret <= 0) {
+                    ::close(fds[i].fd);
+                    fds.erase(fds.begin() + static_cast<std::ptrdiff_t>(i));
+                    buffers.erase(buffers.begin() + static_cast<std::ptrdiff_t>(i));
+                    continue;
+                }
+
+                // the request bodies are ignored, they are small enough to come with the headers
+                buffers[i].append(buf.data(), ret);
+                auto end = buffers[i].find("\r\n\r\n");
+                for (; end != std::string::npos; end = buffers[i].find("\r\n\r\n")) {
+                    buffers[i].erase(0, end + 4);
+                    ++requests;
+                    writeAll(fds[i].fd);
+                    if (closeAfterResponse) {
+                        ::shutdown(fds[i].fd, SHUT_WR);
+                        break;
+                    }
+                }
+            }
+        }
+
+        for (std::size_t i = 1; i < fds.size(); ++i) {
+            ::close(fds[i].fd);
+        }
+    }
+
+    void writeAll(int fd) const
+    {
+        std::size_t written{ 0 };
+        while (written < response.size()) {
+            auto ret = ::write(fd, response.data() + written, response.size() - written);
+            if (ret <= 0) {
+                return;
+            }
+            written += ret;
+        }
+    }
+
+    std::string response;
+    bool closeAfterResponse{ false };
+    int listenFd{ -1 };
+    uint16_t port{ 0 };
+    std::atomic<bool> stopped{ false };
+    std::thread worker;
+};
+
+} // namespace linglong::repo::test
@@ -0,0 +1,120 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <gtest/gtest.h>
+
+#include "linglong/package/fuzzy_reference.h"
+#include "linglong/repo/remote_search_cache.h"
+
+#include <QTemporaryDir>
+
+namespace {
+
+using linglong::repo::RemoteSearchCache;
+
+RemoteSearchCache::Entry entryOf(const std::string &version, const std::string &etag)
+{
+    RemoteSearchCache::Entry entry;
+    entry.packages.emplace_back(linglong::api::types::v1::PackageInfoV2{
+      .arch = { "x86_64" },
+      .channel = "main",
+      .id = "org.deepin.calculator",
+      .kind = "app",
+      .packageInfoV2Module = "binary",
+      .name = "calculator",
+      .version = version,
+    });
+    entry.etag = etag;
+    return entry;
+}
+
+class RemoteSearchCacheTest : public ::testing::Test
+{
+protected:
+    QTemporaryDir dir;
+    std::string key;
+    std::size_t fetched{ 0 };
+    std::vector<std::string> etags;
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(dir.isValid());
+        auto fuzzyRef = linglong::package::FuzzyReference::parse("org.deepin.calculator");
+        ASSERT_TRUE(fuzzyRef.has_value());
+        key = RemoteSearchCache::key("https://localhost", "stable", *fuzzyRef);
+    }
+
+    [[nodiscard]] std::string file() const
+    {
+        return dir.filePath("remote_search_cache.json").toStdString();
+    }
+
+    // answers 304 if the stale entry has the etag "v1", the version 1.0.1 otherwise
+    RemoteSearchCache::Fetch server()
+    {
+        return [this](const RemoteSearchCache::Entry *stale)
+                 -> linglong::utils::error::Result<std::optional<RemoteSearchCache::Entry>> {
+            ++fetched;
+            etags.emplace_back(stale ? stale->etag : "");
+            if (stale && stale->etag == "v1") {
+                return std::nullopt;
+            }
+            return entryOf("1.0.1", "v1");
+        };
+    }
+};
+
+TEST_F(RemoteSearchCacheTest, HitWithinTTL)
+{
+    RemoteSearchCache cache(file(), std::chrono::hours(1));
+    for (int i = 0; i < 10; ++i) {
+        auto ret = cache.search(key, server());
+        ASSERT_TRUE(ret.has_value());
+        ASSERT_EQ(ret->size(), 1);
+        EXPECT_EQ(ret->front().version, "1.0.1");
+    }
+
+    EXPECT_EQ(fetched, 1);
+    EXPECT_EQ(cache.stats().misses, 1);
+    EXPECT_EQ(cache.stats().hits, 9);
+
+    // a new process picks up the cache from disk
+    RemoteSearchCache reloaded(file(), std::chrono::hours(1));
+    ASSERT_TRUE(reloaded.search(key, server()).has_value());
+    EXPECT_EQ(fetched, 1);
+    EXPECT_EQ(reloaded.stats().hits, 1);
+}
+
+TEST_F(RemoteSearchCacheTest, RevalidateStaleEntry)
+{
+    // every entry is stale at once
+    RemoteSearchCache cache(file(), std::chrono::seconds(0));
+    ASSERT_TRUE(cache.search(key, server()).has_value());
+    auto ret = cache.search(key, server());
+    ASSERT_TRUE(ret.has_value());
+    EXPECT_EQ(ret->front().version, "1.0.1");
+
+    EXPECT_EQ(fetched, 2);
+    EXPECT_EQ(etags, (std::vector<std::string>{ "", "v1" }));
+    EXPECT_EQ(cache.stats().misses, 1);
+    EXPECT_EQ(cache.stats().revalidations, 1);
+    EXPECT_EQ(cache.stats().hits, 0);
+}
+
+TEST_F(RemoteSearchCacheTest, FetchError)
+{
+    RemoteSearchCache cache(file(), std::chrono::hours(1));
+    auto ret = cache.search(key, [](const RemoteSearchCache::Entry *) {
+        LINGLONG_TRACE("fetch");
+        return linglong::utils::error::Result<std::optional<RemoteSearchCache::Entry>>(
+          LINGLONG_ERR("network is unreachable"));
+    });
+    EXPECT_FALSE(ret.has_value());
+
+    // errors are not cached
+    ASSERT_TRUE(cache.search(key, server()).has_value());
+    EXPECT_EQ(fetched, 1);
+}
+
+} // namespace
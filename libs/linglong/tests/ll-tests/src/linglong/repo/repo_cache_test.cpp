@@ -0,0 +1,718 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <gtest/gtest.h>
+
+#include "linglong/api/types/v1/Generators.hpp"
+#include "linglong/package/layer_packager.h"
+#include "linglong/package/reference.h"
+#include "linglong/repo/binary_repo_cache.h"
+#include "linglong/repo/ostree_repo.h"
+#include "linglong/repo/repo_cache.h"
+#include "linglong/utils/configure.h"
+#include "linglong/utils/serialize/json.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include <unistd.h>
+
+namespace {
+
+using linglong::api::types::v1::RepositoryCache;
+using linglong::api::types::v1::RepositoryCacheLayersItem;
+
+RepositoryCacheLayersItem syntheticLayer(std::size_t n)
+{
+    RepositoryCacheLayersItem item;
+    item.commit = "commit-" + std::to_string(n);
+    item.repo = "stable";
+    item.info.arch = { "x86_64" };
+    item.info.channel = "main";
+    item.info.id = "org.deepin.app" + std::to_string(n / 4);
+    item.info.kind = "app";
+    item.info.packageInfoV2Module = n % 2 == 0 ? "binary" : "develop";
+    item.info.version = "1.0.0." + std::to_string(n % 4 / 2);
+    item.info.schemaVersion = "1.0";
+    item.info.size = 0;
+    return item;
+}
+
+class RepoCacheTest : public ::testing::Test
+{
+protected:
+    QTemporaryDir dir;
+    OstreeRepo *ostreeRepo{ nullptr };
+    linglong::api::types::v1::RepoConfig config{ "stable",
+                                                 { { "stable", "https://localhost" } },
+                                                 1 };
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(dir.isValid());
+        g_autoptr(GFile) path = g_file_new_for_path(dir.filePath("repo").toUtf8());
+        ostreeRepo = ostree_repo_new(path);
+        ASSERT_TRUE(ostree_repo_create(ostreeRepo,
+                                       OSTREE_REPO_MODE_BARE_USER_ONLY,
+                                       nullptr,
+                                       nullptr));
+    }
+
+    void TearDown() override { g_clear_object(&ostreeRepo); }
+
+    // commits an info.json of syntheticLayer(i) for each of the refs
+    void commitSyntheticRefs(std::size_t refs)
+    {
+        g_autoptr(GError) gErr = nullptr;
+        ASSERT_TRUE(ostree_repo_prepare_transaction(ostreeRepo, nullptr, nullptr, &gErr));
+
+        QDir content(dir.filePath("content"));
+        ASSERT_TRUE(content.mkpath("."));
+        g_autoptr(GFile) contentDir = g_file_new_for_path(content.path().toUtf8());
+        for (std::size_t i = 0; i < refs; ++i) {
+            auto layer = syntheticLayer(i);
+            std::ofstream(content.filePath("info.json").toStdString(), std::ios::trunc)
+              << nlohmann::json(layer.info).dump();
+
+            g_autoptr(OstreeMutableTree) mtree = ostree_mutable_tree_new();
+            ASSERT_TRUE(ostree_repo_write_directory_to_mtree(ostreeRepo,
+                                                             contentDir,
+                                                             mtree,
+                                                             nullptr,
+                                                             nullptr,
+                                                             &gErr));
+            g_autoptr(GFile) root = nullptr;
+            ASSERT_TRUE(ostree_repo_write_mtree(ostreeRepo, mtree, &root, nullptr, &gErr));
+            g_autofree char *commit = nullptr;
+            ASSERT_TRUE(ostree_repo_write_commit(ostreeRepo,
+                                                 nullptr,
+                                                 nullptr,
+                                                 nullptr,
+                                                 nullptr,
+                                                 OSTREE_REPO_FILE(root),
+                                                 &commit,
+                                                 nullptr,
+                                                 &gErr));
+
+            auto ref = layer.info.channel + "/" + layer.info.id + "/" + layer.info.version
+              + "/x86_64/" + layer.info.packageInfoV2Module;
+            ostree_repo_transaction_set_ref(ostreeRepo, "stable", ref.c_str(), commit);
+        }
+
+        ASSERT_TRUE(ostree_repo_commit_transaction(ostreeRepo, nullptr, nullptr, &gErr));
+    }
+
+    RepositoryCache syntheticCache(std::size_t layers)
+    {
+        RepositoryCache cache;
+        cache.config = config;
+        cache.llVersion = LINGLONG_VERSION;
+        cache.version = "1";
+        for (std::size_t i = 0; i < layers; ++i) {
+            cache.layers.emplace_back(syntheticLayer(i));
+        }
+        return cache;
+    }
+
+    std::unique_ptr<linglong::repo::RepoCache> createCache(std::size_t layers)
+    {
+        auto cacheFile = dir.filePath("states.json").toStdString();
+        std::ofstream(cacheFile) << nlohmann::json(syntheticCache(layers)).dump();
+
+        auto ret = linglong::repo::RepoCache::create(cacheFile, config, *ostreeRepo);
+        EXPECT_TRUE(ret.has_value());
+        return std::move(ret).value();
+    }
+};
+
+TEST_F(RepoCacheTest, AddDeleteQuery)
+{
+    auto cache = createCache(16);
+
+    linglong::repo::repoCacheQuery query{ .id = "org.deepin.app1" };
+    EXPECT_EQ(cache->queryLayerItem(query).size(), 4);
+
+    query.channel = "main";
+    query.version = "1.0.0.1";
+    query.module = "develop";
+    auto items = cache->queryLayerItem(query);
+    ASSERT_EQ(items.size(), 1);
+    EXPECT_EQ(items.front().commit, "commit-7");
+
+    // deleting a layer moves the last one into its slot, indexes must follow
+    ASSERT_TRUE(cache->deleteLayerItem(syntheticLayer(1)).has_value());
+    EXPECT_EQ(cache->queryLayerItem().size(), 15);
+    EXPECT_EQ(cache->queryLayerItem({ .id = "org.deepin.app0" }).size(), 3);
+    EXPECT_EQ(cache->queryLayerItem({ .id = "org.deepin.app3" }).size(), 4);
+
+    auto uabLayer = syntheticLayer(100);
+    uabLayer.info.uuid = "a0b1c2";
+    ASSERT_TRUE(cache->addLayerItem(uabLayer).has_value());
+    items = cache->queryLayerItem({ .uuid = "a0b1c2" });
+    ASSERT_EQ(items.size(), 1);
+    EXPECT_EQ(items.front().commit, "commit-100");
+    EXPECT_TRUE(cache->queryLayerItem({ .id = "org.deepin.app404" }).empty());
+}
+
+TEST_F(RepoCacheTest, VersionOrder)
+{
+    auto cache = createCache(0);
+    std::vector<std::string> versions{ "9.0.0.0", "10.0.0.1", "1.2.3", "10.0.0.0", "9.10.0.0" };
+    for (std::size_t i = 0; i < versions.size(); ++i) {
+        auto layer = syntheticLayer(i);
+        layer.info.id = "org.deepin.calculator";
+        layer.info.version = versions[i];
+        ASSERT_TRUE(cache->addLayerItem(layer).has_value());
+    }
+
+    // versions are compared as numbers rather than strings
+    std::vector<std::string> expected{ "10.0.0.1", "10.0.0.0", "9.10.0.0", "9.0.0.0", "1.2.3" };
+    std::vector<std::string> sorted;
+    for (const auto &item : cache->queryLayerItem({ .id = "org.deepin.calculator" })) {
+        sorted.emplace_back(item.info.version);
+    }
+    EXPECT_EQ(sorted, expected);
+
+    // the order of a layer moved by a deletion is kept
+    auto removed = syntheticLayer(0);
+    removed.info.id = "org.deepin.calculator";
+    removed.info.version = versions[0];
+    ASSERT_TRUE(cache->deleteLayerItem(removed).has_value());
+    expected.erase(std::find(expected.begin(), expected.end(), versions[0]));
+    sorted.clear();
+    for (const auto &item : cache->queryLayerItem({ .id = "org.deepin.calculator" })) {
+        sorted.emplace_back(item.info.version);
+    }
+    EXPECT_EQ(sorted, expected);
+}
+
+TEST_F(RepoCacheTest, IndexedQuery)
+{
+    constexpr std::size_t layers = 1000;
+    auto cache = createCache(layers);
+    const auto &all = cache->queryLayerItem();
+
+    for (std::size_t i = 0; i < layers / 4; i += 7) {
+        linglong::repo::repoCacheQuery query{ .id = "org.deepin.app" + std::to_string(i),
+                                              .channel = "main",
+                                              .version = "1.0.0.0",
+                                              .module = "binary" };
+        std::vector<std::string> linear;
+        for (const auto &layer : all) {
+            if (layer.info.id == *query.id && layer.info.channel == *query.channel
+                && layer.info.version == *query.version
+                && layer.info.packageInfoV2Module == *query.module) {
+                linear.emplace_back(layer.commit);
+            }
+        }
+
+        std::vector<std::string> indexed;
+        for (const auto &layer : cache->queryLayerItem(query)) {
+            indexed.emplace_back(layer.commit);
+        }
+        std::sort(linear.begin(), linear.end());
+        std::sort(indexed.begin(), indexed.end());
+        EXPECT_EQ(linear, indexed);
+    }
+}
+
+TEST_F(RepoCacheTest, FailedRebuild)
+{
+    auto cache = createCache(16);
+
+    // a ref without info.json fails the rebuild
+    g_autoptr(GError) gErr = nullptr;
+    ASSERT_TRUE(ostree_repo_prepare_transaction(ostreeRepo, nullptr, nullptr, &gErr));
+    QDir content(dir.filePath("empty"));
+    ASSERT_TRUE(content.mkpath("."));
+    g_autoptr(GFile) contentDir = g_file_new_for_path(content.path().toUtf8());
+    g_autoptr(OstreeMutableTree) mtree = ostree_mutable_tree_new();
+    ASSERT_TRUE(ostree_repo_write_directory_to_mtree(ostreeRepo,
+                                                     contentDir,
+                                                     mtree,
+                                                     nullptr,
+                                                     nullptr,
+                                                     &gErr));
+    g_autoptr(GFile) root = nullptr;
+    ASSERT_TRUE(ostree_repo_write_mtree(ostreeRepo, mtree, &root, nullptr, &gErr));
+    g_autofree char *commit = nullptr;
+    ASSERT_TRUE(ostree_repo_write_commit(ostreeRepo,
+                                         nullptr,
+                                         nullptr,
+                                         nullptr,
+                                         nullptr,
+                                         OSTREE_REPO_FILE(root),
+                                         &commit,
+                                         nullptr,
+                                         &gErr));
+    ostree_repo_transaction_set_ref(ostreeRepo,
+                                    "stable",
+                                    "main/org.deepin.broken/1.0.0.0/x86_64/binary",
+                                    commit);
+    ASSERT_TRUE(ostree_repo_commit_transaction(ostreeRepo, nullptr, nullptr, &gErr));
+    EXPECT_FALSE(cache->rebuildCache(config, *ostreeRepo).has_value());
+
+    // the layers and their indexes are left as they were
+    EXPECT_EQ(cache->queryLayerItem().size(), 16);
+    auto items = cache->queryLayerItem({ .id = "org.deepin.app1",
+                                         .channel = "main",
+                                         .version = "1.0.0.1",
+                                         .module = "develop" });
+    ASSERT_EQ(items.size(), 1);
+    EXPECT_EQ(items.front().commit, "commit-7");
+}
+
+// Benchmarks are disabled by default, run them with
+// ll-tests --gtest_also_run_disabled_tests --gtest_filter='*Benchmark'
+TEST_F(RepoCacheTest, DISABLED_QueryBenchmark)
+{
+    for (std::size_t layers : { 10000, 100000 }) {
+        auto cache = createCache(layers);
+        const auto &all = cache->queryLayerItem();
+        constexpr std::size_t rounds = 1000;
+
+        auto start = std::chrono::steady_clock::now();
+        std::size_t linearFound{ 0 };
+        for (std::size_t i = 0; i < rounds; ++i) {
+            auto id = "org.deepin.app" + std::to_string(i * 7 % (layers / 4));
+            for (const auto &layer : all) {
+                if (layer.info.id == id && layer.info.channel == "main"
+                    && layer.info.version == "1.0.0.0"
+                    && layer.info.packageInfoV2Module == "binary") {
+                    ++linearFound;
+                }
+            }
+        }
+        auto linear = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        std::size_t indexedFound{ 0 };
+        for (std::size_t i = 0; i < rounds; ++i) {
+            linglong::repo::repoCacheQuery query{ .id = "org.deepin.app"
+                                                    + std::to_string(i * 7 % (layers / 4)),
+                                                  .channel = "main",
+                                                  .version = "1.0.0.0",
+                                                  .module = "binary" };
+            indexedFound += cache->queryLayerItem(query).size();
+        }
+        auto indexed = std::chrono::steady_clock::now() - start;
+
+        EXPECT_EQ(linearFound, indexedFound);
+        std::cout << layers << " layers, " << rounds << " queries: linear scan "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(linear).count()
+                  << "us, indexed "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(indexed).count() << "us"
+                  << std::endl;
+    }
+}
+
+class RebuildTest : public RepoCacheTest
+{
+protected:
+    void TearDown() override
+    {
+        qunsetenv("LINGLONG_REBUILD_CACHE_JOBS");
+        RepoCacheTest::TearDown();
+    }
+
+    std::vector<RepositoryCacheLayersItem> rebuild(std::size_t refs, const char *jobs)
+    {
+        qputenv("LINGLONG_REBUILD_CACHE_JOBS", jobs);
+        QFile::remove(dir.filePath("states.json"));
+
+        auto start = std::chrono::steady_clock::now();
+        auto ret = linglong::repo::RepoCache::create(dir.filePath("states.json").toStdString(),
+                                                     config,
+                                                     *ostreeRepo);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        EXPECT_TRUE(ret.has_value());
+        if (!ret) {
+            return {};
+        }
+
+        std::cout << "rebuild cache of " << refs << " refs with " << jobs << " jobs: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+                  << "ms" << std::endl;
+        return (*ret)->queryLayerItem();
+    }
+};
+
+TEST_F(RebuildTest, Parallel)
+{
+    constexpr std::size_t refs = 64;
+    commitSyntheticRefs(refs);
+
+    auto serial = rebuild(refs, "1");
+    auto parallel = rebuild(refs, "8");
+
+    // layers are merged in the order of refs, no matter how they are scheduled
+    ASSERT_EQ(serial.size(), refs);
+    EXPECT_EQ(nlohmann::json(serial), nlohmann::json(parallel));
+}
+
+TEST_F(RebuildTest, DISABLED_Benchmark)
+{
+    constexpr std::size_t refs = 4000;
+    commitSyntheticRefs(refs);
+
+    auto serial = rebuild(refs, "1");
+    auto parallel = rebuild(refs, "8");
+    ASSERT_EQ(serial.size(), refs);
+    EXPECT_EQ(nlohmann::json(serial), nlohmann::json(parallel));
+}
+
+TEST_F(RepoCacheTest, BinaryFormat)
+{
+    auto cacheFile = dir.filePath("states.json").toStdString();
+    ASSERT_TRUE(linglong::repo::writeBinaryRepoCache(dir.filePath("states.bin").toStdString(),
+                                                     syntheticCache(16))
+                  .has_value());
+
+    auto ret = linglong::repo::RepoCache::create(cacheFile,
+                                                 config,
+                                                 *ostreeRepo,
+                                                 linglong::repo::RepoCacheFormat::Binary);
+    ASSERT_TRUE(ret.has_value());
+    auto &cache = *ret;
+
+    auto items = cache->queryLayerItem({ .id = "org.deepin.app1",
+                                         .channel = "main",
+                                         .version = "1.0.0.1",
+                                         .module = "develop" });
+    ASSERT_EQ(items.size(), 1);
+    EXPECT_EQ(items.front().commit, "commit-7");
+    EXPECT_EQ(nlohmann::json(items.front().info), nlohmann::json(syntheticLayer(7).info));
+    EXPECT_EQ(cache->queryLayerItem({ .id = "org.deepin.app0" }).size(), 4);
+    EXPECT_EQ(cache->queryLayerItem().size(), 16);
+
+    // mutations load all layers out of the mapping, states.bin is left to the compaction
+    ASSERT_TRUE(cache->deleteLayerItem(syntheticLayer(7)).has_value());
+    EXPECT_EQ(cache->queryLayerItem().size(), 15);
+    cache.reset();
+
+    auto reopened = linglong::repo::BinaryRepoCache::open(dir.filePath("states.bin").toStdString());
+    ASSERT_TRUE(reopened.has_value());
+    EXPECT_EQ((*reopened)->layers()->size(), 16);
+
+    ret = linglong::repo::RepoCache::create(cacheFile,
+                                            config,
+                                            *ostreeRepo,
+                                            linglong::repo::RepoCacheFormat::Binary);
+    ASSERT_TRUE(ret.has_value());
+    EXPECT_EQ((*ret)->queryLayerItem().size(), 15);
+}
+
+TEST_F(RepoCacheTest, JournalReplay)
+{
+    auto cache = createCache(16);
+    QFile snapshot(dir.filePath("states.json"));
+    ASSERT_TRUE(snapshot.open(QIODevice::ReadOnly));
+    auto before = snapshot.readAll();
+    snapshot.close();
+
+    // mutations only append to the journal
+    ASSERT_TRUE(cache->deleteLayerItem(syntheticLayer(3)).has_value());
+    ASSERT_TRUE(cache->addLayerItem(syntheticLayer(100)).has_value());
+    ASSERT_TRUE(cache->deleteLayerItem(syntheticLayer(100)).has_value());
+    ASSERT_TRUE(cache->addLayerItem(syntheticLayer(3)).has_value());
+    ASSERT_TRUE(cache->deleteLayerItem(syntheticLayer(5)).has_value());
+    ASSERT_TRUE(snapshot.open(QIODevice::ReadOnly));
+    EXPECT_EQ(snapshot.readAll(), before);
+    snapshot.close();
+
+    // simulate a crash in the middle of appending a record
+    cache.reset();
+    std::ofstream(dir.filePath("states.journal").toStdString(), std::ios::app)
+      << R"({"op":"delete","layer":{"com)";
+
+    auto ret = linglong::repo::RepoCache::create(dir.filePath("states.json").toStdString(),
+                                                 config,
+                                                 *ostreeRepo);
+    ASSERT_TRUE(ret.has_value());
+    cache = std::move(ret).value();
+    EXPECT_EQ(cache->queryLayerItem().size(), 15);
+    EXPECT_EQ(cache->queryLayerItem({ .id = "org.deepin.app0" }).size(), 4);
+    EXPECT_EQ(cache->queryLayerItem({ .id = "org.deepin.app1" }).size(), 3);
+    EXPECT_TRUE(cache->queryLayerItem({ .id = "org.deepin.app25" }).empty());
+
+    // the torn tail is dropped before appending
+    ASSERT_TRUE(cache->addLayerItem(syntheticLayer(5)).has_value());
+    cache.reset();
+    ret = linglong::repo::RepoCache::create(dir.filePath("states.json").toStdString(),
+                                            config,
+                                            *ostreeRepo);
+    ASSERT_TRUE(ret.has_value());
+    EXPECT_EQ((*ret)->queryLayerItem().size(), 16);
+}
+
+TEST_F(RepoCacheTest, JournalCompaction)
+{
+    auto cache = createCache(16);
+    for (std::size_t i = 16; i < 16 + 200; ++i) {
+        ASSERT_TRUE(cache->addLayerItem(syntheticLayer(i)).has_value());
+    }
+    cache.reset();
+
+    // compactions have rewritten the snapshot, the rest is in the journal
+    auto snapshot = linglong::utils::serialize::LoadJSONFile<RepositoryCache>(
+      dir.filePath("states.json").toStdString());
+    ASSERT_TRUE(snapshot.has_value());
+    EXPECT_GT(snapshot->layers.size(), 16);
+
+    auto ret = linglong::repo::RepoCache::create(dir.filePath("states.json").toStdString(),
+                                                 config,
+                                                 *ostreeRepo);
+    ASSERT_TRUE(ret.has_value());
+    EXPECT_EQ((*ret)->queryLayerItem().size(), 216);
+}
+
+TEST_F(RepoCacheTest, JournalBatch)
+{
+    auto cache = createCache(16);
+    {
+        // the mutations in a batch are visible at once and flushed together when it ends
+        linglong::repo::RepoCacheBatch batch{ *cache };
+        for (std::size_t i = 16; i < 16 + 8; ++i) {
+            ASSERT_TRUE(cache->addLayerItem(syntheticLayer(i)).has_value());
+        }
+        ASSERT_TRUE(cache->deleteLayerItem(syntheticLayer(3)).has_value());
+        EXPECT_EQ(cache->queryLayerItem().size(), 23);
+        ASSERT_TRUE(batch.end().has_value());
+        EXPECT_TRUE(batch.end().has_value());
+
+        // a batch which isn't ended explicitly ends on destruction
+        linglong::repo::RepoCacheBatch other{ *cache };
+        ASSERT_TRUE(cache->addLayerItem(syntheticLayer(100)).has_value());
+    }
+    ASSERT_TRUE(cache->addLayerItem(syntheticLayer(101)).has_value());
+    cache.reset();
+
+    auto ret = linglong::repo::RepoCache::create(dir.filePath("states.json").toStdString(),
+                                                 config,
+                                                 *ostreeRepo);
+    ASSERT_TRUE(ret.has_value());
+    EXPECT_EQ((*ret)->queryLayerItem().size(), 25);
+}
+
+TEST_F(RepoCacheTest, JournalOwner)
+{
+    auto cache = createCache(16);
+    auto journalFile = dir.filePath("states.journal").toStdString();
+
+    // a reader opening the repository doesn't own the journal
+    linglong::repo::RepoCacheJournal other{ journalFile };
+    ASSERT_TRUE(other.tryLock());
+    other.unlock();
+
+    // the process changing the repository owns it until it's closed
+    ASSERT_TRUE(cache->addLayerItem(syntheticLayer(100)).has_value());
+    EXPECT_FALSE(other.tryLock());
+
+    auto ret = linglong::repo::RepoCache::create(dir.filePath("states.json").toStdString(),
+                                                 config,
+                                                 *ostreeRepo);
+    ASSERT_TRUE(ret.has_value());
+    EXPECT_EQ((*ret)->queryLayerItem().size(), 17);
+    ret->reset();
+
+    cache.reset();
+    ASSERT_TRUE(other.tryLock());
+    EXPECT_EQ(other.size(), 1);
+
+    // a rotated journal left by a failed compaction is kept, but the records aren't counted again
+    std::ofstream(journalFile + ".old") << "";
+    auto rotated = other.rotate();
+    ASSERT_TRUE(rotated.has_value());
+    EXPECT_EQ(other.size(), 0);
+}
+
+TEST_F(RepoCacheTest, DISABLED_ColdStartBenchmark)
+{
+    constexpr std::size_t layers = 100000;
+    auto cache = syntheticCache(layers);
+    auto ref = linglong::package::Reference::parse("main:org.deepin.app42/1.0.0.0/x86_64");
+    ASSERT_TRUE(ref.has_value());
+
+    linglong::repo::ClientFactory clientFactory(std::string{ "https://localhost" });
+    auto coldStart = [&]() {
+        auto start = std::chrono::steady_clock::now();
+        linglong::repo::OSTreeRepo repo(QDir(dir.path()), config, clientFactory);
+        // there is no layer directory, but the lookup of the layer still goes through the cache
+        EXPECT_FALSE(repo.getLayerDir(*ref).has_value());
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                 std::chrono::steady_clock::now() - start)
+          .count();
+    };
+
+    std::ofstream(dir.filePath("states.json").toStdString()) << nlohmann::json(cache).dump();
+    auto json = coldStart();
+
+    ASSERT_TRUE(QFile::remove(dir.filePath("states.json")));
+    ASSERT_TRUE(
+      linglong::repo::writeBinaryRepoCache(dir.filePath("states.bin").toStdString(), cache)
+        .has_value());
+    auto binary = coldStart();
+
+    std::cout << "OSTreeRepo cold start with " << layers << " layers: json " << json
+              << "us, binary " << binary << "us" << std::endl;
+}
+
+TEST_F(RepoCacheTest, ImageLayers)
+{
+    // only the header of the layer file is read while rebuilding the cache
+    linglong::api::types::v1::LayerInfo layerInfo{ nlohmann::json(syntheticLayer(0).info), "1" };
+    auto data = QByteArray::fromStdString(nlohmann::json(layerInfo).dump());
+    QByteArray header;
+    QDataStream stream(&header, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_10);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream << quint32(data.size());
+    ASSERT_TRUE(QDir(dir.path()).mkpath("images"));
+    QFile layer(dir.filePath("images/0123abcd.layer"));
+    ASSERT_TRUE(layer.open(QIODevice::WriteOnly));
+    layer.write(linglong::package::magicNumber + header + data);
+    layer.close();
+
+    auto ret = linglong::repo::RepoCache::create(dir.filePath("states.json").toStdString(),
+                                                 config,
+                                                 *ostreeRepo);
+    ASSERT_TRUE(ret.has_value());
+    auto items = (*ret)->queryLayerItem();
+    ASSERT_EQ(items.size(), 1);
+    EXPECT_EQ(items.front().commit, "0123abcd");
+    EXPECT_EQ(items.front().repo, "local");
+    EXPECT_TRUE(items.front().image.value_or(false));
+    EXPECT_EQ(nlohmann::json(items.front().info), nlohmann::json(syntheticLayer(0).info));
+
+    auto cache = syntheticCache(2);
+    cache.layers.back().image = true;
+    ASSERT_TRUE(
+      linglong::repo::writeBinaryRepoCache(dir.filePath("states.bin").toStdString(), cache)
+        .has_value());
+    auto binary = linglong::repo::BinaryRepoCache::open(dir.filePath("states.bin").toStdString());
+    ASSERT_TRUE(binary.has_value());
+    auto layers = (*binary)->layers();
+    ASSERT_TRUE(layers.has_value());
+    ASSERT_EQ(layers->size(), 2);
+    EXPECT_EQ(nlohmann::json(*layers), nlohmann::json(cache.layers));
+}
+
+class LayerImageTest : public RepoCacheTest
+{
+protected:
+    void SetUp() override
+    {
+        // importLayerFile mounts the image with erofsfuse unless the kernel mount is opted in
+        if (QStandardPaths::findExecutable("mkfs.erofs").isEmpty()
+            || QStandardPaths::findExecutable("erofsfuse").isEmpty()) {
+            GTEST_SKIP() << "mkfs.erofs and erofsfuse are required";
+        }
+
+        // the images are mounted with allow_other
+        QFile fuseConf("/etc/fuse.conf");
+        if (::geteuid() != 0
+            && !(fuseConf.open(QIODevice::ReadOnly)
+                 && QString(fuseConf.readAll())
+                      .split('\n')
+                      .contains("user_allow_other"))) {
+            GTEST_SKIP() << "user_allow_other isn't set in /etc/fuse.conf";
+        }
+        RepoCacheTest::SetUp();
+    }
+
+    // writes the layer directory of syntheticLayer(0) with files of lines of text
+    void writeLayerDir(const QDir &source, int files, int lines)
+    {
+        ASSERT_TRUE(source.mkpath("files"));
+        std::ofstream(source.filePath("info.json").toStdString())
+          << nlohmann::json(syntheticLayer(0).info).dump();
+        for (int i = 0; i < files; ++i) {
+            QFile file(source.filePath(QString{ "files/%1" }.arg(i)));
+            ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+            for (int line = 0; line < lines; ++line) {
+                file.write(QString{ "file %1 line %2\n" }.arg(i).arg(line).toUtf8());
+            }
+        }
+    }
+};
+
+TEST_F(LayerImageTest, Install)
+{
+    QDir source(dir.filePath("layer"));
+    writeLayerDir(source, 2, 16);
+    linglong::package::LayerPackager packager(QDir(dir.filePath("work")));
+    auto layerFile = packager.pack(linglong::package::LayerDir(source.path()),
+                                   dir.filePath("app.layer"));
+    ASSERT_TRUE(layerFile.has_value()) << layerFile.error().message().toStdString();
+    auto ref = linglong::package::Reference::fromPackageInfo(syntheticLayer(0).info);
+    ASSERT_TRUE(ref.has_value());
+
+    linglong::repo::ClientFactory clientFactory(std::string{ "https://localhost" });
+    linglong::repo::OSTreeRepo repo(QDir(dir.path()), config, clientFactory);
+    auto imported = repo.importLayerFile(**layerFile);
+    ASSERT_TRUE(imported.has_value()) << imported.error().message().toStdString();
+    EXPECT_TRUE(imported->valid());
+    auto layerDir = repo.getLayerDir(*ref);
+    ASSERT_TRUE(layerDir.has_value()) << layerDir.error().message().toStdString();
+    QFile file(layerDir->filePath("files/1"));
+    EXPECT_TRUE(file.open(QIODevice::ReadOnly));
+    EXPECT_TRUE(file.readAll().startsWith("file 1 line 0\n"));
+    file.close();
+    ASSERT_TRUE(repo.remove(*ref).has_value());
+}
+
+TEST_F(LayerImageTest, DISABLED_Benchmark)
+{
+    auto info = syntheticLayer(0).info;
+    QDir source(dir.filePath("layer"));
+    writeLayerDir(source, 256, 8192);
+
+    linglong::package::LayerPackager packager(QDir(dir.filePath("work")));
+    auto layerFile = packager.pack(linglong::package::LayerDir(source.path()),
+                                   dir.filePath("app.layer"));
+    ASSERT_TRUE(layerFile.has_value()) << layerFile.error().message().toStdString();
+    auto ref = linglong::package::Reference::fromPackageInfo(info);
+    ASSERT_TRUE(ref.has_value());
+
+    linglong::repo::ClientFactory clientFactory(std::string{ "https://localhost" });
+    linglong::repo::OSTreeRepo repo(QDir(dir.path()), config, clientFactory);
+
+    // what installFromLayer did: mount the layer, commit its files and check them out again
+    auto start = std::chrono::steady_clock::now();
+    {
+        linglong::package::LayerPackager unpacker(QDir(dir.filePath("unpack")));
+        auto layerDir = unpacker.unpack(**layerFile);
+        ASSERT_TRUE(layerDir.has_value()) << layerDir.error().message().toStdString();
+        auto imported = repo.importLayerDir(*layerDir);
+        ASSERT_TRUE(imported.has_value()) << imported.error().message().toStdString();
+    }
+    auto extracted = std::chrono::steady_clock::now() - start;
+    ASSERT_TRUE(repo.remove(*ref).has_value());
+
+    start = std::chrono::steady_clock::now();
+    auto imported = repo.importLayerFile(**layerFile);
+    auto image = std::chrono::steady_clock::now() - start;
+    ASSERT_TRUE(imported.has_value()) << imported.error().message().toStdString();
+    EXPECT_TRUE(imported->valid());
+    EXPECT_TRUE(repo.getLayerDir(*ref).has_value());
+    ASSERT_TRUE(repo.remove(*ref).has_value());
+
+    auto ms = [](auto duration) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    };
+    std::cout << "install a layer of " << QFileInfo(dir.filePath("app.layer")).size()
+              << " bytes: extract into ostree " << ms(extracted) << "ms, keep the image "
+              << ms(image) << "ms" << std::endl;
+}
+
+} // namespace
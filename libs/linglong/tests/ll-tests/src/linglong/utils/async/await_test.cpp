@@ -0,0 +1,143 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <gtest/gtest.h>
+
+#include "linglong/repo/client_factory.h"
+#include "linglong/repo/mock_server.h"
+#include "linglong/utils/async/await.h"
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QTimer>
+
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+// the helpers are meant to be used inside a Qt application, like ll-cli
+void ensureApplication()
+{
+    static int argc = 1;
+    static char name[] = "ll-tests";
+    static char *argv[] = { name, nullptr };
+    if (QCoreApplication::instance() == nullptr) {
+        static QCoreApplication app(argc, argv);
+    }
+}
+
+long request(linglong::repo::ClientFactory &factory)
+{
+    auto client = factory.createClientV2();
+    apiClient_invoke(client.get(),
+                     "/api/v1/repos/stable",
+                     nullptr,
+                     nullptr,
+                     nullptr,
+                     nullptr,
+                     nullptr,
+                     nullptr,
+                     "GET");
+    free(client->dataReceived);
+    client->dataReceived = nullptr;
+    return client->response_code;
+}
+
+} // namespace
+
+TEST(AwaitTest, RunAndWait)
+{
+    ensureApplication();
+
+    EXPECT_EQ(linglong::utils::async::runAndWait([]() {
+                  return 42;
+              }),
+              42);
+    EXPECT_THROW(linglong::utils::async::runAndWait([]() -> int {
+                     throw std::runtime_error("failed");
+                 }),
+                 std::runtime_error);
+
+    // events of the calling thread are still handled while waiting
+    bool fired{ false };
+    QTimer::singleShot(0, [&fired]() {
+        fired = true;
+    });
+    linglong::utils::async::runAndWait([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    });
+    EXPECT_TRUE(fired);
+
+    // threads without an event loop, like the workers of a thread pool, just run func
+    std::thread worker([]() {
+        EXPECT_EQ(linglong::utils::async::runAndWait([]() {
+                      return std::this_thread::get_id();
+                  }),
+                  std::this_thread::get_id());
+    });
+    worker.join();
+}
+
+TEST(AwaitTest, WaitUntil)
+{
+    ensureApplication();
+
+    QTimer timer;
+    int ticks{ 0 };
+    QObject::connect(&timer, &QTimer::timeout, [&ticks]() {
+        ++ticks;
+    });
+    timer.start(1);
+    linglong::utils::async::waitUntil(&timer, &QTimer::timeout, [&ticks]() {
+        return ticks >= 3;
+    });
+    EXPECT_EQ(ticks, 3);
+}
+
+TEST(AwaitTest, DISABLED_LatencyBenchmark)
+{
+    ensureApplication();
+    linglong::repo::test::MockServer server;
+    linglong::repo::ClientFactory factory(server.url());
+    constexpr std::size_t rounds = 20;
+
+    // the way listRemote used to wait for a request
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < rounds; ++i) {
+        auto future = std::async(std::launch::async, [&factory]() {
+            return request(factory);
+        });
+        QEventLoop loop;
+        QTimer timer;
+        QObject::connect(&timer, &QTimer::timeout, [&loop, &future]() {
+            if (future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                loop.quit();
+            }
+        });
+        timer.start(100);
+        loop.exec();
+        ASSERT_EQ(future.get(), 200);
+    }
+    auto polled = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < rounds; ++i) {
+        ASSERT_EQ(linglong::utils::async::runAndWait([&factory]() {
+                      return request(factory);
+                  }),
+                  200);
+    }
+    auto signalled = std::chrono::steady_clock::now() - start;
+
+    EXPECT_LT(signalled, polled);
+    std::cout << rounds << " requests: polled every 100ms "
+              << std::chrono::duration_cast<std::chrono::microseconds>(polled).count() / rounds
+              << "us each, signalled "
+              << std::chrono::duration_cast<std::chrono::microseconds>(signalled).count() / rounds
+              << "us each" << std::endl;
+}
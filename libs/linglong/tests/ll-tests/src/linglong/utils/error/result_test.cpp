@@ -6,10 +6,38 @@
 
 #include <gtest/gtest.h>
 
+#include "linglong/api/types/v1/Generators.hpp"
+#include "linglong/package/fuzzy_reference.h"
 #include "linglong/utils/error/error.h"
 
+#include <chrono>
+#include <iostream>
+
 using namespace linglong::utils::error;
 
+namespace {
+
+QString countedMessage(int &built)
+{
+    ++built;
+    return "counted";
+}
+
+template<typename Func>
+std::chrono::nanoseconds perCall(std::size_t rounds, Func func)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < rounds; ++i) {
+        if (!func()) {
+            ADD_FAILURE() << "unexpected error";
+            break;
+        }
+    }
+    return (std::chrono::steady_clock::now() - start) / rounds;
+}
+
+} // namespace
+
 TEST(Error, New)
 {
     auto res = []() -> Result<void> {
@@ -64,3 +92,70 @@ TEST(Error, Wrap)
     ASSERT_EQ(res.error().code(), -1);
     ASSERT_EQ(res.error().message().contains("error"), true);
 }
+
+TEST(Error, LazyTrace)
+{
+    int built = 0;
+    auto fn = [&built](bool fail) -> Result<void> {
+        LINGLONG_TRACE(countedMessage(built));
+        if (fail) {
+            return LINGLONG_ERR("failed");
+        }
+
+        return LINGLONG_OK;
+    };
+
+    ASSERT_TRUE(fn(false).has_value());
+    EXPECT_EQ(built, 0);
+
+    auto res = fn(true);
+    ASSERT_FALSE(res.has_value());
+    EXPECT_EQ(built, 1);
+    EXPECT_TRUE(res.error().message().contains("counted"));
+
+    res = [](QString name) -> Result<void> {
+        LINGLONG_TRACE(QString("trace %1").arg(name));
+        name = "changed";
+        return LINGLONG_ERR("failed");
+    }("origin");
+    ASSERT_FALSE(res.has_value());
+    EXPECT_TRUE(res.error().message().contains("trace changed"));
+}
+
+// the overhead of the trace messages used on the paths of OSTreeRepo::clearReference and
+// ContainerBuilder::create, which succeed most of the time
+TEST(Error, DISABLED_TraceBenchmark)
+{
+    constexpr std::size_t rounds = 100000;
+    auto fuzzy = linglong::package::FuzzyReference::parse("stable:org.deepin.demo/1.0.0/x86_64");
+    ASSERT_TRUE(fuzzy.has_value());
+    linglong::api::types::v1::OciConfigurationPatch patch{ "1.0.1", {} };
+    patch.patch.push_back(nlohmann::json::parse(
+      R"({"op":"add","path":"/mounts/-","value":{"type":"bind","source":"/tmp"}})"));
+
+    auto eagerClear = perCall(rounds, [&fuzzy]() -> Result<void> {
+        QString linglong_trace_message = "clear fuzzy reference " + fuzzy->toString();
+        return LINGLONG_OK;
+    });
+    auto lazyClear = perCall(rounds, [&fuzzy]() -> Result<void> {
+        LINGLONG_TRACE("clear fuzzy reference " + fuzzy->toString());
+        return LINGLONG_OK;
+    });
+    auto eagerPatch = perCall(rounds, [&patch]() -> Result<void> {
+        QString linglong_trace_message =
+          QString("apply oci runtime config patch %1")
+            .arg(QString::fromStdString(nlohmann::json(patch).dump(-1, ' ', true)));
+        return LINGLONG_OK;
+    });
+    auto lazyPatch = perCall(rounds, [&patch]() -> Result<void> {
+        LINGLONG_TRACE(QString("apply oci runtime config patch %1")
+                         .arg(QString::fromStdString(nlohmann::json(patch).dump(-1, ' ', true))));
+        return LINGLONG_OK;
+    });
+
+    EXPECT_LT(lazyClear, eagerClear);
+    EXPECT_LT(lazyPatch, eagerPatch);
+    std::cout << "trace per call: clearReference " << eagerClear.count() << "ns -> "
+              << lazyClear.count() << "ns, ContainerBuilder::create " << eagerPatch.count()
+              << "ns -> " << lazyPatch.count() << "ns" << std::endl;
+}
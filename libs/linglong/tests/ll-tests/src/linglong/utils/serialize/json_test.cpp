@@ -0,0 +1,115 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/utils/serialize/json.h"
+
+#include <QJsonObject>
+
+#include <chrono>
+#include <iostream>
+
+using namespace linglong::utils::serialize;
+using linglong::api::types::v1::PackageManager1SearchResult;
+
+namespace {
+
+PackageManager1SearchResult searchResult(std::size_t count)
+{
+    PackageManager1SearchResult result{ std::vector<linglong::api::types::v1::PackageInfoV2>{},
+                                        0,
+                                        "" };
+    for (std::size_t i = 0; i < count; ++i) {
+        linglong::api::types::v1::PackageInfoV2 info;
+        info.arch = { "x86_64" };
+        info.base = "main:org.deepin.base/23.1.0/x86_64";
+        info.channel = "main";
+        info.command = std::vector<std::string>{ "demo", "--flag" };
+        info.description = "demo application " + std::to_string(i);
+        info.id = "org.deepin.demo" + std::to_string(i);
+        info.kind = "app";
+        info.packageInfoV2Module = "binary";
+        info.name = "demo";
+        info.runtime = "main:org.deepin.runtime.dtk/23.1.0/x86_64";
+        info.schemaVersion = "1.0";
+        info.size = static_cast<int64_t>(i) * 1024;
+        info.version = "1.0.0." + std::to_string(i);
+        result.packages->push_back(std::move(info));
+    }
+    return result;
+}
+
+// the conversion used before, through the json text
+QVariantMap textToQVariantMap(const PackageManager1SearchResult &result)
+{
+    return toQJsonDocument(result).object().toVariantMap();
+}
+
+} // namespace
+
+TEST(Serialize, QVariantMatchesJsonText)
+{
+    auto result = searchResult(3);
+    result.code = -1;
+    result.message = "中文 \"quoted\"";
+
+    auto map = toQVariantMap(result);
+    EXPECT_EQ(map, textToQVariantMap(result));
+
+    auto back = fromQVariantMap<PackageManager1SearchResult>(map);
+    ASSERT_TRUE(back.has_value()) << back.error().message().toStdString();
+    EXPECT_EQ(nlohmann::json(*back), nlohmann::json(result));
+
+    back = fromQVariantMap<PackageManager1SearchResult>(textToQVariantMap(result));
+    ASSERT_TRUE(back.has_value()) << back.error().message().toStdString();
+    EXPECT_EQ(nlohmann::json(*back), nlohmann::json(result));
+}
+
+TEST(Serialize, FromQVariantTypes)
+{
+    QVariantMap map{ { "int", 1 },
+                     { "uint", 2U },
+                     { "double", 1.5 },
+                     { "integral", 3.0 },
+                     { "bool", true },
+                     { "string", "str" },
+                     { "list", QStringList{ "a", "b" } },
+                     { "null", QVariant::fromValue(nullptr) } };
+
+    auto json = fromQVariant(map);
+    EXPECT_EQ(json,
+              nlohmann::json::parse(
+                R"({"int":1,"uint":2,"double":1.5,"integral":3,"bool":true,"string":"str",)"
+                R"("list":["a","b"],"null":null})"));
+    EXPECT_EQ(toQVariant(json).toMap().value("integral").userType(), QMetaType::Double);
+}
+
+TEST(Serialize, DISABLED_QVariantBenchmark)
+{
+    auto result = searchResult(5000);
+
+    auto start = std::chrono::steady_clock::now();
+    auto textMap = textToQVariantMap(result);
+    auto textBack =
+      fromQJsonObject<PackageManager1SearchResult>(QJsonObjectfromVariantMap(textMap));
+    auto text = std::chrono::steady_clock::now() - start;
+    ASSERT_TRUE(textBack.has_value());
+
+    start = std::chrono::steady_clock::now();
+    auto map = toQVariantMap(result);
+    auto back = fromQVariantMap<PackageManager1SearchResult>(map);
+    auto direct = std::chrono::steady_clock::now() - start;
+    ASSERT_TRUE(back.has_value());
+    EXPECT_EQ(back->packages->size(), 5000);
+
+    EXPECT_LT(direct, text);
+    std::cout << "5000 packages to QVariantMap and back: through text "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(text).count()
+              << "ms, direct "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(direct).count() << "ms"
+              << std::endl;
+}
@@ -0,0 +1,74 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "linglong/utils/finally/finally.h"
+
+#include <QAbstractEventDispatcher>
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QMetaObject>
+#include <QThread>
+
+#include <future>
+#include <type_traits>
+
+namespace linglong::utils::async {
+
+// Runs func and returns its result. On the main thread of the application, or on a thread running
+// an event loop, func runs on a new thread while the calling thread keeps handling its Qt events,
+// and is woken up by a queued call as soon as func returns, so there is no polling delay. Other
+// threads, e.g. the workers of a QThreadPool, have no events to handle, func simply runs on them.
+template<typename Func>
+std::invoke_result_t<std::decay_t<Func>> runAndWait(Func &&func)
+{
+    auto *thread = QThread::currentThread();
+    auto *app = QCoreApplication::instance();
+    auto handleEvents = QAbstractEventDispatcher::instance(thread) != nullptr
+      && (thread->loopLevel() > 0 || (app != nullptr && thread == app->thread()));
+    if (!handleEvents) {
+        return std::forward<Func>(func)();
+    }
+
+    QEventLoop loop;
+    auto job = [&loop, func = std::forward<Func>(func)]() mutable {
+        auto wake = utils::finally::finally([&loop]() {
+            QMetaObject::invokeMethod(
+              &loop,
+              [&loop]() {
+                  loop.quit();
+              },
+              Qt::QueuedConnection);
+        });
+        return func();
+    };
+    auto future = std::async(std::launch::async, std::move(job));
+
+    // the queued quit is only delivered inside exec, it couldn't be missed
+    loop.exec();
+    return future.get();
+}
+
+// Handles Qt events until done() holds, done is checked again every time signal of sender is
+// emitted.
+template<typename Sender, typename Signal, typename Predicate>
+void waitUntil(const Sender *sender, Signal signal, Predicate done)
+{
+    if (done()) {
+        return;
+    }
+
+    QEventLoop loop;
+    QObject::connect(sender, signal, &loop, [&loop, &done]() {
+        if (done()) {
+            loop.quit();
+        }
+    });
+    loop.exec();
+}
+
+} // namespace linglong::utils::async
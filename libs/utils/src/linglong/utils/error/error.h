@@ -259,10 +259,36 @@ private:
 template<typename Value>
 using Result = tl::expected<Value, Error>;
 
+namespace details {
+
+// LazyTrace holds how to build a trace message, so the message costs nothing until an error is
+// actually created with it.
+template<typename Builder>
+class LazyTrace
+{
+public:
+    explicit LazyTrace(Builder builder) noexcept
+        : builder(std::move(builder))
+    {
+    }
+
+    operator QString() const { return this->builder(); } // NOLINT
+
+private:
+    Builder builder;
+};
+
+} // namespace details
+
 } // namespace linglong::utils::error
 
-// Use this macro to define trace message at the begining of function
-#define LINGLONG_TRACE(message) QString linglong_trace_message = message;
+// Use this macro to define trace message at the begining of function. The message is only
+// evaluated when LINGLONG_ERR is used, with the values its variables have at that time.
+#define LINGLONG_TRACE(message)                                                 \
+    [[maybe_unused]] const ::linglong::utils::error::details::LazyTrace         \
+      linglong_trace_message([&]() -> QString { /*NOLINT*/                      \
+          return message;                                                       \
+      });
 
 // Use this macro to create new error or wrap an existing error
 // LINGLONG_ERR(message, code =-1)
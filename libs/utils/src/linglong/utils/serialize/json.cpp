@@ -8,6 +8,9 @@
 
 #include <qdbusargument.h>
 
+#include <cmath>
+#include <limits>
+
 namespace linglong::utils::serialize {
 namespace {
 static QVariant decodeQDBusArgument(const QVariant &v)
@@ -53,4 +56,116 @@ QJsonObject QJsonObjectfromVariantMap(const QVariantMap &map) noexcept
     }
     return QJsonObject::fromVariantMap(newMap);
 }
+
+QVariant toQVariant(const nlohmann::json &json) noexcept
+{
+    switch (json.type()) {
+    case nlohmann::json::value_t::object: {
+        QVariantMap map;
+        for (const auto &[key, value] : json.items()) {
+            map.insert(QString::fromStdString(key), toQVariant(value));
+        }
+        return map;
+    }
+    case nlohmann::json::value_t::array: {
+        QVariantList list;
+        list.reserve(static_cast<int>(json.size()));
+        for (const auto &value : json) {
+            list.append(toQVariant(value));
+        }
+        return list;
+    }
+    case nlohmann::json::value_t::string:
+        return QString::fromStdString(json.get_ref<const std::string &>());
+    case nlohmann::json::value_t::boolean:
+        return json.get<bool>();
+    // numbers are doubles in QJsonValue, keep them so for the types on D-Bus
+    case nlohmann::json::value_t::number_integer:
+    case nlohmann::json::value_t::number_unsigned:
+    case nlohmann::json::value_t::number_float:
+        return json.get<double>();
+    case nlohmann::json::value_t::null:
+        return QVariant::fromValue(nullptr);
+    default:
+        return QVariant{};
+    }
+}
+
+nlohmann::json fromQVariant(const QVariant &variant) noexcept
+{
+    if (variant.canConvert<QDBusArgument>()) {
+        return fromQVariant(decodeQDBusArgument(variant));
+    }
+
+    switch (variant.userType()) {
+    case QMetaType::QVariantMap: {
+        auto json = nlohmann::json::object();
+        const auto map = variant.toMap();
+        for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
+            json[it.key().toStdString()] = fromQVariant(it.value());
+        }
+        return json;
+    }
+    case QMetaType::QVariantHash: {
+        auto json = nlohmann::json::object();
+        const auto hash = variant.toHash();
+        for (auto it = hash.constBegin(); it != hash.constEnd(); ++it) {
+            json[it.key().toStdString()] = fromQVariant(it.value());
+        }
+        return json;
+    }
+    case QMetaType::QVariantList: {
+        auto json = nlohmann::json::array();
+        const auto list = variant.toList();
+        for (const auto &value : list) {
+            json.push_back(fromQVariant(value));
+        }
+        return json;
+    }
+    case QMetaType::QStringList: {
+        auto json = nlohmann::json::array();
+        const auto list = variant.toStringList();
+        for (const auto &value : list) {
+            json.push_back(value.toStdString());
+        }
+        return json;
+    }
+    case QMetaType::QString:
+    case QMetaType::QByteArray:
+        return variant.toString().toStdString();
+    case QMetaType::Bool:
+        return variant.toBool();
+    case QMetaType::Int:
+    case QMetaType::Short:
+    case QMetaType::Long:
+    case QMetaType::LongLong:
+        return variant.toLongLong();
+    case QMetaType::UInt:
+    case QMetaType::UShort:
+    case QMetaType::ULong:
+    case QMetaType::ULongLong:
+    case QMetaType::UChar:
+        return variant.toULongLong();
+    case QMetaType::Double:
+    case QMetaType::Float: {
+        // integral doubles are read back as integers, as they were when parsed from the text
+        auto number = variant.toDouble();
+        if (std::trunc(number) == number && std::abs(number) < 0x1p63) {
+            return static_cast<int64_t>(number);
+        }
+        return number;
+    }
+    case QMetaType::UnknownType:
+    case QMetaType::Nullptr:
+        return nullptr;
+    default: {
+        auto str = variant.toString();
+        if (str.isEmpty()) {
+            return nullptr;
+        }
+        return str.toStdString();
+    }
+    }
+}
+
 } // namespace linglong::utils::serialize
@@ -22,6 +22,11 @@ namespace linglong::utils::serialize {
 
 QJsonObject QJsonObjectfromVariantMap(const QVariantMap &vmap) noexcept;
 
+// Converts between json and QVariant by walking the trees, the result is the same as going
+// through QJsonDocument but without dumping and parsing the text.
+QVariant toQVariant(const nlohmann::json &json) noexcept;
+nlohmann::json fromQVariant(const QVariant &variant) noexcept;
+
 template<typename T>
 QJsonDocument toQJsonDocument(const T &x) noexcept
 {
@@ -33,9 +38,9 @@ QJsonDocument toQJsonDocument(const T &x) noexcept
 template<typename T>
 QVariantMap toQVariantMap(const T &x) noexcept
 {
-    QJsonDocument doc = toQJsonDocument(x);
-    Q_ASSERT(doc.isObject());
-    return doc.object().toVariantMap();
+    nlohmann::json json = x;
+    Q_ASSERT(json.is_object());
+    return toQVariant(json).toMap();
 }
 
 template<typename T, typename Source>
@@ -172,7 +177,8 @@ error::Result<T> fromQJsonValue(const QJsonValue &v) noexcept
 template<typename T>
 error::Result<T> fromQVariantMap(const QVariantMap &vmap)
 {
-    return fromQJsonObject<T>(QJsonObjectfromVariantMap(vmap));
+    const nlohmann::json json = fromQVariant(vmap);
+    return LoadJSON<T>(json);
 }
 
 } // namespace linglong::utils::serialize
@@ -0,0 +1,153 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "linglong/utils/serialize/json_list_stream.h"
+
+namespace linglong::utils::serialize {
+
+JsonListStream::JsonListStream(std::string key,
+                               std::function<void(nlohmann::json &&)> handler) noexcept
+    : key(std::move(key))
+    , handler(std::move(handler))
+{
+}
+
+void JsonListStream::put(char c) noexcept
+{
+    if (this->inList && this->depth >= 2) {
+        this->entry.push_back(c);
+        return;
+    }
+
+    this->envelope.push_back(c);
+}
+
+bool JsonListStream::emit() noexcept
+{
+    if (this->entry.find_first_not_of(" \t\r\n") == std::string::npos) {
+        this->entry.clear();
+        return true;
+    }
+
+    auto json = nlohmann::json::parse(this->entry, nullptr, false);
+    this->entry.clear();
+    if (json.is_discarded()) {
+        return false;
+    }
+
+    try {
+        this->handler(std::move(json));
+    } catch (const std::exception &e) {
+        qWarning() << "failed to handle list entry:" << e.what();
+        return false;
+    }
+
+    return true;
+}
+
+bool JsonListStream::feed(std::string_view chunk) noexcept
+{
+    for (auto c : chunk) {
+        if (this->failed) {
+            return false;
+        }
+
+        if (this->inString) {
+            if (this->escaped) {
+                this->escaped = false;
+            } else if (c == '\\') {
+                this->escaped = true;
+            } else if (c == '"') {
+                this->inString = false;
+                this->capturingKey = false;
+                this->put(c);
+                continue;
+            }
+
+            if (this->capturingKey) {
+                this->currentKey.push_back(c);
+            }
+            this->put(c);
+            continue;
+        }
+
+        switch (c) {
+        case '"':
+            this->inString = true;
+            if (this->depth == 1 && this->expectKey) {
+                this->capturingKey = true;
+                this->expectKey = false;
+                this->currentKey.clear();
+            }
+            this->put(c);
+            break;
+        case '[':
+            if (this->depth == 1 && this->valueKey == this->key) {
+                this->inList = true;
+                this->valueKey.clear();
+                this->envelope.push_back(c);
+                ++this->depth;
+                break;
+            }
+            [[fallthrough]];
+        case '{':
+            ++this->depth;
+            this->put(c);
+            this->expectKey = this->depth == 1;
+            break;
+        case ']':
+            if (this->inList && this->depth == 2) {
+                this->failed = !this->emit();
+                this->inList = false;
+                --this->depth;
+                this->envelope.push_back(c);
+                break;
+            }
+            [[fallthrough]];
+        case '}':
+            this->put(c);
+            this->failed = --this->depth < 0;
+            break;
+        case ',':
+            if (this->inList && this->depth == 2) {
+                this->failed = !this->emit();
+                break;
+            }
+            this->expectKey = this->depth == 1;
+            this->put(c);
+            break;
+        case ':':
+            if (this->depth == 1) {
+                this->valueKey = this->currentKey;
+            }
+            this->put(c);
+            break;
+        default:
+            this->put(c);
+            break;
+        }
+    }
+
+    return !this->failed;
+}
+
+error::Result<nlohmann::json> JsonListStream::finish() noexcept
+{
+    LINGLONG_TRACE("finish json list stream of " + QString::fromStdString(this->key));
+
+    if (this->failed || this->depth != 0 || this->inString) {
+        return LINGLONG_ERR("malformed or truncated json");
+    }
+
+    auto json = nlohmann::json::parse(this->envelope, nullptr, false);
+    if (json.is_discarded()) {
+        return LINGLONG_ERR("malformed json");
+    }
+
+    return json;
+}
+
+} // namespace linglong::utils::serialize
@@ -0,0 +1,50 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "linglong/utils/error/error.h"
+#include "nlohmann/json.hpp"
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace linglong::utils::serialize {
+
+// JsonListStream parses a json object like {"code":200,"data":[...]} chunk by chunk, entries of
+// the list under `key` are handed to the handler as soon as they are complete, so the whole
+// document is never held in memory.
+class JsonListStream
+{
+public:
+    JsonListStream(std::string key, std::function<void(nlohmann::json &&)> handler) noexcept;
+
+    // returns false once the input is known to be malformed
+    bool feed(std::string_view chunk) noexcept;
+    // returns the object with the streamed list left empty
+    error::Result<nlohmann::json> finish() noexcept;
+
+private:
+    void put(char c) noexcept;
+    bool emit() noexcept;
+
+    std::string key;
+    std::function<void(nlohmann::json &&)> handler;
+    std::string envelope;
+    std::string entry;
+    std::string currentKey;
+    std::string valueKey;
+    int depth{ 0 };
+    bool inString{ false };
+    bool escaped{ false };
+    bool expectKey{ false };
+    bool capturingKey{ false };
+    bool inList{ false };
+    bool failed{ false };
+};
+
+} // namespace linglong::utils::serialize